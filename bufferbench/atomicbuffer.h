@@ -0,0 +1,90 @@
+#ifndef ATOMIC_BUFFER_H
+#define ATOMIC_BUFFER_H
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+/**
+ * @brief 对照组: 改为单线程所有之前的Buffer
+ * 读写位置为std::atomic, 存储为std::vector<char>, RetrieveAll清零整个容量, 空间不足时总是先整理
+*/
+class AtomicBuffer {
+public:
+    explicit AtomicBuffer(int initBuffSize = 1024) : buffer_(initBuffSize), readPos_(0), writePos_(0) {}
+
+    size_t WritableBytes() const { return buffer_.size() - writePos_; }
+    size_t ReadableBytes() const { return writePos_ - readPos_; }
+    size_t PrependableBytes() const { return readPos_; }
+    const char* Peek() const { return &*buffer_.begin() + readPos_; }
+    char* BeginWrite() { return &*buffer_.begin() + writePos_; }
+    void HasWritten(size_t len) { writePos_ += len; }
+
+    void EnsureWriteable(size_t len) {
+        if (WritableBytes() < len) {
+            MakeSpace_(len);
+        }
+        assert(WritableBytes() >= len);
+    }
+
+    void Retrieve(size_t len) {
+        assert(len <= ReadableBytes());
+        readPos_ += len;
+    }
+
+    void RetrieveAll() {
+        bzero(&buffer_[0], buffer_.size());
+        readPos_ = 0;
+        writePos_ = 0;
+    }
+
+    void Append(const char* str, size_t len) {
+        assert(str);
+        EnsureWriteable(len);
+        std::copy(str, str + len, BeginWrite());
+        HasWritten(len);
+    }
+
+    ssize_t ReadFd(int fd, int* saveErrno) {
+        char buff[65535];
+        struct iovec iov[2];
+        const size_t writable = WritableBytes();
+        iov[0].iov_base = BeginWrite();
+        iov[0].iov_len = writable;
+        iov[1].iov_base = buff;
+        iov[1].iov_len = sizeof(buff);
+        const ssize_t len = readv(fd, iov, 2);
+        if (len < 0) {
+            *saveErrno = errno;
+        } else if (static_cast<size_t>(len) <= writable) {
+            writePos_ += len;
+        } else {
+            writePos_ = buffer_.size();
+            Append(buff, len - writable);
+        }
+        return len;
+    }
+
+private:
+    void MakeSpace_(size_t len) {
+        if (WritableBytes() + PrependableBytes() < len) {
+            buffer_.resize(writePos_ + len + 1);
+        } else {
+            size_t readable = ReadableBytes();
+            std::copy(&buffer_[0] + readPos_, &buffer_[0] + writePos_, &buffer_[0]);
+            readPos_ = 0;
+            writePos_ = readable;
+        }
+    }
+
+    std::vector<char> buffer_;
+    std::atomic<std::size_t> readPos_;
+    std::atomic<std::size_t> writePos_;
+};
+
+#endif
@@ -0,0 +1,126 @@
+/**
+ * @brief Buffer微基准: 对比原子读写位置的旧实现(AtomicBuffer)与当前单线程所有的Buffer
+ * 每个场景跑若干轮取最快的一轮, 输出每次操作的纳秒数
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <functional>
+
+#include "../code/buffer/buffer.h"
+#include "atomicbuffer.h"
+
+static const int ROUNDS = 5;
+static unsigned long sink = 0;  // 累加读到的字节, 防止循环被优化掉
+
+/**
+ * @brief 跑ROUNDS轮, 返回最快一轮每次操作的纳秒数
+*/
+static double Measure(long ops, const std::function<void()>& body) {
+    double best = 0;
+    for (int i = 0; i < ROUNDS; i++) {
+        auto start = std::chrono::steady_clock::now();
+        body();
+        std::chrono::duration<double, std::nano> cost = std::chrono::steady_clock::now() - start;
+        if (i == 0 || cost.count() < best) {
+            best = cost.count();
+        }
+    }
+    return best / ops;
+}
+
+/**
+ * @brief 请求解析: 每次追加一行64字节, 积累超过2KB时取走除最后32字节以外的数据
+ * 剩下的半行要整理到开头, 覆盖Append/Retrieve/MakeSpace_
+*/
+template <class B>
+static double AppendRetrieve(long ops) {
+    char line[64];
+    memset(line, 'a', sizeof(line));
+    return Measure(ops, [&]() {
+        B buff(1024);
+        for (long i = 0; i < ops; i++) {
+            buff.Append(line, sizeof(line));
+            if (buff.ReadableBytes() > 2048) {
+                sink += buff.Peek()[0];
+                buff.Retrieve(buff.ReadableBytes() - 32);
+            }
+        }
+    });
+}
+
+/**
+ * @brief keep-alive响应: 同一个缓冲区追加8行响应头和512字节响应体, 发送后RetrieveAll
+*/
+template <class B>
+static double ResponseCycle(long ops) {
+    char header[40];
+    char body[512];
+    memset(header, 'h', sizeof(header));
+    memset(body, 'b', sizeof(body));
+    return Measure(ops, [&]() {
+        B buff(1024);
+        for (long i = 0; i < ops; i++) {
+            for (int j = 0; j < 8; j++) {
+                buff.Append(header, sizeof(header));
+            }
+            buff.Append(body, sizeof(body));
+            sink += buff.ReadableBytes();
+            buff.RetrieveAll();
+        }
+    });
+}
+
+/**
+ * @brief 从socketpair读: 对端每次写size字节, ReadFd读出后RetrieveAll
+ * size超过初始容量时数据经溢出缓冲区再追加
+*/
+template <class B>
+static double ReadFd(long ops, size_t size) {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+        perror("socketpair");
+        exit(1);
+    }
+    char* data = new char[size];
+    memset(data, 'r', size);
+    double ns = Measure(ops, [&]() {
+        B buff(1024);
+        int err = 0;
+        for (long i = 0; i < ops; i++) {
+            if (write(fds[1], data, size) != static_cast<ssize_t>(size)) {
+                perror("write");
+                exit(1);
+            }
+            while (buff.ReadableBytes() < size) {
+                if (buff.ReadFd(fds[0], &err) <= 0) {
+                    perror("readv");
+                    exit(1);
+                }
+            }
+            sink += buff.ReadableBytes();
+            buff.RetrieveAll();
+        }
+    });
+    delete[] data;
+    close(fds[0]);
+    close(fds[1]);
+    return ns;
+}
+
+static void Report(const char* name, double atomicNs, double plainNs) {
+    printf("%-22s %12.1f %12.1f %9.2fx\n", name, atomicNs, plainNs, atomicNs / plainNs);
+}
+
+int main(int argc, char* argv[]) {
+    long ops = argc > 1 ? atol(argv[1]) : 2000000;
+    printf("%-22s %12s %12s %10s\n", "ns/op", "atomic", "plain", "speedup");
+    Report("append+retrieve", AppendRetrieve<AtomicBuffer>(ops), AppendRetrieve<Buffer>(ops));
+    Report("response+RetrieveAll", ResponseCycle<AtomicBuffer>(ops), ResponseCycle<Buffer>(ops));
+    Report("ReadFd 512B", ReadFd<AtomicBuffer>(ops / 10, 512), ReadFd<Buffer>(ops / 10, 512));
+    Report("ReadFd 16KB", ReadFd<AtomicBuffer>(ops / 20, 16 * 1024), ReadFd<Buffer>(ops / 20, 16 * 1024));
+    return sink == 0;
+}
@@ -0,0 +1,87 @@
+#include "arena.h"
+
+#include <algorithm>
+#include <cstring>
+
+/**
+ * @brief 构造函数, 首个块在第一次分配时才申请
+ * @param blockSize 默认块大小
+ */
+Arena::Arena(size_t blockSize) : blockSize_(blockSize), cur_(nullptr), end_(nullptr), used_(0) {
+  assert(blockSize_ > 0);
+}
+
+/**
+ * @brief 分配len个字节
+ * @param len 字节数
+ * @param align 对齐, 必须是2的幂
+ */
+char* Arena::Allocate(size_t len, size_t align) {
+  assert(align && (align & (align - 1)) == 0);
+  size_t pad = (align - reinterpret_cast<uintptr_t>(cur_) % align) % align;
+  if (cur_ == nullptr || static_cast<size_t>(end_ - cur_) < len + pad) {
+    NewBlock_(len + align - 1);
+    pad = (align - reinterpret_cast<uintptr_t>(cur_) % align) % align;
+  }
+  char* ptr = cur_ + pad;
+  cur_ = ptr + len;
+  used_ += len + pad;
+  return ptr;
+}
+
+/**
+ * @brief 复制字符串
+ * @param str 源字符串
+ */
+std::string_view Arena::Copy(std::string_view str) {
+  char* ptr = Allocate(str.size() + 1);
+  memcpy(ptr, str.data(), str.size());
+  ptr[str.size()] = '\0';
+  return std::string_view(ptr, str.size());
+}
+
+/**
+ * @brief 拼接字符串
+ * @param a 前半部分
+ * @param b 后半部分
+ */
+std::string_view Arena::Concat(std::string_view a, std::string_view b) {
+  char* ptr = Allocate(a.size() + b.size() + 1);
+  memcpy(ptr, a.data(), a.size());
+  memcpy(ptr + a.size(), b.data(), b.size());
+  ptr[a.size() + b.size()] = '\0';
+  return std::string_view(ptr, a.size() + b.size());
+}
+
+/**
+ * @brief 重置arena
+ * 如果上个请求用了多个块, 合并成一个足够大的块, 使下个同样大小的请求只需一个块
+ */
+void Arena::Reset() {
+  if (blocks_.size() > 1) {
+    size_t total = std::min(std::max(used_, blockSize_), MAX_KEEP_SIZE);
+    blocks_.clear();
+    NewBlock_(total);
+  } else if (!blocks_.empty() && blocks_.back().size > MAX_KEEP_SIZE) {
+    blocks_.clear();
+  }
+  if (blocks_.empty()) {
+    cur_ = end_ = nullptr;
+  } else {
+    cur_ = blocks_.back().data.get();
+    end_ = cur_ + blocks_.back().size;
+  }
+  used_ = 0;
+}
+
+/**
+ * @brief 申请新块
+ * @param len 至少需要的字节数
+ */
+char* Arena::NewBlock_(size_t len) {
+  size_t size = std::max(len, blockSize_);
+  blocks_.push_back({std::unique_ptr<char[]>(new char[size]), size});
+  cur_ = blocks_.back().data.get();
+  end_ = cur_ + size;
+  return cur_;
+}
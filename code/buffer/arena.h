@@ -0,0 +1,66 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+#include <string_view>
+#include <vector>
+
+/**
+ * @brief 单请求的线性(bump-pointer)分配器
+ * 每个请求的数据都从这里切出, 下一个请求开始时整体Reset, 不逐个释放
+*/
+class Arena {
+public:
+    explicit Arena(size_t blockSize = 4096);
+    ~Arena() = default;
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    /**
+     * @brief 分配len个字节, 按align对齐
+    */
+    char* Allocate(size_t len, size_t align = 1);
+
+    /**
+     * @brief 将字符串复制进arena, 结尾补'\0'
+    */
+    std::string_view Copy(std::string_view str);
+
+    /**
+     * @brief 拼接两个字符串, 结尾补'\0'
+    */
+    std::string_view Concat(std::string_view a, std::string_view b);
+
+    /**
+     * @brief 释放全部分配, 保留一个足以容纳上个请求的块
+    */
+    void Reset();
+
+    /**
+     * @brief 已分配字节数
+    */
+    size_t Used() const { return used_; }
+
+private:
+    struct Block {
+        std::unique_ptr<char[]> data;
+        size_t size;
+    };
+
+    char* NewBlock_(size_t len);
+
+    static constexpr size_t MAX_KEEP_SIZE = 64 * 1024; // Reset后最多保留的块大小
+
+    size_t blockSize_;          // 默认块大小
+    std::vector<Block> blocks_; // 已分配的块, back()为当前块
+    char* cur_;                 // 当前块的分配位置
+    char* end_;                 // 当前块的末尾
+    size_t used_;               // 已分配字节数
+};
+
+#endif
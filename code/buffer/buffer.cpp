@@ -1,10 +1,23 @@
 #include "buffer.h"
 
+#include <algorithm>
+
+/**
+ * @brief 构造函数, 内存在第一次写入时申请
+ * @param initBuffSize 第一次申请的大小
+ */
+Buffer::Buffer(int initBuffSize)
+    : buffer_(nullptr),
+      chunk_(nullptr),
+      capacity_(0),
+      initSize_(initBuffSize),
+      readPos_(0),
+      writePos_(0) {}
+
 /**
- * @brief 构造函数
- * @param initBuffSize 缓冲区大小
+ * @brief 析构函数
  */
-Buffer::Buffer(int initBuffSize) : buffer_(initBuffSize), readPos_(0), writePos_(0) {}
+Buffer::~Buffer() { Free_(); }
 
 /**
  * @brief 返回可读字节数
@@ -14,7 +27,7 @@ size_t Buffer::ReadableBytes() const { return writePos_ - readPos_; }
 /**
  * @brief 返回可写字节数
  */
-size_t Buffer::WritableBytes() const { return buffer_.size() - writePos_; }
+size_t Buffer::WritableBytes() const { return capacity_ - writePos_; }
 
 /**
  * @brief 返回预留空间字节数
@@ -26,6 +39,46 @@ size_t Buffer::PrependableBytes() const { return readPos_; }
  */
 const char* Buffer::Peek() const { return BeginPtr_() + readPos_; }
 
+/**
+ * @brief 查找字符串
+ * @param start 查找的起点, 位于可读数据中
+ * @param str 目标字符串
+ */
+const char* Buffer::Find(const char* start, std::string_view str) const {
+  assert(Peek() <= start && start <= BeginWriteConst());
+  size_t pos = std::string_view(start, BeginWriteConst() - start).find(str);
+  return pos == std::string_view::npos ? nullptr : start + pos;
+}
+
+/**
+ * @brief 查找\r\n: 用memchr找\r, 比逐字节匹配两个字符快
+ * @param start 查找的起点, 位于可读数据中
+ */
+const char* Buffer::FindCRLF(const char* start) const {
+  assert(Peek() <= start && start <= BeginWriteConst());
+  const char* end = BeginWriteConst();
+  while (start < end) {
+    const char* cr = static_cast<const char*>(memchr(start, '\r', end - start));
+    if (!cr || cr + 1 == end) {
+      return nullptr;
+    }
+    if (cr[1] == '\n') {
+      return cr;
+    }
+    start = cr + 1;
+  }
+  return nullptr;
+}
+
+/**
+ * @brief 查找\n
+ * @param start 查找的起点, 位于可读数据中
+ */
+const char* Buffer::FindEOL(const char* start) const {
+  assert(Peek() <= start && start <= BeginWriteConst());
+  size_t len = BeginWriteConst() - start;
+  return len > 0 ? static_cast<const char*>(memchr(start, '\n', len)) : nullptr;
+}
 /**
  * @brief 确保缓冲区有足够的空间存放len个字节
  */
@@ -47,12 +100,15 @@ char* Buffer::BeginWrite() { return BeginPtr_() + writePos_; }
 const char* Buffer::BeginWriteConst() const { return BeginPtr_() + writePos_; }
 
 /**
- * @brief 从缓冲区中取出数据
+ * @brief 从缓冲区中取出数据, 取空时读写位置归零
  * @param len 数据长度
  */
 void Buffer::Retrieve(size_t len) {
   assert(len <= ReadableBytes());
   readPos_ += len;
+  if (readPos_ == writePos_) {
+    Reset_();
+  }
 }
 
 /**
@@ -65,13 +121,14 @@ void Buffer::RetrieveUntil(const char* end) {
 }
 
 /**
- * @brief 重置缓冲区
+ * @brief 重置缓冲区, 旧数据不清零
  */
-void Buffer::RetrieveAll() {
-  bzero(&buffer_[0], buffer_.size());
-  readPos_ = 0;
-  writePos_ = 0;
-}
+void Buffer::RetrieveAll() { Reset_(); }
+
+/**
+ * @brief 读写位置归零
+ */
+void Buffer::Reset_() { readPos_ = writePos_ = 0; }
 
 /**
  * @brief 重置缓冲区并返回字符串
@@ -86,7 +143,7 @@ std::string Buffer::RetrieveAllToStr() {
  * @brief 添加数据
  * @param str 字符串
  */
-void Buffer::Append(const std::string& str) { Append(str.data(), str.length()); }
+void Buffer::Append(std::string_view str) { Append(str.data(), str.size()); }
 
 /**
  * @brief 添加数据
@@ -125,43 +182,99 @@ void Buffer::HasWritten(size_t len) { writePos_ += len; }
 /**
  * @brief 返回缓冲区头指针
  */
-char* Buffer::BeginPtr_() { return &*buffer_.begin(); }
+char* Buffer::BeginPtr_() { return buffer_; }
 
 /**
  * @brief 返回缓冲区头指针
  */
-const char* Buffer::BeginPtr_() const { return &*buffer_.begin(); }
+const char* Buffer::BeginPtr_() const { return buffer_; }
 
 /**
- * @brief 扩大缓冲区
- * @param len 扩大的长度
+ * @brief 扩大缓冲区: 已读部分空出的空间足够且不少于未读数据时原地整理, 否则按倍数扩容
+ * @param len 需要的可写长度
  */
 void Buffer::MakeSpace_(size_t len) {
-  if (WritableBytes() + PrependableBytes() < len) {
-    buffer_.resize(writePos_ + len + 1);
-  } else {
-    size_t readable = ReadableBytes();
-    std::copy(BeginPtr_() + readPos_, BeginPtr_() + writePos_, BeginPtr_());
+  size_t readable = ReadableBytes();
+  size_t reclaim = readPos_;
+  if (reclaim > 0 && WritableBytes() + reclaim >= len && readable <= reclaim) {
+    memmove(BeginPtr_(), Peek(), readable);
     readPos_ = 0;
-    writePos_ = readPos_ + readable;
-    assert(readable == ReadableBytes());
+    writePos_ = readable;
+  } else {
+    Reallocate_(std::max({capacity_ * 2, readable + len, initSize_}));
+  }
+}
+
+/**
+ * @brief 换新内存: 不超过最大一级块时从ChunkPool取(容量取整到块大小), 否则从堆上申请
+ * @param capacity 至少需要的容量
+ */
+void Buffer::Reallocate_(size_t capacity) {
+  size_t readable = ReadableBytes();
+  assert(capacity >= readable);
+  char* buffer;
+  ChunkPool::Chunk* chunk = nullptr;
+  if (capacity <= ChunkPool::CLASS_SIZE[ChunkPool::CLASS_NUM - 1]) {
+    chunk = ChunkPool::Instance()->Get(capacity);
+    buffer = chunk->Data();
+    capacity = chunk->cap;
+  } else {
+    buffer = new char[capacity];
+  }
+  if (readable > 0) {
+    memcpy(buffer, buffer_ + readPos_, readable);
+  }
+  Free_();
+  buffer_ = buffer;
+  chunk_ = chunk;
+  capacity_ = capacity;
+  readPos_ = 0;
+  writePos_ = readable;
+}
+
+/**
+ * @brief 归还内存, 读写位置不变, 由调用者处理
+ */
+void Buffer::Free_() {
+  if (chunk_) {
+    ChunkPool::Instance()->Put(chunk_);
+  } else {
+    delete[] buffer_;
   }
+  buffer_ = nullptr;
+  chunk_ = nullptr;
+  capacity_ = 0;
 }
 
 /**
- * @brief 从fd中读取数据
+ * @brief 收缩缓冲区: 空闲的keep-alive连接不持有内存, 大请求留下的大块内存在数据不多时换小
+ */
+void Buffer::Shrink() {
+  size_t readable = ReadableBytes();
+  if (readable == 0) {
+    Free_();
+    Reset_();
+  } else if (capacity_ > SHRINK_THRESHOLD && readable <= capacity_ / 4) {
+    Reallocate_(std::max(readable, initSize_));
+  }
+}
+
+/**
+ * @brief 从fd中读取数据; 溢出缓冲区每个线程一个, 第一次使用时申请, 不再每次在栈上放64KB数组.
+ * 没有内存的空闲缓冲区直接读到溢出缓冲区, 读到数据后才按实际长度申请
  * @param fd 文件描述符
  * @param saveErrno 错误码
 */
 ssize_t Buffer::ReadFd(int fd, int* saveErrno) {
-  char buff[65535];
+  thread_local std::unique_ptr<char[]> extra(new char[EXTRA_SIZE]);
+  char* buff = extra.get();
   struct iovec iov[2];
   const size_t writable = WritableBytes();
   /* 分散读， 保证数据全部读完 */
   iov[0].iov_base = BeginPtr_() + writePos_;
   iov[0].iov_len = writable;
   iov[1].iov_base = buff;
-  iov[1].iov_len = sizeof(buff);
+  iov[1].iov_len = EXTRA_SIZE;
 
   const ssize_t len = readv(fd, iov, 2);
   if (len < 0) {
@@ -169,7 +282,7 @@ ssize_t Buffer::ReadFd(int fd, int* saveErrno) {
   } else if (static_cast<size_t>(len) <= writable) {
     writePos_ += len;  // 直接读
   } else {
-    writePos_ = buffer_.size();
+    writePos_ = capacity_;
     Append(buff, len - writable);  // 将buff的数据添加到末尾
   }
   return len;
@@ -187,7 +300,7 @@ ssize_t Buffer::WriteFd(int fd, int* saveErrno) {
     *saveErrno = errno;
     return len;
   }
-  readPos_ += len;
+  Retrieve(len);
   return len;
 }
 
@@ -4,15 +4,26 @@
 #include <sys/uio.h>
 #include <unistd.h>
 
-#include <atomic>
 #include <cstring>
 #include <iostream>
-#include <vector>
+#include <memory>
+#include <string_view>
 
+#include "chainbuffer.h"
+
+/**
+ * @brief 连续内存的读写缓冲区
+ * 同一时刻只由一个线程使用(连接由EPOLLONESHOT保证), 读写位置不做同步, 多线程共享时由使用者加锁.
+ * 读空时读写位置归零, 只在空间不足且搬移量不大于回收量时才整理, 扩容只拷贝未读数据, 不清零.
+ * 内存在第一次写入时才申请, 不超过64KB时取自ChunkPool; 空闲时可以通过Shrink归还.
+*/
 class Buffer {
 public:
     Buffer(int initBuffSize = 1024);
-    ~Buffer() = default;
+    ~Buffer();
+
+    Buffer(const Buffer&) = delete;
+    Buffer& operator=(const Buffer&) = delete;
 
     /**
      * @brief 可读字节数
@@ -34,6 +45,30 @@ public:
     */
     const char* Peek() const;
 
+    /**
+     * @brief 可读数据的视图, 不拷贝; 在下一次写入或Shrink之前有效
+    */
+    std::string_view View() const { return std::string_view(Peek(), ReadableBytes()); }
+
+    /**
+     * @brief 在可读数据中查找str, 可以指定从start开始
+     * @return 找到时返回起始位置, 否则返回nullptr
+    */
+    const char* Find(std::string_view str) const { return Find(Peek(), str); }
+    const char* Find(const char* start, std::string_view str) const;
+
+    /**
+     * @brief 查找\r\n, 返回\r的位置, 找不到返回nullptr
+    */
+    const char* FindCRLF() const { return FindCRLF(Peek()); }
+    const char* FindCRLF(const char* start) const;
+
+    /**
+     * @brief 查找\n, 找不到返回nullptr
+    */
+    const char* FindEOL() const { return FindEOL(Peek()); }
+    const char* FindEOL(const char* start) const;
+
     /**
      * @brief 确保缓冲区有足够的空间存放len个字节
     */
@@ -77,7 +112,7 @@ public:
     /**
      * @brief 添加字符串
     */
-    void Append(const std::string& str);
+    void Append(std::string_view str);
     void Append(const char* str, size_t len);
     void Append(const void* data, size_t len);
 
@@ -87,7 +122,17 @@ public:
     void Append(const Buffer& buff);
 
     /**
-     * @brief 从fd中读取数据
+     * @brief 为空时归还全部内存; 否则容量超过SHRINK_THRESHOLD且大部分空闲时换成刚好容纳数据的内存
+    */
+    void Shrink();
+
+    /**
+     * @brief 当前占用的内存
+    */
+    size_t Capacity() const { return capacity_; }
+
+    /**
+     * @brief 从fd中读取数据, 超出可写空间的部分先读到线程共享的溢出缓冲区
     */
     ssize_t ReadFd(int fd, int* Errno);
 
@@ -96,6 +141,9 @@ public:
     */
     ssize_t WriteFd(int fd, int* Errno);
 
+    static constexpr size_t EXTRA_SIZE = 64 * 1024;         // 每个线程的溢出缓冲区大小, 即单次ReadFd最多多读的字节数
+    static constexpr size_t SHRINK_THRESHOLD = 64 * 1024;   // 不超过该容量的缓冲区只在为空时归还
+
 private:
     /**
      * @brief 返回缓冲区头指针
@@ -112,10 +160,28 @@ private:
     */
     void MakeSpace_(size_t len);
 
+    /**
+     * @brief 换成至少capacity字节的新内存, 未读数据移到开头
+    */
+    void Reallocate_(size_t capacity);
+
+    /**
+     * @brief 归还内存
+    */
+    void Free_();
+
+    /**
+     * @brief 读写位置归零
+    */
+    void Reset_();
+
 private:
-    std::vector<char> buffer_; // 缓冲区
-    std::atomic<std::size_t> readPos_; // 读指针
-    std::atomic<std::size_t> writePos_; // 写指针
+    char* buffer_; // 缓冲区, 不初始化
+    ChunkPool::Chunk* chunk_; // 内存来自池时的块, 否则为空
+    size_t capacity_; // 缓冲区大小
+    size_t initSize_; // 第一次申请的大小
+    size_t readPos_; // 读指针
+    size_t writePos_; // 写指针
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,270 @@
+#include "chainbuffer.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <new>
+
+/**
+ * @brief 池不析构: 静态对象(如日志)中的缓冲区在退出时还会归还块
+ */
+ChunkPool* ChunkPool::Instance() {
+  static ChunkPool* pool = new ChunkPool();
+  return pool;
+}
+
+/**
+ * @brief 能容纳size字节的最小一级
+ */
+int ChunkPool::ClassOf_(size_t size) {
+  for (int i = 0; i < CLASS_NUM - 1; i++) {
+    if (size <= CLASS_SIZE[i]) {
+      return i;
+    }
+  }
+  return CLASS_NUM - 1;
+}
+
+/**
+ * @brief 取出一个块, 缓存为空时新分配, 块头和数据区一次分配
+ * @param hint 期望的数据区大小
+ */
+ChunkPool::Chunk* ChunkPool::Get(size_t hint) {
+  int cls = ClassOf_(hint);
+  Chunk* chunk = nullptr;
+  {
+    std::lock_guard<std::mutex> locker(mtx_[cls]);
+    if (!free_[cls].empty()) {
+      chunk = free_[cls].back();
+      free_[cls].pop_back();
+    }
+  }
+  if (!chunk) {
+    chunk = static_cast<Chunk*>(::operator new(sizeof(Chunk) + CLASS_SIZE[cls]));
+    chunk->cap = CLASS_SIZE[cls];
+  }
+  chunk->next = nullptr;
+  chunk->read = chunk->write = 0;
+  return chunk;
+}
+
+/**
+ * @brief 归还一个块, 数据不清零
+ */
+void ChunkPool::Put(Chunk* chunk) {
+  assert(chunk);
+  int cls = ClassOf_(chunk->cap);
+  assert(CLASS_SIZE[cls] == chunk->cap);
+  {
+    std::lock_guard<std::mutex> locker(mtx_[cls]);
+    if (free_[cls].size() < MAX_CACHED[cls]) {
+      free_[cls].push_back(chunk);
+      return;
+    }
+  }
+  ::operator delete(chunk);
+}
+
+size_t ChunkPool::Cached() const {
+  size_t count = 0;
+  for (int i = 0; i < CLASS_NUM; i++) {
+    std::lock_guard<std::mutex> locker(mtx_[i]);
+    count += free_[i].size();
+  }
+  return count;
+}
+
+/**
+ * @brief 构造函数, 第一次写入时才取块
+ */
+ChainBuffer::ChainBuffer() : head_(nullptr), tail_(nullptr), readable_(0) {}
+
+ChainBuffer::~ChainBuffer() { RetrieveAll(); }
+
+/**
+ * @brief 在尾部接上新块, 已缓存的数据越多取的块越大
+ * @param hint 接下来要写入的字节数
+ */
+void ChainBuffer::PushChunk_(size_t hint) {
+  Chunk* chunk = ChunkPool::Instance()->Get(std::max(hint, readable_));
+  if (tail_) {
+    tail_->next = chunk;
+  } else {
+    head_ = chunk;
+  }
+  tail_ = chunk;
+}
+
+/**
+ * @brief 追加数据
+ * @param data 数据
+ * @param len 数据长度
+ */
+void ChainBuffer::Append(const char* data, size_t len) {
+  assert(data || len == 0);
+  while (len > 0) {
+    if (!tail_ || tail_->Writable() == 0) {
+      PushChunk_(len);
+    }
+    size_t n = std::min(len, tail_->Writable());
+    memcpy(tail_->Data() + tail_->write, data, n);
+    tail_->write += n;
+    readable_ += n;
+    data += n;
+    len -= n;
+  }
+}
+
+/**
+ * @brief 消费数据, 读完的块归还给池
+ * @param len 数据长度
+ */
+void ChainBuffer::Retrieve(size_t len) {
+  assert(len <= readable_);
+  if (len == readable_) {
+    RetrieveAll();
+    return;
+  }
+  readable_ -= len;
+  while (len > 0) {
+    size_t n = std::min(len, head_->Readable());
+    head_->read += n;
+    len -= n;
+    if (head_->Readable() == 0) {
+      Chunk* next = head_->next;
+      ChunkPool::Instance()->Put(head_);
+      head_ = next;
+    }
+  }
+}
+
+/**
+ * @brief 丢弃前len个字节之后的数据
+ * @param len 保留的字节数
+ */
+void ChainBuffer::Truncate(size_t len) {
+  if (len >= readable_) {
+    return;
+  }
+  if (len == 0) {
+    RetrieveAll();
+    return;
+  }
+  readable_ = len;
+  Chunk* chunk = head_;
+  while (len > chunk->Readable()) {
+    len -= chunk->Readable();
+    chunk = chunk->next;
+  }
+  chunk->write = chunk->read + len;
+  for (Chunk* rest = chunk->next; rest;) {
+    Chunk* next = rest->next;
+    ChunkPool::Instance()->Put(rest);
+    rest = next;
+  }
+  chunk->next = nullptr;
+  tail_ = chunk;
+}
+
+/**
+ * @brief 归还所有块
+ */
+void ChainBuffer::RetrieveAll() {
+  while (head_) {
+    Chunk* next = head_->next;
+    ChunkPool::Instance()->Put(head_);
+    head_ = next;
+  }
+  tail_ = nullptr;
+  readable_ = 0;
+}
+
+/**
+ * @brief 填入iovec
+ * @param iov 输出数组
+ * @param max 数组大小
+ * @param offset 跳过的字节数
+ */
+int ChainBuffer::PeekIov(struct iovec* iov, int max, size_t offset) const {
+  int cnt = 0;
+  for (const Chunk* chunk = head_; chunk && cnt < max; chunk = chunk->next) {
+    size_t len = chunk->Readable();
+    if (offset >= len) {
+      offset -= len;
+      continue;
+    }
+    iov[cnt].iov_base = const_cast<char*>(chunk->Data() + chunk->read + offset);
+    iov[cnt].iov_len = len - offset;
+    offset = 0;
+    cnt++;
+  }
+  return cnt;
+}
+
+/**
+ * @brief 从fd中读取数据, 读到尾块剩余空间和一个新块中; 新块没有用到时直接归还
+ * @param fd 文件描述符
+ * @param saveErrno 错误码
+ */
+ssize_t ChainBuffer::ReadFd(int fd, int* saveErrno) {
+  struct iovec iov[2];
+  int cnt = 0;
+  size_t writable = tail_ ? tail_->Writable() : 0;
+  if (writable > 0) {
+    iov[cnt].iov_base = tail_->Data() + tail_->write;
+    iov[cnt].iov_len = writable;
+    cnt++;
+  }
+  Chunk* extra = nullptr;
+  if (writable < MAX_READ) {
+    extra = ChunkPool::Instance()->Get(std::max(MAX_READ - writable, readable_));
+    iov[cnt].iov_base = extra->Data();
+    iov[cnt].iov_len = std::min(extra->cap, MAX_READ - writable);
+    cnt++;
+  }
+  const ssize_t len = readv(fd, iov, cnt);
+  if (len < 0) {
+    *saveErrno = errno;
+  }
+  size_t left = len > 0 ? len : 0;
+  readable_ += left;
+  if (writable > 0) {
+    size_t n = std::min(left, writable);
+    tail_->write += n;
+    left -= n;
+  }
+  if (extra && left > 0) {
+    extra->write = left;
+    if (tail_) {
+      tail_->next = extra;
+    } else {
+      head_ = extra;
+    }
+    tail_ = extra;
+  } else if (extra) {
+    ChunkPool::Instance()->Put(extra);
+  }
+  return len;
+}
+
+/**
+ * @brief 向fd中写入数据
+ * @param fd 文件描述符
+ * @param saveErrno 错误码
+ */
+ssize_t ChainBuffer::WriteFd(int fd, int* saveErrno) {
+  struct iovec iov[MAX_IOV];
+  int cnt = PeekIov(iov, MAX_IOV);
+  if (cnt == 0) {
+    return 0;
+  }
+  ssize_t len = writev(fd, iov, cnt);
+  if (len < 0) {
+    *saveErrno = errno;
+    return len;
+  }
+  Retrieve(len);
+  return len;
+}
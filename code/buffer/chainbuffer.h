@@ -0,0 +1,126 @@
+#ifndef CHAIN_BUFFER_H
+#define CHAIN_BUFFER_H
+
+#include <assert.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include <mutex>
+#include <string_view>
+#include <vector>
+
+/**
+ * @brief 固定大小(4/16/64KB)内存块的全局池
+ * 块按大小分级缓存, 归还的块不清零; 每级缓存的块数有上限, 超出的直接释放
+*/
+class ChunkPool {
+public:
+    /**
+     * @brief 块头, 数据紧跟在块头之后
+    */
+    struct Chunk {
+        Chunk* next;
+        size_t cap;         // 数据区大小
+        size_t read;        // 读位置
+        size_t write;       // 写位置
+
+        char* Data() { return reinterpret_cast<char*>(this + 1); }
+        const char* Data() const { return reinterpret_cast<const char*>(this + 1); }
+        size_t Readable() const { return write - read; }
+        size_t Writable() const { return cap - write; }
+    };
+
+    static ChunkPool* Instance();
+
+    /**
+     * @brief 取出能容纳hint字节的最小一级的块, 超过最大一级时返回最大一级
+    */
+    Chunk* Get(size_t hint);
+    void Put(Chunk* chunk);
+
+    /**
+     * @brief 各级缓存中的块数之和
+    */
+    size_t Cached() const;
+
+    static constexpr int CLASS_NUM = 3;
+    static constexpr size_t CLASS_SIZE[CLASS_NUM] = {4 * 1024, 16 * 1024, 64 * 1024};
+    static constexpr size_t MAX_CACHED[CLASS_NUM] = {1024, 256, 64};  // 每级最多缓存的块数
+
+private:
+    ChunkPool() = default;
+    ~ChunkPool() = default;
+
+    static int ClassOf_(size_t size);
+
+    mutable std::mutex mtx_[CLASS_NUM];
+    std::vector<Chunk*> free_[CLASS_NUM];
+};
+
+/**
+ * @brief 由池中的块串成的缓冲区
+ * 追加只写尾块, 写满时接上新块; 读取只移动头块的读位置, 读完的块立即归还; 数据不搬移, 重置不清零.
+ * 适合只在两端读写、不需要连续内存的数据, 读写socket时用readv/writev跨块进行
+*/
+class ChainBuffer {
+public:
+    ChainBuffer();
+    ~ChainBuffer();
+
+    ChainBuffer(const ChainBuffer&) = delete;
+    ChainBuffer& operator=(const ChainBuffer&) = delete;
+
+    size_t ReadableBytes() const { return readable_; }
+
+    /**
+     * @brief 追加数据, 块大小随已缓存的数据量增长
+    */
+    void Append(const char* data, size_t len);
+    void Append(std::string_view str) { Append(str.data(), str.size()); }
+
+    /**
+     * @brief 从头部消费len个字节
+    */
+    void Retrieve(size_t len);
+
+    /**
+     * @brief 只保留前len个字节, 丢弃其后的数据
+    */
+    void Truncate(size_t len);
+
+    /**
+     * @brief 归还所有块
+    */
+    void RetrieveAll();
+
+    /**
+     * @brief 从offset开始的数据依次填入iov, 不消费
+     * @return 填入的iovec个数, 最多max个
+    */
+    int PeekIov(struct iovec* iov, int max, size_t offset = 0) const;
+
+    /**
+     * @brief 从fd读取, 尾块的剩余空间不够时先接上新块, 一次readv最多读MAX_READ字节
+    */
+    ssize_t ReadFd(int fd, int* saveErrno);
+
+    /**
+     * @brief 写入fd并消费已写出的数据
+    */
+    ssize_t WriteFd(int fd, int* saveErrno);
+
+    static constexpr size_t MAX_READ = 64 * 1024;   // 单次ReadFd最多读取的字节数
+    static constexpr int MAX_IOV = 16;              // 单次WriteFd最多的iovec数
+
+private:
+    typedef ChunkPool::Chunk Chunk;
+
+    void PushChunk_(size_t hint);
+
+    Chunk* head_;           // 读端
+    Chunk* tail_;           // 写端
+    size_t readable_;
+};
+
+#endif
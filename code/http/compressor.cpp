@@ -0,0 +1,267 @@
+#include "compressor.h"
+
+#include <assert.h>
+#include <brotli/encode.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "../log/log.h"
+#include "httptable.h"
+
+namespace {
+
+constexpr auto ENCODING_TABLE = httptable::MakeStaticMap<httptable::NoCaseKey, ContentEncoding>({
+    {"gzip", ContentEncoding::GZIP},
+    {"x-gzip", ContentEncoding::GZIP},
+    {"br", ContentEncoding::BR},
+    {"zstd", ContentEncoding::ZSTD},
+    {"identity", ContentEncoding::IDENTITY},
+});
+static_assert(ENCODING_TABLE.Valid(), "no perfect hash seed for ENCODING_TABLE");
+
+/* 值得压缩的文件后缀; 不在表中的后缀(包括LookupMimeType退回text/plain的未知后缀)一律不压缩 */
+constexpr auto COMPRESSIBLE_SUFFIX = httptable::MakeStaticMap<httptable::NoCaseKey, bool>({
+    {".html", true}, {".xhtml", true}, {".xml", true}, {".txt", true}, {".css", true},
+    {".js", true},   {".json", true},  {".svg", true}, {".ico", true}, {".ttf", true},
+    {".otf", true},  {".eot", true},   {".rtf", true},
+});
+static_assert(COMPRESSIBLE_SUFFIX.Valid(), "no perfect hash seed for COMPRESSIBLE_SUFFIX");
+
+std::string_view Trim(std::string_view str) {
+    while (!str.empty() && (str.front() == ' ' || str.front() == '\t')) {
+        str.remove_prefix(1);
+    }
+    while (!str.empty() && (str.back() == ' ' || str.back() == '\t')) {
+        str.remove_suffix(1);
+    }
+    return str;
+}
+
+/**
+ * @brief q值是否为0, 即 q=0 / q=0.0 / q=0.000
+*/
+bool IsZeroQuality(std::string_view params) {
+    size_t pos = params.find("q=");
+    if (pos == std::string_view::npos) {
+        return false;
+    }
+    std::string_view q = Trim(params.substr(pos + 2));
+    if (q.empty() || q[0] != '0') {
+        return false;
+    }
+    for (size_t i = 1; i < q.size(); i++) {
+        if (q[i] != '.' && q[i] != '0') {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool WriteFile(const std::string& path, const std::string& data) {
+    std::string tmp = path + ".tmp";
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    size_t written = 0;
+    while (written < data.size()) {
+        ssize_t len = write(fd, data.data() + written, data.size() - written);
+        if (len <= 0) {
+            close(fd);
+            unlink(tmp.c_str());
+            return false;
+        }
+        written += len;
+    }
+    close(fd);
+    /* 先写临时文件再改名, 文件缓存不会读到写了一半的内容 */
+    if (rename(tmp.c_str(), path.c_str()) < 0) {
+        unlink(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+}  // namespace
+
+/**
+ * @brief 解析Accept-Encoding, q=0表示拒绝, 其余q值不区分, 由服务端按压缩率选择
+*/
+uint32_t Compressor::ParseAcceptEncoding(std::string_view value) {
+    uint32_t accepted = 0, rejected = 0;
+    bool any = false;
+    while (!value.empty()) {
+        size_t comma = value.find(',');
+        std::string_view item = value.substr(0, comma);
+        value = comma == std::string_view::npos ? std::string_view() : value.substr(comma + 1);
+
+        size_t semi = item.find(';');
+        std::string_view token = Trim(item.substr(0, semi));
+        bool zero = semi != std::string_view::npos && IsZeroQuality(item.substr(semi + 1));
+        if (token == "*") {
+            any = !zero;
+            continue;
+        }
+        const ContentEncoding* enc = ENCODING_TABLE.Find(token);
+        if (!enc) {
+            continue;
+        }
+        (zero ? rejected : accepted) |= 1u << static_cast<int>(*enc);
+    }
+    if (any) {
+        accepted |= ~rejected & ((1u << static_cast<int>(ContentEncoding::COUNT)) - 1);
+    }
+    return accepted;
+}
+
+/**
+ * @brief Content-Encoding的值
+*/
+std::string_view Compressor::Name(ContentEncoding enc) {
+    switch (enc) {
+        case ContentEncoding::GZIP: return "gzip";
+        case ContentEncoding::BR: return "br";
+        case ContentEncoding::ZSTD: return "zstd";
+        default: return std::string_view();
+    }
+}
+
+/**
+ * @brief 预压缩文件的后缀
+*/
+std::string_view Compressor::Suffix(ContentEncoding enc) {
+    switch (enc) {
+        case ContentEncoding::GZIP: return ".gz";
+        case ContentEncoding::BR: return ".br";
+        case ContentEncoding::ZSTD: return ".zst";
+        default: return std::string_view();
+    }
+}
+
+/**
+ * @brief 按后缀判断文件是否值得压缩, 只认白名单中的后缀; 图片/视频/字体(woff)本身已经压缩,
+ * 未知后缀可能是任意二进制文件, 压缩只会浪费CPU
+*/
+bool Compressor::IsCompressible(std::string_view path) {
+    const size_t dot = path.find_last_of('.');
+    if (dot == std::string_view::npos || path.find('/', dot) != std::string_view::npos) {
+        return false;
+    }
+    return COMPRESSIBLE_SUFFIX.Get(path.substr(dot), false);
+}
+
+/**
+ * @brief gzip压缩
+*/
+bool Compressor::Gzip(const char* data, size_t len, std::string* out, int level) {
+    assert(out);
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    /* windowBits + 16 输出gzip格式 */
+    if (deflateInit2(&stream, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return false;
+    }
+    out->resize(deflateBound(&stream, len));
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+    stream.avail_in = len;
+    stream.next_out = reinterpret_cast<Bytef*>(&(*out)[0]);
+    stream.avail_out = out->size();
+    int ret = deflate(&stream, Z_FINISH);
+    out->resize(stream.total_out);
+    deflateEnd(&stream);
+    return ret == Z_STREAM_END;
+}
+
+/**
+ * @brief brotli压缩
+*/
+bool Compressor::Brotli(const char* data, size_t len, std::string* out, int quality) {
+    assert(out);
+    size_t outLen = BrotliEncoderMaxCompressedSize(len);
+    if (outLen == 0) {
+        return false;
+    }
+    out->resize(outLen);
+    if (!BrotliEncoderCompress(quality, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT, len,
+                               reinterpret_cast<const uint8_t*>(data), &outLen,
+                               reinterpret_cast<uint8_t*>(&(*out)[0]))) {
+        return false;
+    }
+    out->resize(outLen);
+    return true;
+}
+
+/**
+ * @brief 递归遍历目录生成预压缩文件
+*/
+void Compressor::PrecompressDir(const char* root) {
+    assert(root);
+    DIR* dp = opendir(root);
+    if (!dp) {
+        LOG_WARN("precompress open %s error: %d", root, errno);
+        return;
+    }
+    std::string dir(root);
+    if (dir.empty() || dir.back() != '/') {
+        dir.push_back('/');
+    }
+    while (struct dirent* entry = readdir(dp)) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+        std::string path = dir + entry->d_name;
+        struct stat st;
+        if (stat(path.c_str(), &st) < 0) {
+            continue;
+        }
+        if (S_ISDIR(st.st_mode)) {
+            PrecompressDir(path.c_str());
+        } else if (S_ISREG(st.st_mode) && static_cast<size_t>(st.st_size) >= MIN_SIZE &&
+                   IsCompressible(path)) {
+            PrecompressFile_(path, st.st_size, st.st_mtime);
+        }
+    }
+    closedir(dp);
+}
+
+/**
+ * @brief 生成单个文件的预压缩版本, 已存在且不早于原文件时跳过
+*/
+void Compressor::PrecompressFile_(const std::string& path, size_t size, time_t mtime) {
+    const ContentEncoding encs[] = {ContentEncoding::GZIP, ContentEncoding::BR};
+    char* data = nullptr;
+    for (ContentEncoding enc : encs) {
+        std::string target = path + std::string(Suffix(enc));
+        struct stat st;
+        if (stat(target.c_str(), &st) == 0 && st.st_mtime >= mtime) {
+            continue;
+        }
+        if (!data) {
+            int fd = open(path.c_str(), O_RDONLY);
+            if (fd < 0) {
+                return;
+            }
+            void* ret = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            close(fd);
+            if (ret == MAP_FAILED) {
+                return;
+            }
+            data = static_cast<char*>(ret);
+        }
+        std::string out;
+        bool ok = enc == ContentEncoding::GZIP ? Gzip(data, size, &out, 9) : Brotli(data, size, &out);
+        /* 压缩后没有变小的不保存, 运行时直接发送原文件 */
+        if (ok && out.size() < size && WriteFile(target, out)) {
+            LOG_INFO("precompress %s: %zu -> %zu", target.c_str(), size, out.size());
+        }
+    }
+    if (data) {
+        munmap(data, size);
+    }
+}
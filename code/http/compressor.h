@@ -0,0 +1,54 @@
+#ifndef COMPRESSOR_H
+#define COMPRESSOR_H
+
+#include <stdint.h>
+
+#include <string>
+#include <string_view>
+
+/**
+ * @brief 响应体的内容编码, 数值即Accept-Encoding掩码中的位
+*/
+enum class ContentEncoding : uint8_t {
+    IDENTITY = 0,
+    GZIP,
+    BR,
+    ZSTD,
+    COUNT,
+};
+
+/**
+ * @brief 静态资源压缩: Accept-Encoding协商, gzip/brotli压缩, 预压缩文件(.gz/.br/.zst)生成
+*/
+class Compressor {
+public:
+    /**
+     * @brief 解析Accept-Encoding, 返回客户端可接受编码的掩码(1 << ContentEncoding)
+    */
+    static uint32_t ParseAcceptEncoding(std::string_view value);
+
+    static std::string_view Name(ContentEncoding enc);      // Content-Encoding的值
+    static std::string_view Suffix(ContentEncoding enc);    // 预压缩文件的后缀
+
+    /**
+     * @brief 文件是否值得压缩(文本, js, json, svg等), 按后缀白名单判断, 未知后缀不压缩
+    */
+    static bool IsCompressible(std::string_view path);
+
+    static bool Gzip(const char* data, size_t len, std::string* out, int level = 6);
+    static bool Brotli(const char* data, size_t len, std::string* out, int quality = 11);
+
+    /**
+     * @brief 为目录下可压缩的文件生成缺失或过期的.gz/.br预压缩文件
+     * .zst没有内置压缩器, 由外部工具生成后同样会被使用
+    */
+    static void PrecompressDir(const char* root);
+
+    static const size_t MIN_SIZE = 256;                 // 小于该大小的文件不压缩
+    static const size_t MAX_INLINE_SIZE = 4 * 1024 * 1024; // 没有预压缩文件时, 在线gzip的最大文件大小
+
+private:
+    static void PrecompressFile_(const std::string& path, size_t size, time_t mtime);
+};
+
+#endif
@@ -0,0 +1,521 @@
+#include "filecache.h"
+
+#include <dirent.h>
+#include <errno.h>
+
+#include "../log/log.h"
+#include "httpresponse.h"
+#include "httptable.h"
+
+/**
+ * @brief 解除文件映射
+*/
+CachedFile::~CachedFile() {
+    if (mapped) {
+        munmap(data, size);
+    }
+}
+
+/**
+ * @brief 占用的缓存字节数
+*/
+size_t CachedFile::Cost() const {
+    size_t cost = size;
+    for (auto& variant : variants) {
+        if (variant) {
+            cost += variant->size;
+        }
+    }
+    return cost;
+}
+
+FileCache::FileCache() : maxEntries_(0), maxBytes_(0), inotifyFd_(-1) {}
+
+FileCache::~FileCache() {
+    if (inotifyFd_ >= 0) {
+        close(inotifyFd_);
+    }
+}
+
+/**
+ * @brief 获取单例
+*/
+FileCache* FileCache::Instance() {
+    static FileCache cache;
+    return &cache;
+}
+
+/**
+ * @brief 初始化
+ * @param root 资源目录
+ * @param maxEntries 最大缓存文件数
+ * @param maxBytes 最大映射字节数
+*/
+void FileCache::Init(const char* root, size_t maxEntries, size_t maxBytes) {
+    assert(root && maxEntries > 0 && maxBytes > 0);
+    Clear();
+    root_ = root;
+    while (root_.size() > 1 && root_.back() == '/') {
+        root_.pop_back();
+    }
+    maxEntries_ = std::max<size_t>(maxEntries / SHARD_NUM, 1);
+    maxBytes_ = std::max<size_t>(maxBytes / SHARD_NUM, 1);
+
+    if (inotifyFd_ >= 0) {
+        close(inotifyFd_);
+        watches_.clear();
+    }
+    inotifyFd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotifyFd_ < 0) {
+        LOG_WARN("inotify init error, file cache will not be invalidated: %d", errno);
+        return;
+    }
+    AddWatch_("");
+}
+
+/**
+ * @brief 规范化请求路径: 合并重复的'/', 去掉".", 拒绝".."
+ * @return 路径是否合法
+*/
+bool FileCache::Normalize_(std::string_view path, std::string* out) {
+    out->clear();
+    if (path.empty() || path[0] != '/') {
+        return false;
+    }
+    size_t i = 0;
+    while (i < path.size()) {
+        while (i < path.size() && path[i] == '/') {
+            i++;
+        }
+        size_t end = path.find('/', i);
+        if (end == std::string_view::npos) {
+            end = path.size();
+        }
+        std::string_view seg = path.substr(i, end - i);
+        if (seg == "..") {
+            return false;
+        }
+        if (!seg.empty() && seg != ".") {
+            out->push_back('/');
+            out->append(seg.data(), seg.size());
+        }
+        i = end;
+    }
+    if (out->empty()) {
+        out->push_back('/');
+    }
+    return true;
+}
+
+/**
+ * @brief 打开资源文件
+ * @param path 相对资源目录的请求路径
+ * @param file 成功时指向缓存的文件
+*/
+int FileCache::Open(std::string_view path, FileRef* file) {
+    assert(file);
+    thread_local std::string key;  // 复用容量, 命中时不分配内存
+    if (!Normalize_(path, &key)) {
+        return 404;
+    }
+    Shard& shard = ShardOf_(key);
+    uint64_t generation;
+    FileRef cached;
+    {
+        std::lock_guard<std::mutex> locker(shard.mtx);
+        auto it = shard.index.find(key);
+        if (it != shard.index.end()) {
+            shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+            cached = *it->second;
+        }
+        generation = shard.generation;
+    }
+    if (cached) {
+        if (!Stale_(*cached)) {
+            *file = std::move(cached);
+            return 200;
+        }
+        /* 映射的文件已被原地修改而inotify事件还没处理, 不能再发送旧映射, 立即失效并重新加载 */
+        Invalidate(key);
+        std::lock_guard<std::mutex> locker(shard.mtx);
+        generation = shard.generation;
+    }
+
+    /* 未命中: 在锁外完成stat/open/mmap */
+    std::shared_ptr<CachedFile> loaded;
+    int code = Load_(key, &loaded);
+    if (code != 200) {
+        return code;
+    }
+    {
+        std::lock_guard<std::mutex> locker(shard.mtx);
+        auto it = shard.index.find(key);
+        if (it != shard.index.end()) {
+            /* 其他线程已经加载 */
+            shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+            *file = *it->second;
+            return 200;
+        }
+        if (generation == shard.generation) {
+            shard.lru.push_front(loaded);
+            shard.index.emplace(loaded->path, shard.lru.begin());
+            shard.bytes += loaded->Cost();
+            Evict_(shard);
+        }
+    }
+    *file = loaded;
+    return 200;
+}
+
+/**
+ * @brief 加载文件并建立映射
+*/
+int FileCache::Load_(const std::string& path, std::shared_ptr<CachedFile>* file) const {
+    std::string fullPath = root_ + path;
+    struct stat st;
+    if (stat(fullPath.c_str(), &st) < 0 || S_ISDIR(st.st_mode)) {
+        return 404;
+    }
+    if (!(st.st_mode & S_IROTH)) {
+        return 403;
+    }
+    std::shared_ptr<CachedFile> loaded(new CachedFile());
+    loaded->path = path;
+    loaded->mtime = st.st_mtime;
+    loaded->type = LookupMimeType(path);
+    loaded->cacheControl = CacheControl_(path, loaded->type);
+    /* inode-大小-修改时间(纳秒), 文件内容变化时必然改变 */
+    char etag[64];
+    uint64_t mtimeNs = uint64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+    snprintf(etag, sizeof(etag), "\"%lx-%lx-%llx\"", (unsigned long)st.st_ino, (unsigned long)st.st_size,
+             (unsigned long long)mtimeNs);
+    loaded->etag = etag;
+    if (!Map_(fullPath, st, loaded.get())) {
+        return 404;
+    }
+    if (loaded->size >= Compressor::MIN_SIZE && Compressor::IsCompressible(path)) {
+        loaded->vary = true;
+        LoadVariants_(fullPath, loaded.get());
+    }
+    MakeHeader_(loaded.get());
+    LOG_DEBUG("file cache load %s, size:%zu", fullPath.c_str(), loaded->size);
+    *file = std::move(loaded);
+    return 200;
+}
+
+/**
+ * @brief 加载压缩版本: 优先使用不早于原文件的预压缩文件, 没有.gz时在线gzip
+*/
+void FileCache::LoadVariants_(const std::string& fullPath, CachedFile* file) const {
+    const ContentEncoding encs[] = {ContentEncoding::GZIP, ContentEncoding::BR, ContentEncoding::ZSTD};
+    for (ContentEncoding enc : encs) {
+        std::string sidecar = fullPath + std::string(Compressor::Suffix(enc));
+        struct stat st;
+        if (stat(sidecar.c_str(), &st) < 0 || !S_ISREG(st.st_mode) || st.st_mtime < file->mtime ||
+            st.st_size == 0) {
+            continue;
+        }
+        std::shared_ptr<CachedFile> variant(new CachedFile());
+        variant->path = file->path;
+        variant->mtime = file->mtime;
+        variant->type = file->type;
+        variant->encoding = Compressor::Name(enc);
+        variant->vary = true;
+        InheritValidators_(*file, variant.get());
+        if (Map_(sidecar, st, variant.get())) {
+            MakeHeader_(variant.get());
+            file->variants[static_cast<int>(enc)] = std::move(variant);
+        }
+    }
+
+    auto& gzip = file->variants[static_cast<int>(ContentEncoding::GZIP)];
+    if (!gzip && file->size <= Compressor::MAX_INLINE_SIZE) {
+        std::shared_ptr<CachedFile> variant(new CachedFile());
+        if (Compressor::Gzip(file->data, file->size, &variant->body) && variant->body.size() < file->size) {
+            variant->path = file->path;
+            variant->mtime = file->mtime;
+            variant->type = file->type;
+            variant->encoding = Compressor::Name(ContentEncoding::GZIP);
+            variant->vary = true;
+            InheritValidators_(*file, variant.get());
+            variant->data = &variant->body[0];
+            variant->size = variant->body.size();
+            MakeHeader_(variant.get());
+            gzip = std::move(variant);
+        }
+    }
+}
+
+/**
+ * @brief 加载文件内容: 不超过COPY_SIZE的读入内存, 更大的映射, 空文件两者都不做
+ * @param st 加载前stat的结果, 读入时文件变短视为失败
+*/
+bool FileCache::Map_(const std::string& fullPath, const struct stat& st, CachedFile* file) {
+    size_t size = st.st_size;
+    file->size = size;
+    if (size == 0) {
+        return true;
+    }
+    int fd = open(fullPath.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    if (size <= COPY_SIZE) {
+        file->body.resize(size);
+        size_t done = 0;
+        while (done < size) {
+            ssize_t n = pread(fd, &file->body[done], size - done, done);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                break;
+            }
+            done += n;
+        }
+        close(fd);
+        if (done < size) {
+            LOG_WARN("read %s error: %zu of %zu bytes", fullPath.c_str(), done, size);
+            file->body.clear();
+            return false;
+        }
+        file->data = &file->body[0];
+        return true;
+    }
+    void* ret = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (ret == MAP_FAILED) {
+        LOG_WARN("mmap %s error: %d", fullPath.c_str(), errno);
+        return false;
+    }
+    file->data = static_cast<char*>(ret);
+    file->mapped = true;
+    file->mappedMtimeNs = uint64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+    return true;
+}
+
+/**
+ * @brief 缓存项中是否有映射的文件(原文件或预压缩文件)已被修改; 读入内存的文件不需要检查
+*/
+bool FileCache::Stale_(const CachedFile& file) const {
+    thread_local std::string fullPath;
+    fullPath.assign(root_).append(file.path);
+    if (file.mapped && Changed_(fullPath, file)) {
+        return true;
+    }
+    size_t len = fullPath.size();
+    for (int i = 0; i < static_cast<int>(ContentEncoding::COUNT); i++) {
+        const auto& variant = file.variants[i];
+        if (variant && variant->mapped) {
+            fullPath.resize(len);
+            fullPath.append(Compressor::Suffix(static_cast<ContentEncoding>(i)));
+            if (Changed_(fullPath, *variant)) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief 被映射的文件大小或修改时间是否与映射时不同, 文件不存在也算
+*/
+bool FileCache::Changed_(const std::string& fullPath, const CachedFile& file) {
+    struct stat st;
+    if (stat(fullPath.c_str(), &st) < 0) {
+        return true;
+    }
+    uint64_t mtimeNs = uint64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+    return static_cast<size_t>(st.st_size) != file.size || mtimeNs != file.mappedMtimeNs;
+}
+
+/**
+ * @brief 预先生成两种连接方式的响应头
+*/
+void FileCache::MakeHeader_(CachedFile* file) {
+    for (int keepAlive = 0; keepAlive < 2; keepAlive++) {
+        file->header[keepAlive] = HttpResponse::StaticHeader(*file, keepAlive, false);
+        file->notModified[keepAlive] = HttpResponse::StaticHeader(*file, keepAlive, true);
+    }
+}
+
+/**
+ * @brief 压缩版本的字节不同, ETag加上编码后缀, 其余与原文件相同
+*/
+void FileCache::InheritValidators_(const CachedFile& file, CachedFile* variant) {
+    variant->etag = file.etag;
+    variant->etag.insert(variant->etag.size() - 1, "-" + std::string(variant->encoding));
+    variant->cacheControl = file.cacheControl;
+}
+
+/**
+ * @brief 配置Cache-Control
+*/
+void FileCache::AddCacheRule(std::string_view pattern, int maxAge) {
+    assert(!pattern.empty() && maxAge >= 0);
+    std::string value = maxAge == 0 ? "no-cache" : "max-age=" + std::to_string(maxAge);
+    for (auto& rule : cacheRules_) {
+        if (rule.first == pattern) {
+            rule.second = value;
+            Clear();
+            return;
+        }
+    }
+    cacheRules_.emplace_back(std::string(pattern), value);
+    Clear();  // 已缓存的响应头按新规则重新生成
+}
+
+/**
+ * @brief 按规则得到文件的Cache-Control
+*/
+std::string FileCache::CacheControl_(std::string_view path, std::string_view type) const {
+    const std::pair<std::string, std::string>* best = nullptr;
+    for (auto& rule : cacheRules_) {
+        bool isPath = rule.first[0] == '/';
+        std::string_view target = isPath ? path : type;
+        if (target.substr(0, rule.first.size()) != rule.first) {
+            continue;
+        }
+        if (!best) {
+            best = &rule;
+            continue;
+        }
+        bool bestIsPath = best->first[0] == '/';
+        if ((isPath && !bestIsPath) || (isPath == bestIsPath && rule.first.size() > best->first.size())) {
+            best = &rule;
+        }
+    }
+    return best ? best->second : std::string();
+}
+
+/**
+ * @brief 使某个文件的缓存失效
+*/
+void FileCache::Invalidate(std::string_view path) {
+    Shard& shard = ShardOf_(path);
+    std::lock_guard<std::mutex> locker(shard.mtx);
+    shard.generation++;
+    auto it = shard.index.find(path);
+    if (it != shard.index.end()) {
+        LOG_DEBUG("file cache invalidate %s", (*it->second)->path.c_str());
+        auto node = it->second;
+        shard.bytes -= (*node)->Cost();
+        shard.index.erase(it);
+        shard.lru.erase(node);
+    }
+}
+
+/**
+ * @brief 清空缓存
+*/
+void FileCache::Clear() {
+    for (auto& shard : shards_) {
+        std::lock_guard<std::mutex> locker(shard.mtx);
+        shard.generation++;
+        shard.index.clear();
+        shard.lru.clear();
+        shard.bytes = 0;
+    }
+}
+
+/**
+ * @brief 按路径选择分片
+*/
+FileCache::Shard& FileCache::ShardOf_(std::string_view path) {
+    return shards_[std::hash<std::string_view>()(path) % SHARD_NUM];
+}
+
+/**
+ * @brief 淘汰最久未使用的文件, 正在发送的响应仍持有引用
+*/
+void FileCache::Evict_(Shard& shard) {
+    while (shard.lru.size() > 1 && (shard.lru.size() > maxEntries_ || shard.bytes > maxBytes_)) {
+        auto& victim = shard.lru.back();
+        shard.bytes -= victim->Cost();
+        shard.index.erase(victim->path);
+        shard.lru.pop_back();
+    }
+}
+
+/**
+ * @brief 为目录及其子目录注册inotify
+ * @param dir 相对资源目录的路径, 根目录为空串
+*/
+void FileCache::AddWatch_(const std::string& dir) {
+    std::string fullPath = root_ + dir;
+    int wd = inotify_add_watch(inotifyFd_, fullPath.c_str(),
+                               IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE |
+                               IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF);
+    if (wd < 0) {
+        LOG_WARN("inotify watch %s error: %d", fullPath.c_str(), errno);
+        return;
+    }
+    watches_[wd] = dir;
+
+    DIR* dp = opendir(fullPath.c_str());
+    if (!dp) {
+        return;
+    }
+    while (struct dirent* entry = readdir(dp)) {
+        if (entry->d_type == DT_DIR && strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0) {
+            AddWatch_(dir + "/" + entry->d_name);
+        }
+    }
+    closedir(dp);
+}
+
+/**
+ * @brief 读取inotify事件并使对应文件失效
+*/
+void FileCache::HandleEvents() {
+    alignas(struct inotify_event) char buf[4096];
+    while (true) {
+        ssize_t len = read(inotifyFd_, buf, sizeof(buf));
+        if (len <= 0) {
+            break;
+        }
+        for (char* ptr = buf; ptr < buf + len;) {
+            const struct inotify_event* event = reinterpret_cast<const struct inotify_event*>(ptr);
+            ptr += sizeof(struct inotify_event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                LOG_WARN("inotify queue overflow, clear file cache");
+                Clear();
+                continue;
+            }
+            auto watch = watches_.find(event->wd);
+            if (watch == watches_.end()) {
+                continue;
+            }
+            if (event->mask & IN_IGNORED) {
+                watches_.erase(watch);
+                continue;
+            }
+            if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) {
+                Clear();  // 目录整体变化, 少见, 直接清空
+                continue;
+            }
+            if (event->len == 0) {
+                continue;
+            }
+            std::string path = watch->second + "/" + event->name;
+            if (event->mask & IN_ISDIR) {
+                if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+                    AddWatch_(path);
+                } else if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                    Clear();
+                }
+                continue;
+            }
+            Invalidate(path);
+            /* 预压缩文件变化时, 原文件的条目中缓存着它 */
+            for (int i = 1; i < static_cast<int>(ContentEncoding::COUNT); i++) {
+                std::string_view suffix = Compressor::Suffix(static_cast<ContentEncoding>(i));
+                if (path.size() > suffix.size() &&
+                    path.compare(path.size() - suffix.size(), suffix.size(), suffix) == 0) {
+                    Invalidate(std::string_view(path).substr(0, path.size() - suffix.size()));
+                }
+            }
+        }
+    }
+}
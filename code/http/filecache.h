@@ -0,0 +1,149 @@
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+#include <fcntl.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "compressor.h"
+
+/**
+ * @brief 缓存中的静态文件, 析构时解除映射
+ * 通过shared_ptr引用计数, 被淘汰或失效后仍在发送的响应继续持有映射
+*/
+struct CachedFile {
+    CachedFile() : data(nullptr), size(0), mtime(0), mapped(false), mappedMtimeNs(0), vary(false) {}
+    ~CachedFile();
+
+    CachedFile(const CachedFile&) = delete;
+    CachedFile& operator=(const CachedFile&) = delete;
+
+    std::string path;       // 相对资源目录的规范化路径, 即缓存key
+    char* data;             // 内存映射或body, 空文件为nullptr
+    size_t size;            // 文件大小
+    time_t mtime;           // 修改时间
+    bool mapped;            // data是否为内存映射
+    uint64_t mappedMtimeNs; // 映射时被映射文件(原文件或预压缩文件)的修改时间(纳秒), 用于检查原地修改
+    std::string_view type;  // MIME类型
+    std::string header[2];  // 预先生成的200响应头, 下标为是否keep-alive
+    std::string notModified[2]; // 预先生成的304响应头
+    std::string etag;       // 强ETag, 带引号, 压缩版本带编码后缀
+    std::string cacheControl; // Cache-Control, 为空时不返回
+
+    std::string body;           // 读入内存或在线压缩生成的内容, 非空时data指向这里而不是映射
+    std::string_view encoding;  // Content-Encoding, 原文件为空
+    bool vary;                  // 是否按Accept-Encoding协商, 需要返回Vary头
+    std::shared_ptr<const CachedFile> variants[static_cast<int>(ContentEncoding::COUNT)]; // 压缩版本
+
+    /**
+     * @brief 占用的缓存字节数, 包括压缩版本
+    */
+    size_t Cost() const;
+};
+
+typedef std::shared_ptr<const CachedFile> FileRef;
+
+/**
+ * @brief 静态资源的打开文件/映射缓存
+ * 按路径分片的LRU, 资源目录下的文件变化时由inotify通知失效
+ * 可压缩的文件同时缓存.gz/.br/.zst预压缩版本, 没有.gz时在线gzip, 计入同一个LRU的容量
+ * 映射的文件被原地截断后, 访问超出新长度的页会触发SIGBUS: 不超过COPY_SIZE的文件读入内存, 不受影响;
+ * 更大的文件每次命中时比较大小和修改时间, 变化了立即重新加载. 剩余风险: 检查之后、发送完之前
+ * 被截断的文件, 以及已经持有旧映射、正在发送的响应, 仍可能触发SIGBUS, 资源应通过写新文件再rename替换
+*/
+class FileCache {
+public:
+    static FileCache* Instance();
+
+    /**
+     * @brief 初始化, 为资源目录及其子目录注册inotify
+    */
+    void Init(const char* root, size_t maxEntries = 1024, size_t maxBytes = 256 * 1024 * 1024);
+
+    /**
+     * @brief 打开资源文件, 命中缓存时除检查映射的大文件是否被修改的stat外不产生系统调用
+     * @param path 相对资源目录的请求路径
+     * @return 200成功, 403无权限, 404不存在
+    */
+    int Open(std::string_view path, FileRef* file);
+
+    /**
+     * @brief 使某个文件的缓存失效
+    */
+    void Invalidate(std::string_view path);
+
+    /**
+     * @brief 清空缓存
+    */
+    void Clear();
+
+    /**
+     * @brief inotify文件描述符, 由主线程的epoll监听
+    */
+    int WatchFd() const { return inotifyFd_; }
+
+    /**
+     * @brief 处理inotify事件
+    */
+    void HandleEvents();
+
+    /**
+     * @brief 配置Cache-Control的max-age, 需在开始服务前调用
+     * @param pattern 以'/'开头为路径前缀, 否则为MIME类型前缀(如"image/", "text/css")
+     * @param maxAge 秒, 0表示no-cache(每次都需验证)
+     * 路径前缀优先于MIME类型, 同类中最长的匹配生效
+    */
+    void AddCacheRule(std::string_view pattern, int maxAge);
+
+private:
+    FileCache();
+    ~FileCache();
+
+    struct Shard {
+        std::mutex mtx;
+        std::list<std::shared_ptr<CachedFile>> lru;  // 头部为最近使用
+        std::unordered_map<std::string_view, std::list<std::shared_ptr<CachedFile>>::iterator> index;
+        size_t bytes = 0;
+        uint64_t generation = 0;  // 每次失效加一, 防止加载期间失效的文件被放入缓存
+    };
+
+    static bool Normalize_(std::string_view path, std::string* out);
+    int Load_(const std::string& path, std::shared_ptr<CachedFile>* file) const;
+    void LoadVariants_(const std::string& fullPath, CachedFile* file) const;
+    static bool Map_(const std::string& fullPath, const struct stat& st, CachedFile* file);
+    bool Stale_(const CachedFile& file) const;
+    static bool Changed_(const std::string& fullPath, const CachedFile& file);
+    static void MakeHeader_(CachedFile* file);
+    static void InheritValidators_(const CachedFile& file, CachedFile* variant);
+    std::string CacheControl_(std::string_view path, std::string_view type) const;
+    Shard& ShardOf_(std::string_view path);
+    void Evict_(Shard& shard);
+    void AddWatch_(const std::string& dir);
+
+    static const int SHARD_NUM = 16;   // 分片数
+    static const size_t COPY_SIZE = 256 * 1024; // 不超过该大小的文件读入内存而不映射
+
+    std::string root_;                 // 资源目录, 不带结尾的'/'
+    size_t maxEntries_;                // 每个分片的最大条目数
+    size_t maxBytes_;                  // 每个分片的最大映射字节数
+    Shard shards_[SHARD_NUM];          // 分片
+
+    int inotifyFd_;                    // inotify描述符
+    std::unordered_map<int, std::string> watches_; // watch描述符 -> 相对目录
+
+    std::vector<std::pair<std::string, std::string>> cacheRules_; // 模式 -> Cache-Control
+};
+
+#endif
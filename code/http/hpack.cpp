@@ -0,0 +1,450 @@
+#include "hpack.h"
+
+#include <assert.h>
+
+#include <algorithm>
+
+namespace {
+
+struct HeaderField {
+    const char* name;
+    const char* value;
+};
+
+const size_t STATIC_TABLE_SIZE = 61;
+const size_t ENTRY_OVERHEAD = 32;   // RFC 7541 4.1 每个表项额外计算的大小
+
+const HeaderField STATIC_TABLE[STATIC_TABLE_SIZE] = {
+    {":authority", ""},
+    {":method", "GET"},
+    {":method", "POST"},
+    {":path", "/"},
+    {":path", "/index.html"},
+    {":scheme", "http"},
+    {":scheme", "https"},
+    {":status", "200"},
+    {":status", "204"},
+    {":status", "206"},
+    {":status", "304"},
+    {":status", "400"},
+    {":status", "404"},
+    {":status", "500"},
+    {"accept-charset", ""},
+    {"accept-encoding", "gzip, deflate"},
+    {"accept-language", ""},
+    {"accept-ranges", ""},
+    {"accept", ""},
+    {"access-control-allow-origin", ""},
+    {"age", ""},
+    {"allow", ""},
+    {"authorization", ""},
+    {"cache-control", ""},
+    {"content-disposition", ""},
+    {"content-encoding", ""},
+    {"content-language", ""},
+    {"content-length", ""},
+    {"content-location", ""},
+    {"content-range", ""},
+    {"content-type", ""},
+    {"cookie", ""},
+    {"date", ""},
+    {"etag", ""},
+    {"expect", ""},
+    {"expires", ""},
+    {"from", ""},
+    {"host", ""},
+    {"if-match", ""},
+    {"if-modified-since", ""},
+    {"if-none-match", ""},
+    {"if-range", ""},
+    {"if-unmodified-since", ""},
+    {"last-modified", ""},
+    {"link", ""},
+    {"location", ""},
+    {"max-forwards", ""},
+    {"proxy-authenticate", ""},
+    {"proxy-authorization", ""},
+    {"range", ""},
+    {"referer", ""},
+    {"refresh", ""},
+    {"retry-after", ""},
+    {"server", ""},
+    {"set-cookie", ""},
+    {"strict-transport-security", ""},
+    {"transfer-encoding", ""},
+    {"user-agent", ""},
+    {"vary", ""},
+    {"via", ""},
+    {"www-authenticate", ""},
+};
+
+/* RFC 7541 附录B, 按符号排列的码字及其位数 */
+const uint32_t HUFFMAN_CODE[256] = {
+    0x1ff8, 0x7fffd8, 0xfffffe2, 0xfffffe3, 0xfffffe4, 0xfffffe5, 0xfffffe6, 0xfffffe7,
+    0xfffffe8, 0xffffea, 0x3ffffffc, 0xfffffe9, 0xfffffea, 0x3ffffffd, 0xfffffeb, 0xfffffec,
+    0xfffffed, 0xfffffee, 0xfffffef, 0xffffff0, 0xffffff1, 0xffffff2, 0x3ffffffe, 0xffffff3,
+    0xffffff4, 0xffffff5, 0xffffff6, 0xffffff7, 0xffffff8, 0xffffff9, 0xffffffa, 0xffffffb,
+    0x14, 0x3f8, 0x3f9, 0xffa, 0x1ff9, 0x15, 0xf8, 0x7fa,
+    0x3fa, 0x3fb, 0xf9, 0x7fb, 0xfa, 0x16, 0x17, 0x18,
+    0x0, 0x1, 0x2, 0x19, 0x1a, 0x1b, 0x1c, 0x1d,
+    0x1e, 0x1f, 0x5c, 0xfb, 0x7ffc, 0x20, 0xffb, 0x3fc,
+    0x1ffa, 0x21, 0x5d, 0x5e, 0x5f, 0x60, 0x61, 0x62,
+    0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a,
+    0x6b, 0x6c, 0x6d, 0x6e, 0x6f, 0x70, 0x71, 0x72,
+    0xfc, 0x73, 0xfd, 0x1ffb, 0x7fff0, 0x1ffc, 0x3ffc, 0x22,
+    0x7ffd, 0x3, 0x23, 0x4, 0x24, 0x5, 0x25, 0x26,
+    0x27, 0x6, 0x74, 0x75, 0x28, 0x29, 0x2a, 0x7,
+    0x2b, 0x76, 0x2c, 0x8, 0x9, 0x2d, 0x77, 0x78,
+    0x79, 0x7a, 0x7b, 0x7ffe, 0x7fc, 0x3ffd, 0x1ffd, 0xffffffc,
+    0xfffe6, 0x3fffd2, 0xfffe7, 0xfffe8, 0x3fffd3, 0x3fffd4, 0x3fffd5, 0x7fffd9,
+    0x3fffd6, 0x7fffda, 0x7fffdb, 0x7fffdc, 0x7fffdd, 0x7fffde, 0xffffeb, 0x7fffdf,
+    0xffffec, 0xffffed, 0x3fffd7, 0x7fffe0, 0xffffee, 0x7fffe1, 0x7fffe2, 0x7fffe3,
+    0x7fffe4, 0x1fffdc, 0x3fffd8, 0x7fffe5, 0x3fffd9, 0x7fffe6, 0x7fffe7, 0xffffef,
+    0x3fffda, 0x1fffdd, 0xfffe9, 0x3fffdb, 0x3fffdc, 0x7fffe8, 0x7fffe9, 0x1fffde,
+    0x7fffea, 0x3fffdd, 0x3fffde, 0xfffff0, 0x1fffdf, 0x3fffdf, 0x7fffeb, 0x7fffec,
+    0x1fffe0, 0x1fffe1, 0x3fffe0, 0x1fffe2, 0x7fffed, 0x3fffe1, 0x7fffee, 0x7fffef,
+    0xfffea, 0x3fffe2, 0x3fffe3, 0x3fffe4, 0x7ffff0, 0x3fffe5, 0x3fffe6, 0x7ffff1,
+    0x3ffffe0, 0x3ffffe1, 0xfffeb, 0x7fff1, 0x3fffe7, 0x7ffff2, 0x3fffe8, 0x1ffffec,
+    0x3ffffe2, 0x3ffffe3, 0x3ffffe4, 0x7ffffde, 0x7ffffdf, 0x3ffffe5, 0xfffff1, 0x1ffffed,
+    0x7fff2, 0x1fffe3, 0x3ffffe6, 0x7ffffe0, 0x7ffffe1, 0x3ffffe7, 0x7ffffe2, 0xfffff2,
+    0x1fffe4, 0x1fffe5, 0x3ffffe8, 0x3ffffe9, 0xffffffd, 0x7ffffe3, 0x7ffffe4, 0x7ffffe5,
+    0xfffec, 0xfffff3, 0xfffed, 0x1fffe6, 0x3fffe9, 0x1fffe7, 0x1fffe8, 0x7ffff3,
+    0x3fffea, 0x3fffeb, 0x1ffffee, 0x1ffffef, 0xfffff4, 0xfffff5, 0x3ffffea, 0x7ffff4,
+    0x3ffffeb, 0x7ffffe6, 0x3ffffec, 0x3ffffed, 0x7ffffe7, 0x7ffffe8, 0x7ffffe9, 0x7ffffea,
+    0x7ffffeb, 0xffffffe, 0x7ffffec, 0x7ffffed, 0x7ffffee, 0x7ffffef, 0x7fffff0, 0x3ffffee,
+};
+const uint8_t HUFFMAN_LEN[256] = {
+    13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+    28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+    6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+    5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+    13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+    15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+    6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+    20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+    24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+    22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+    21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+    26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+    19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+    20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+    26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+};
+
+/**
+ * @brief 范式哈夫曼解码表: 同一长度的码字连续递增, 按长度记录首个码字和对应符号的起始位置
+*/
+struct HuffmanTable {
+    uint32_t first[31];     // 该长度的首个码字
+    uint32_t count[31];     // 该长度的码字数
+    uint32_t offset[31];    // 该长度的首个符号在symbols中的位置
+    uint8_t symbols[256];   // 按(长度, 码字)排序的符号
+
+    HuffmanTable() {
+        std::fill(first, first + 31, 0);
+        std::fill(count, count + 31, 0);
+        std::fill(offset, offset + 31, 0);
+        int order[256];
+        for (int i = 0; i < 256; i++) {
+            order[i] = i;
+            count[HUFFMAN_LEN[i]]++;
+        }
+        std::sort(order, order + 256, [](int a, int b) {
+            return HUFFMAN_LEN[a] != HUFFMAN_LEN[b] ? HUFFMAN_LEN[a] < HUFFMAN_LEN[b] : HUFFMAN_CODE[a] < HUFFMAN_CODE[b];
+        });
+        for (int i = 0; i < 256; i++) {
+            symbols[i] = static_cast<uint8_t>(order[i]);
+        }
+        uint32_t pos = 0;
+        for (int len = 1; len <= 30; len++) {
+            offset[len] = pos;
+            pos += count[len];
+        }
+        for (int i = 255; i >= 0; i--) {
+            first[HUFFMAN_LEN[order[i]]] = HUFFMAN_CODE[order[i]];
+        }
+    }
+};
+
+const HuffmanTable& GetHuffmanTable() {
+    static const HuffmanTable table;
+    return table;
+}
+
+/**
+ * @brief 可以直接引用静态表的状态码
+*/
+int StatusIndex(int code) {
+    switch (code) {
+        case 200: return 8;
+        case 204: return 9;
+        case 206: return 10;
+        case 304: return 11;
+        case 400: return 12;
+        case 404: return 13;
+        case 500: return 14;
+        default: return 0;
+    }
+}
+
+/**
+ * @brief 静态表中名字匹配的第一项, 没有返回0
+*/
+size_t StaticNameIndex(std::string_view name) {
+    for (size_t i = 0; i < STATIC_TABLE_SIZE; i++) {
+        if (name == STATIC_TABLE[i].name) {
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+}  // namespace
+
+HpackDecoder::HpackDecoder(size_t maxTableSize)
+    : tableSize_(0), maxTableSize_(maxTableSize), settingsMaxTableSize_(maxTableSize) {}
+
+/**
+ * @brief 解码头部块, RFC 7541 6
+*/
+bool HpackDecoder::Decode(std::string_view block, const FieldCallback& emit) {
+    bool fieldSeen = false;
+    while (!block.empty()) {
+        uint8_t first = static_cast<uint8_t>(block[0]);
+        uint64_t index = 0;
+        std::string_view name, value;
+        if (first & 0x80) {
+            /* 6.1 索引字段 */
+            if (!DecodeInt_(&block, 7, &index) || index == 0 || !Lookup_(index, &name, &value)) {
+                return false;
+            }
+            emit(name, value);
+            fieldSeen = true;
+            continue;
+        }
+        if ((first & 0xe0) == 0x20) {
+            /* 6.3 动态表大小更新, 只能出现在块的开头 */
+            if (fieldSeen || !DecodeInt_(&block, 5, &index) || index > settingsMaxTableSize_) {
+                return false;
+            }
+            maxTableSize_ = index;
+            Evict_(maxTableSize_);
+            continue;
+        }
+        /* 6.2 字面量: 01 加入索引, 0000 不索引, 0001 永不索引 */
+        bool indexing = (first & 0xc0) == 0x40;
+        if (!DecodeInt_(&block, indexing ? 6 : 4, &index)) {
+            return false;
+        }
+        if (index) {
+            std::string_view ignored;
+            if (!Lookup_(index, &name, &ignored)) {
+                return false;
+            }
+            /* 名字可能引用动态表, 插入时会被淘汰, 先复制 */
+            name_.assign(name.data(), name.size());
+        } else if (!DecodeString_(&block, &name_)) {
+            return false;
+        }
+        if (!DecodeString_(&block, &value_)) {
+            return false;
+        }
+        if (indexing) {
+            Insert_(name_, value_);
+        }
+        emit(name_, value_);
+        fieldSeen = true;
+    }
+    return true;
+}
+
+/**
+ * @brief 按索引查找, 1~61为静态表, 其后为动态表
+*/
+bool HpackDecoder::Lookup_(uint64_t index, std::string_view* name, std::string_view* value) const {
+    if (index <= STATIC_TABLE_SIZE) {
+        *name = STATIC_TABLE[index - 1].name;
+        *value = STATIC_TABLE[index - 1].value;
+        return true;
+    }
+    index -= STATIC_TABLE_SIZE + 1;
+    if (index >= table_.size()) {
+        return false;
+    }
+    *name = table_[index].first;
+    *value = table_[index].second;
+    return true;
+}
+
+/**
+ * @brief 插入动态表, 超出上限时从最旧的开始淘汰, 单项超过上限时清空表
+*/
+void HpackDecoder::Insert_(std::string_view name, std::string_view value) {
+    size_t size = name.size() + value.size() + ENTRY_OVERHEAD;
+    if (size > maxTableSize_) {
+        Evict_(0);
+        return;
+    }
+    Evict_(maxTableSize_ - size);
+    table_.emplace_front(std::string(name), std::string(value));
+    tableSize_ += size;
+}
+
+void HpackDecoder::Evict_(size_t maxSize) {
+    while (tableSize_ > maxSize && !table_.empty()) {
+        tableSize_ -= table_.back().first.size() + table_.back().second.size() + ENTRY_OVERHEAD;
+        table_.pop_back();
+    }
+}
+
+/**
+ * @brief 前缀整数, RFC 7541 5.1
+*/
+bool HpackDecoder::DecodeInt_(std::string_view* in, int prefix, uint64_t* value) {
+    assert(!in->empty());
+    uint64_t mask = (1u << prefix) - 1;
+    uint64_t result = static_cast<uint8_t>((*in)[0]) & mask;
+    in->remove_prefix(1);
+    if (result < mask) {
+        *value = result;
+        return true;
+    }
+    /* 最多接受 7*4 位的增量, 足够表示任何合理的长度和索引 */
+    for (int shift = 0; shift <= 21; shift += 7) {
+        if (in->empty()) {
+            return false;
+        }
+        uint8_t byte = static_cast<uint8_t>((*in)[0]);
+        in->remove_prefix(1);
+        result += static_cast<uint64_t>(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            *value = result;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief 字符串字面量, RFC 7541 5.2
+*/
+bool HpackDecoder::DecodeString_(std::string_view* in, std::string* out) {
+    if (in->empty()) {
+        return false;
+    }
+    bool huffman = static_cast<uint8_t>((*in)[0]) & 0x80;
+    uint64_t len = 0;
+    if (!DecodeInt_(in, 7, &len) || len > in->size()) {
+        return false;
+    }
+    std::string_view str = in->substr(0, len);
+    in->remove_prefix(len);
+    out->clear();
+    if (huffman) {
+        return Huffman::Decode(str, out);
+    }
+    out->assign(str.data(), str.size());
+    return true;
+}
+
+/**
+ * @brief :status, 常见状态码直接引用静态表
+*/
+void HpackEncoder::EncodeStatus(int code, std::string* out) {
+    int index = StatusIndex(code);
+    if (index) {
+        EncodeInt_(index, 7, 0x80, out);
+        return;
+    }
+    char value[4] = {char('0' + code / 100 % 10), char('0' + code / 10 % 10), char('0' + code % 10), '\0'};
+    EncodeInt_(8, 4, 0x00, out);
+    EncodeString_(std::string_view(value, 3), out);
+}
+
+/**
+ * @brief 不加入索引的字面量, 名字必须已是小写
+*/
+void HpackEncoder::Encode(std::string_view name, std::string_view value, std::string* out) {
+    size_t index = StaticNameIndex(name);
+    EncodeInt_(index, 4, 0x00, out);
+    if (!index) {
+        EncodeString_(name, out);
+    }
+    EncodeString_(value, out);
+}
+
+void HpackEncoder::EncodeInt_(uint64_t value, int prefix, uint8_t flags, std::string* out) {
+    uint64_t mask = (1u << prefix) - 1;
+    if (value < mask) {
+        out->push_back(static_cast<char>(flags | value));
+        return;
+    }
+    out->push_back(static_cast<char>(flags | mask));
+    value -= mask;
+    while (value >= 0x80) {
+        out->push_back(static_cast<char>((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    out->push_back(static_cast<char>(value));
+}
+
+void HpackEncoder::EncodeString_(std::string_view str, std::string* out) {
+    size_t len = Huffman::EncodedLength(str);
+    if (len < str.size()) {
+        EncodeInt_(len, 7, 0x80, out);
+        Huffman::Encode(str, out);
+    } else {
+        EncodeInt_(str.size(), 7, 0x00, out);
+        out->append(str.data(), str.size());
+    }
+}
+
+/**
+ * @brief 逐位解码; 末尾不足一个字节的填充必须是EOS的前缀(全1), RFC 7541 5.2
+*/
+bool Huffman::Decode(std::string_view in, std::string* out) {
+    const HuffmanTable& table = GetHuffmanTable();
+    uint32_t code = 0;
+    int len = 0;
+    for (unsigned char byte : in) {
+        for (int bit = 7; bit >= 0; bit--) {
+            code = (code << 1) | ((byte >> bit) & 1);
+            len++;
+            if (code - table.first[len] < table.count[len]) {
+                out->push_back(static_cast<char>(table.symbols[table.offset[len] + code - table.first[len]]));
+                code = 0;
+                len = 0;
+            } else if (len >= 30) {
+                /* 30位仍未匹配, 只可能是EOS */
+                return false;
+            }
+        }
+    }
+    return len < 8 && code == (1u << len) - 1;
+}
+
+size_t Huffman::EncodedLength(std::string_view in) {
+    size_t bits = 0;
+    for (unsigned char c : in) {
+        bits += HUFFMAN_LEN[c];
+    }
+    return (bits + 7) / 8;
+}
+
+void Huffman::Encode(std::string_view in, std::string* out) {
+    uint64_t acc = 0;
+    int bits = 0;
+    for (unsigned char c : in) {
+        acc = (acc << HUFFMAN_LEN[c]) | HUFFMAN_CODE[c];
+        bits += HUFFMAN_LEN[c];
+        while (bits >= 8) {
+            bits -= 8;
+            out->push_back(static_cast<char>(acc >> bits));
+        }
+    }
+    if (bits > 0) {
+        /* 用EOS的高位(全1)填充 */
+        out->push_back(static_cast<char>((acc << (8 - bits)) | ((1u << (8 - bits)) - 1)));
+    }
+}
@@ -0,0 +1,67 @@
+#ifndef HPACK_H
+#define HPACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <deque>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <utility>
+
+/**
+ * @brief HPACK(RFC 7541)头部解码器, 每个HTTP/2连接一个, 维护对端的动态表
+*/
+class HpackDecoder {
+public:
+    typedef std::function<void(std::string_view name, std::string_view value)> FieldCallback;
+
+    explicit HpackDecoder(size_t maxTableSize = 4096);
+
+    /**
+     * @brief 解码一个完整的头部块(HEADERS + CONTINUATION), 每个字段回调一次
+     * @return 格式错误返回false, 属于连接错误(COMPRESSION_ERROR)
+    */
+    bool Decode(std::string_view block, const FieldCallback& emit);
+
+private:
+    bool Lookup_(uint64_t index, std::string_view* name, std::string_view* value) const;
+    void Insert_(std::string_view name, std::string_view value);
+    void Evict_(size_t maxSize);
+
+    static bool DecodeInt_(std::string_view* in, int prefix, uint64_t* value);
+    static bool DecodeString_(std::string_view* in, std::string* out);
+
+    std::deque<std::pair<std::string, std::string>> table_;  // 动态表, 头部为最新
+    size_t tableSize_;                                        // 动态表当前大小(RFC计算方式)
+    size_t maxTableSize_;                                     // 当前上限, 由对端的大小更新指令调整
+    size_t settingsMaxTableSize_;                             // SETTINGS_HEADER_TABLE_SIZE, 上限的上限
+    std::string name_, value_;                                // 解码字符串的复用缓冲
+};
+
+/**
+ * @brief HPACK头部编码器
+ * 不使用动态表(对端无需为本连接维护状态), 名字尽量引用静态表, 字符串按哈夫曼编码更短时编码
+*/
+class HpackEncoder {
+public:
+    static void EncodeStatus(int code, std::string* out);
+    static void Encode(std::string_view name, std::string_view value, std::string* out);
+
+private:
+    static void EncodeInt_(uint64_t value, int prefix, uint8_t flags, std::string* out);
+    static void EncodeString_(std::string_view str, std::string* out);
+};
+
+/**
+ * @brief HPACK哈夫曼编码
+*/
+class Huffman {
+public:
+    static bool Decode(std::string_view in, std::string* out);
+    static size_t EncodedLength(std::string_view in);
+    static void Encode(std::string_view in, std::string* out);
+};
+
+#endif
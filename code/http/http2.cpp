@@ -0,0 +1,817 @@
+#include "http2.h"
+
+#include <assert.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "../log/log.h"
+#include "httprequest.h"
+#include "httpresponse.h"
+
+namespace {
+
+const char CLIENT_PREFACE[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+const size_t PREFACE_LEN = sizeof(CLIENT_PREFACE) - 1;
+
+const size_t FRAME_HEADER_LEN = 9;
+const size_t MAX_FRAME_SIZE = 16384;            // 本端SETTINGS_MAX_FRAME_SIZE, 使用默认值
+const size_t MAX_HEADER_BLOCK = 64 * 1024;      // 头部块(压缩后)上限
+const size_t MAX_REQUEST_BODY = 1024 * 1024;    // 请求体上限
+const int64_t DEFAULT_WINDOW = 65535;
+const int64_t MAX_WINDOW = 0x7fffffff;
+
+const uint8_t FLAG_END_STREAM = 0x1;
+const uint8_t FLAG_ACK = 0x1;
+const uint8_t FLAG_END_HEADERS = 0x4;
+const uint8_t FLAG_PADDED = 0x8;
+const uint8_t FLAG_PRIORITY = 0x20;
+
+enum SettingId : uint16_t {
+    SETTINGS_HEADER_TABLE_SIZE = 0x1,
+    SETTINGS_ENABLE_PUSH = 0x2,
+    SETTINGS_MAX_CONCURRENT_STREAMS = 0x3,
+    SETTINGS_INITIAL_WINDOW_SIZE = 0x4,
+    SETTINGS_MAX_FRAME_SIZE = 0x5,
+    SETTINGS_MAX_HEADER_LIST_SIZE = 0x6,
+};
+
+uint32_t ReadUint32(const char* p) {
+    const uint8_t* u = reinterpret_cast<const uint8_t*>(p);
+    return (uint32_t(u[0]) << 24) | (uint32_t(u[1]) << 16) | (uint32_t(u[2]) << 8) | u[3];
+}
+
+void WriteUint32(char* p, uint32_t value) {
+    p[0] = static_cast<char>(value >> 24);
+    p[1] = static_cast<char>(value >> 16);
+    p[2] = static_cast<char>(value >> 8);
+    p[3] = static_cast<char>(value);
+}
+
+/**
+ * @brief 去掉PADDED标志带来的填充, 填充长度不小于负载时为协议错误
+*/
+bool StripPadding(uint8_t flags, std::string_view* payload) {
+    if (!(flags & FLAG_PADDED)) {
+        return true;
+    }
+    if (payload->empty()) {
+        return false;
+    }
+    size_t padLen = static_cast<uint8_t>((*payload)[0]);
+    if (padLen >= payload->size()) {
+        return false;
+    }
+    payload->remove_prefix(1);
+    payload->remove_suffix(padLen);
+    return true;
+}
+
+/**
+ * @brief base64url解码(RFC 4648 5, 不带填充), HTTP2-Settings使用
+*/
+bool Base64UrlDecode(std::string_view in, std::string* out) {
+    uint32_t acc = 0;
+    int bits = 0;
+    for (char c : in) {
+        int v;
+        if (c >= 'A' && c <= 'Z') {
+            v = c - 'A';
+        } else if (c >= 'a' && c <= 'z') {
+            v = c - 'a' + 26;
+        } else if (c >= '0' && c <= '9') {
+            v = c - '0' + 52;
+        } else if (c == '-' || c == '+') {
+            v = 62;
+        } else if (c == '_' || c == '/') {
+            v = 63;
+        } else if (c == '=') {
+            break;
+        } else {
+            return false;
+        }
+        acc = (acc << 6) | v;
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            out->push_back(static_cast<char>(acc >> bits));
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief HTTP/2禁止的逐跳头部, 转换HTTP/1响应头时丢弃
+*/
+bool IsConnectionHeader(std::string_view name) {
+    return name == "connection" || name == "keep-alive" || name == "proxy-connection" ||
+           name == "transfer-encoding" || name == "upgrade";
+}
+
+}  // namespace
+
+Http2Session::Http2Session()
+    : prefaceReceived_(false), settingsReceived_(false), goAway_(false), fatal_(false), lastStreamId_(0),
+      headerStream_(0), headerEndStream_(false), headerRefused_(false), connWindow_(DEFAULT_WINDOW),
+      initialWindow_(DEFAULT_WINDOW), peerMaxFrame_(MAX_FRAME_SIZE), vtime_(0), control_(256), scratch_(512) {
+    /* 服务端前言: 不推送, 限制并发流数, 其余使用默认值 */
+    char settings[12];
+    settings[0] = 0;
+    settings[1] = SETTINGS_ENABLE_PUSH;
+    WriteUint32(settings + 2, 0);
+    settings[6] = 0;
+    settings[7] = SETTINGS_MAX_CONCURRENT_STREAMS;
+    WriteUint32(settings + 8, MAX_CONCURRENT_STREAMS);
+    AppendFrame_(control_, SETTINGS, 0, 0, std::string_view(settings, sizeof(settings)));
+}
+
+/**
+ * @brief 检查连接前言
+*/
+Http2Session::PrefaceState Http2Session::CheckPreface(const Buffer& buff) {
+    size_t len = std::min(buff.ReadableBytes(), PREFACE_LEN);
+    if (memcmp(buff.Peek(), CLIENT_PREFACE, len) != 0) {
+        return NOT_PREFACE;
+    }
+    return len == PREFACE_LEN ? PREFACE : PARTIAL_PREFACE;
+}
+
+/**
+ * @brief h2c升级条件, 带请求体的升级请求直接按HTTP/1处理
+*/
+bool Http2Session::IsUpgradeRequest(const HttpRequest& request) {
+    return request.version() == "1.1" && httptable::ContainsToken(request.header(HttpHeader::UPGRADE), "h2c") &&
+           !request.header(HttpHeader::HTTP2_SETTINGS).empty() &&
+           request.header(HttpHeader::CONTENT_LENGTH).empty() &&
+           request.header(HttpHeader::TRANSFER_ENCODING).empty();
+}
+
+/**
+ * @brief h2c升级, RFC 7540 3.2
+*/
+bool Http2Session::Upgrade(std::string_view settings) {
+    std::string payload;
+    if (!Base64UrlDecode(settings, &payload) || payload.size() % 6 != 0 || !ApplySettings_(payload)) {
+        return false;
+    }
+    uint32_t id = UPGRADE_STREAM;
+    Stream& stream = streams_[id];
+    stream.id = id;
+    stream.remoteClosed = true;
+    stream.sendWindow = initialWindow_;
+    stream.vtime = vtime_;
+    lastStreamId_ = id;
+    return true;
+}
+
+/**
+ * @brief 拆帧, 不完整的帧留在缓冲区中等待更多数据
+*/
+bool Http2Session::Feed(Buffer& buff) {
+    if (fatal_) {
+        buff.RetrieveAll();
+        return false;
+    }
+    if (!prefaceReceived_) {
+        PrefaceState state = CheckPreface(buff);
+        if (state == PARTIAL_PREFACE) {
+            return true;
+        }
+        if (state == NOT_PREFACE) {
+            buff.RetrieveAll();
+            return SendGoAway_(PROTOCOL_ERROR);
+        }
+        buff.Retrieve(PREFACE_LEN);
+        prefaceReceived_ = true;
+    }
+    while (buff.ReadableBytes() >= FRAME_HEADER_LEN) {
+        const uint8_t* header = reinterpret_cast<const uint8_t*>(buff.Peek());
+        size_t len = (size_t(header[0]) << 16) | (size_t(header[1]) << 8) | header[2];
+        uint8_t type = header[3];
+        uint8_t flags = header[4];
+        uint32_t id = ReadUint32(buff.Peek() + 5) & 0x7fffffff;
+        if (len > MAX_FRAME_SIZE) {
+            buff.RetrieveAll();
+            return SendGoAway_(FRAME_SIZE_ERROR);
+        }
+        if (buff.ReadableBytes() < FRAME_HEADER_LEN + len) {
+            break;
+        }
+        std::string_view payload(buff.Peek() + FRAME_HEADER_LEN, len);
+        bool ok = HandleFrame_(type, flags, id, payload);
+        buff.Retrieve(FRAME_HEADER_LEN + len);
+        if (!ok) {
+            buff.RetrieveAll();
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief 按类型分发帧
+*/
+bool Http2Session::HandleFrame_(uint8_t type, uint8_t flags, uint32_t id, std::string_view payload) {
+    /* 前言之后的第一个帧必须是SETTINGS */
+    if (!settingsReceived_ && type != SETTINGS) {
+        return SendGoAway_(PROTOCOL_ERROR);
+    }
+    /* 头部块必须连续, 中间不能插入其他帧 */
+    if (headerStream_ && type != CONTINUATION) {
+        return SendGoAway_(PROTOCOL_ERROR);
+    }
+    switch (type) {
+        case DATA: return OnData_(flags, id, payload);
+        case HEADERS: return OnHeaders_(flags, id, payload);
+        case PRIORITY: return OnPriority_(id, payload);
+        case RST_STREAM: return OnRstStream_(id, payload);
+        case SETTINGS: return OnSettings_(flags, id, payload);
+        case PUSH_PROMISE: return SendGoAway_(PROTOCOL_ERROR);
+        case PING: return OnPing_(flags, id, payload);
+        case GOAWAY:
+            if (id != 0) {
+                return SendGoAway_(PROTOCOL_ERROR);
+            }
+            goAway_ = true;
+            return true;
+        case WINDOW_UPDATE: return OnWindowUpdate_(id, payload);
+        case CONTINUATION: return OnContinuation_(flags, id, payload);
+        default: return true;   // 未知类型的帧必须忽略
+    }
+}
+
+/**
+ * @brief DATA帧: 累积请求体, 消耗的窗口立即归还
+*/
+bool Http2Session::OnData_(uint8_t flags, uint32_t id, std::string_view payload) {
+    if (id == 0) {
+        return SendGoAway_(PROTOCOL_ERROR);
+    }
+    size_t consumed = payload.size();
+    if (!StripPadding(flags, &payload)) {
+        return SendGoAway_(PROTOCOL_ERROR);
+    }
+    if (consumed > 0) {
+        SendWindowUpdate_(0, consumed);
+    }
+    Stream* stream = Find_(id);
+    if (!stream || stream->remoteClosed) {
+        if (id > lastStreamId_) {
+            return SendGoAway_(PROTOCOL_ERROR);
+        }
+        SendRstStream_(id, STREAM_CLOSED);
+        return true;
+    }
+    if (stream->body.size() + payload.size() > MAX_REQUEST_BODY) {
+        SendRstStream_(id, CANCEL);
+        Close_(id);
+        return true;
+    }
+    stream->body.append(payload.data(), payload.size());
+    if (flags & FLAG_END_STREAM) {
+        stream->remoteClosed = true;
+        ready_.push_back(id);
+    } else if (consumed > 0) {
+        SendWindowUpdate_(id, consumed);
+    }
+    return true;
+}
+
+/**
+ * @brief HEADERS帧: 打开新流, 或是请求尾部(trailers)
+*/
+bool Http2Session::OnHeaders_(uint8_t flags, uint32_t id, std::string_view payload) {
+    if (id == 0 || id % 2 == 0 || !StripPadding(flags, &payload)) {
+        return SendGoAway_(PROTOCOL_ERROR);
+    }
+    std::string_view priority;
+    if (flags & FLAG_PRIORITY) {
+        if (payload.size() < 5) {
+            return SendGoAway_(FRAME_SIZE_ERROR);
+        }
+        priority = payload.substr(0, 5);
+        payload.remove_prefix(5);
+    }
+
+    Stream* stream = Find_(id);
+    headerRefused_ = false;
+    if (stream) {
+        /* 已有的流上只能是请求尾部, 且必须结束流 */
+        if (stream->remoteClosed) {
+            return SendGoAway_(STREAM_CLOSED);
+        }
+        if (!(flags & FLAG_END_STREAM)) {
+            return SendGoAway_(PROTOCOL_ERROR);
+        }
+    } else {
+        if (id <= lastStreamId_) {
+            return SendGoAway_(PROTOCOL_ERROR);
+        }
+        lastStreamId_ = id;
+        if (goAway_ || streams_.size() >= MAX_CONCURRENT_STREAMS) {
+            SendRstStream_(id, REFUSED_STREAM);
+            headerRefused_ = true;
+        } else {
+            stream = &streams_[id];
+            stream->id = id;
+            stream->sendWindow = initialWindow_;
+            stream->vtime = vtime_;
+        }
+    }
+    if (stream && !priority.empty()) {
+        SetWeight_(stream, priority);
+    }
+    headerStream_ = id;
+    headerEndStream_ = flags & FLAG_END_STREAM;
+    headerBlock_.assign(payload.data(), payload.size());
+    if (flags & FLAG_END_HEADERS) {
+        return OnHeaderBlock_();
+    }
+    return true;
+}
+
+/**
+ * @brief CONTINUATION帧: 继续累积头部块
+*/
+bool Http2Session::OnContinuation_(uint8_t flags, uint32_t id, std::string_view payload) {
+    if (headerStream_ == 0 || id != headerStream_) {
+        return SendGoAway_(PROTOCOL_ERROR);
+    }
+    if (headerBlock_.size() + payload.size() > MAX_HEADER_BLOCK) {
+        return SendGoAway_(ENHANCE_YOUR_CALM);
+    }
+    headerBlock_.append(payload.data(), payload.size());
+    if (flags & FLAG_END_HEADERS) {
+        return OnHeaderBlock_();
+    }
+    return true;
+}
+
+/**
+ * @brief 头部块接收完整: 解码, 校验伪头部, 请求结束时放入就绪队列
+*/
+bool Http2Session::OnHeaderBlock_() {
+    uint32_t id = headerStream_;
+    headerStream_ = 0;
+    Stream* stream = headerRefused_ ? nullptr : Find_(id);
+    /* 请求尾部只解码不保存, 被拒绝的流也必须解码以保持动态表同步 */
+    bool trailers = stream && !stream->fields.empty();
+    bool ok = decoder_.Decode(headerBlock_, [&](std::string_view name, std::string_view value) {
+        if (stream && !trailers) {
+            stream->fields.emplace_back(std::string(name), std::string(value));
+        }
+    });
+    if (!ok) {
+        return SendGoAway_(COMPRESSION_ERROR);
+    }
+    if (!stream) {
+        return true;
+    }
+    if (!trailers) {
+        bool hasMethod = false, hasPath = false;
+        for (const auto& field : stream->fields) {
+            if (field.first == ":method") {
+                hasMethod = true;
+                stream->head = field.second == "HEAD";
+            } else if (field.first == ":path") {
+                hasPath = !field.second.empty();
+            }
+        }
+        if (!hasMethod || !hasPath) {
+            SendRstStream_(id, PROTOCOL_ERROR);
+            Close_(id);
+            return true;
+        }
+    }
+    if (headerEndStream_) {
+        stream->remoteClosed = true;
+        ready_.push_back(id);
+    }
+    return true;
+}
+
+/**
+ * @brief PRIORITY帧: 只采用权重, 依赖关系不建树
+*/
+bool Http2Session::OnPriority_(uint32_t id, std::string_view payload) {
+    if (id == 0) {
+        return SendGoAway_(PROTOCOL_ERROR);
+    }
+    if (payload.size() != 5) {
+        return SendGoAway_(FRAME_SIZE_ERROR);
+    }
+    Stream* stream = Find_(id);
+    if (stream) {
+        SetWeight_(stream, payload);
+    }
+    return true;
+}
+
+/**
+ * @brief RST_STREAM帧: 丢弃流及未发送的响应
+*/
+bool Http2Session::OnRstStream_(uint32_t id, std::string_view payload) {
+    if (id == 0 || id > lastStreamId_) {
+        return SendGoAway_(PROTOCOL_ERROR);
+    }
+    if (payload.size() != 4) {
+        return SendGoAway_(FRAME_SIZE_ERROR);
+    }
+    Close_(id);
+    return true;
+}
+
+/**
+ * @brief SETTINGS帧: 应用并确认
+*/
+bool Http2Session::OnSettings_(uint8_t flags, uint32_t id, std::string_view payload) {
+    if (id != 0) {
+        return SendGoAway_(PROTOCOL_ERROR);
+    }
+    if (flags & FLAG_ACK) {
+        return payload.empty() ? true : SendGoAway_(FRAME_SIZE_ERROR);
+    }
+    if (payload.size() % 6 != 0) {
+        return SendGoAway_(FRAME_SIZE_ERROR);
+    }
+    settingsReceived_ = true;
+    if (!ApplySettings_(payload)) {
+        return false;
+    }
+    AppendFrame_(control_, SETTINGS, FLAG_ACK, 0, std::string_view());
+    return true;
+}
+
+/**
+ * @brief 应用对端设置, 只有影响发送的两项需要记录
+*/
+bool Http2Session::ApplySettings_(std::string_view payload) {
+    for (size_t i = 0; i + 6 <= payload.size(); i += 6) {
+        uint16_t key = (uint16_t(static_cast<uint8_t>(payload[i])) << 8) | static_cast<uint8_t>(payload[i + 1]);
+        uint32_t value = ReadUint32(payload.data() + i + 2);
+        switch (key) {
+            case SETTINGS_ENABLE_PUSH:
+                if (value > 1) {
+                    return SendGoAway_(PROTOCOL_ERROR);
+                }
+                break;
+            case SETTINGS_INITIAL_WINDOW_SIZE: {
+                if (value > MAX_WINDOW) {
+                    return SendGoAway_(FLOW_CONTROL_ERROR);
+                }
+                /* 初始窗口的变化作用于所有已打开的流 */
+                int64_t delta = int64_t(value) - initialWindow_;
+                initialWindow_ = value;
+                for (auto& item : streams_) {
+                    item.second.sendWindow += delta;
+                    if (item.second.sendWindow > MAX_WINDOW) {
+                        return SendGoAway_(FLOW_CONTROL_ERROR);
+                    }
+                }
+                break;
+            }
+            case SETTINGS_MAX_FRAME_SIZE:
+                if (value < MAX_FRAME_SIZE || value > 0xffffff) {
+                    return SendGoAway_(PROTOCOL_ERROR);
+                }
+                peerMaxFrame_ = value;
+                break;
+            default:
+                /* HEADER_TABLE_SIZE: 编码器不使用动态表; 其余设置不影响服务端 */
+                break;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief PING帧: 原样回复
+*/
+bool Http2Session::OnPing_(uint8_t flags, uint32_t id, std::string_view payload) {
+    if (id != 0) {
+        return SendGoAway_(PROTOCOL_ERROR);
+    }
+    if (payload.size() != 8) {
+        return SendGoAway_(FRAME_SIZE_ERROR);
+    }
+    if (!(flags & FLAG_ACK)) {
+        AppendFrame_(control_, PING, FLAG_ACK, 0, payload);
+    }
+    return true;
+}
+
+/**
+ * @brief WINDOW_UPDATE帧: 增加连接或流的发送窗口
+*/
+bool Http2Session::OnWindowUpdate_(uint32_t id, std::string_view payload) {
+    if (payload.size() != 4) {
+        return SendGoAway_(FRAME_SIZE_ERROR);
+    }
+    uint32_t increment = ReadUint32(payload.data()) & 0x7fffffff;
+    if (id == 0) {
+        if (increment == 0) {
+            return SendGoAway_(PROTOCOL_ERROR);
+        }
+        connWindow_ += increment;
+        return connWindow_ <= MAX_WINDOW ? true : SendGoAway_(FLOW_CONTROL_ERROR);
+    }
+    Stream* stream = Find_(id);
+    if (!stream) {
+        return id > lastStreamId_ ? SendGoAway_(PROTOCOL_ERROR) : true;
+    }
+    stream->sendWindow += increment;
+    if (increment == 0 || stream->sendWindow > MAX_WINDOW) {
+        SendRstStream_(id, increment == 0 ? PROTOCOL_ERROR : FLOW_CONTROL_ERROR);
+        Close_(id);
+    }
+    return true;
+}
+
+/**
+ * @brief 优先级字段的最后一个字节为权重-1
+*/
+void Http2Session::SetWeight_(Stream* stream, std::string_view priority) {
+    assert(stream && priority.size() == 5);
+    stream->weight = static_cast<uint8_t>(priority[4]) + 1;
+}
+
+Http2Session::Stream* Http2Session::Find_(uint32_t id) {
+    auto it = streams_.find(id);
+    return it == streams_.end() ? nullptr : &it->second;
+}
+
+void Http2Session::Close_(uint32_t id) { streams_.erase(id); }
+
+bool Http2Session::HasPendingData_(const Stream& stream) const {
+    return stream.responded && stream.dataIdx < stream.data.size();
+}
+
+/**
+ * @brief 取出就绪的流, 跳过期间被重置的
+*/
+bool Http2Session::NextRequest(uint32_t* id) {
+    assert(id);
+    while (!ready_.empty() && !fatal_) {
+        *id = ready_.front();
+        ready_.pop_front();
+        if (Find_(*id)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief 伪头部转为请求行, :authority作为Host
+*/
+void Http2Session::BuildRequest(uint32_t id, HttpRequest* request) const {
+    assert(request);
+    auto it = streams_.find(id);
+    assert(it != streams_.end());
+    const Stream& stream = it->second;
+    std::string_view method, path, authority;
+    for (const auto& field : stream.fields) {
+        if (field.first == ":method") {
+            method = field.second;
+        } else if (field.first == ":path") {
+            path = field.second;
+        } else if (field.first == ":authority") {
+            authority = field.second;
+        }
+    }
+    request->SetRequestLine(method, path, "2.0");
+    for (const auto& field : stream.fields) {
+        if (field.first[0] != ':') {
+            request->SetHeader(field.first, field.second);
+        }
+    }
+    if (!authority.empty() && request->header(HttpHeader::HOST).empty()) {
+        request->SetHeader("Host", authority);
+    }
+    request->SetBody(stream.body);
+}
+
+/**
+ * @brief 把HttpResponse生成的HTTP/1响应转为HEADERS帧和待发送的数据段
+ * 文件数据直接引用缓存中的映射, 其余数据复制到流中
+*/
+void Http2Session::Respond(uint32_t id, HttpResponse& response) {
+    Stream* stream = Find_(id);
+    if (!stream || fatal_) {
+        return;
+    }
+    scratch_.RetrieveAll();
+    response.MakeResponse(scratch_);
+
+    /* 响应头依次在缓存的头部块和Buffer中, 第一行为状态行, 空行之后为内存中的响应体 */
+    block_.clear();
+    bool statusSeen = false;
+    auto encode = [&](std::string_view text) -> std::string_view {
+        while (!text.empty()) {
+            size_t eol = text.find("\r\n");
+            if (eol == std::string_view::npos) {
+                break;
+            }
+            std::string_view line = text.substr(0, eol);
+            text.remove_prefix(eol + 2);
+            if (line.empty()) {
+                return text;
+            }
+            if (!statusSeen) {
+                statusSeen = true;
+                HpackEncoder::EncodeStatus(line.size() >= 12 ? atoi(std::string(line.substr(9, 3)).c_str()) : 500,
+                                           &block_);
+                continue;
+            }
+            size_t colon = line.find(':');
+            if (colon == std::string_view::npos) {
+                continue;
+            }
+            lower_.assign(line.data(), colon);
+            std::transform(lower_.begin(), lower_.end(), lower_.begin(), ::tolower);
+            if (IsConnectionHeader(lower_)) {
+                continue;
+            }
+            std::string_view value = line.substr(colon + 1);
+            while (!value.empty() && value.front() == ' ') {
+                value.remove_prefix(1);
+            }
+            HpackEncoder::Encode(lower_, value, &block_);
+        }
+        return std::string_view();
+    };
+    encode(response.HeaderBlock());
+    std::string_view inlineBody = encode(std::string_view(scratch_.Peek(), scratch_.ReadableBytes()));
+
+    stream->responded = true;
+    stream->vtime = std::max(stream->vtime, vtime_);
+    if (!stream->head) {
+        const FileRef& file = response.File();
+        auto inFile = [&file](std::string_view data) {
+            return file && data.data() >= file->data && data.data() + data.size() <= file->data + file->size;
+        };
+        /* 先预留空间, 之后追加不会重新分配, 引用owned的数据段保持有效 */
+        size_t ownedLen = inlineBody.size();
+        for (size_t i = 0; i < response.BodyCount(); i++) {
+            ownedLen += inFile(response.Body(i)) ? 0 : response.Body(i).size();
+        }
+        stream->owned.reserve(ownedLen);
+        auto add = [&](std::string_view data) {
+            if (data.empty()) {
+                return;
+            }
+            if (!inFile(data)) {
+                size_t offset = stream->owned.size();
+                stream->owned.append(data.data(), data.size());
+                data = std::string_view(stream->owned.data() + offset, data.size());
+            }
+            stream->data.push_back(data);
+        };
+        add(inlineBody);
+        for (size_t i = 0; i < response.BodyCount(); i++) {
+            add(response.Body(i));
+        }
+        stream->file = file;
+    }
+    bool endStream = stream->data.empty();
+    AppendHeaders_(id, block_, endStream);
+    if (endStream) {
+        Close_(id);
+    }
+}
+
+/**
+ * @brief 先输出控制帧, 再按加权公平调度输出数据帧:
+ * 每次选虚拟时间最小且窗口未耗尽的流发送一帧, 权重越大虚拟时间增长越慢, 获得的带宽越多;
+ * buff中的片段在追加时可能重新分配, 先记录长度并把iov_base置空, 最后统一换成buff中的地址
+*/
+int Http2Session::Flush(Buffer& buff, struct iovec* iov, int maxIov) {
+    /* 上一批输出已写完, 结束的流不再被引用 */
+    retired_.clear();
+    int cnt = 0;
+    size_t mark = 0;    // buff中还没有放入iov的起点
+    auto addBuff = [&]() {
+        if (buff.ReadableBytes() > mark) {
+            iov[cnt].iov_base = nullptr;
+            iov[cnt].iov_len = buff.ReadableBytes() - mark;
+            mark = buff.ReadableBytes();
+            cnt++;
+        }
+    };
+    buff.Append(control_);
+    control_.RetrieveAll();
+    size_t out = 0;
+    /* h2c升级后先只发101和头部, 等收到客户端前言和SETTINGS再发数据, 避免客户端升级时缓冲不下 */
+    /* 每帧最多占用两个iovec(帧头所在的buff片段和负载), 再留一个给末尾的buff片段 */
+    while (settingsReceived_ && !fatal_ && connWindow_ > 0 && out < OUTPUT_LIMIT && cnt + 3 <= maxIov) {
+        Stream* next = nullptr;
+        for (auto& item : streams_) {
+            Stream& stream = item.second;
+            if (HasPendingData_(stream) && stream.sendWindow > 0 && (!next || stream.vtime < next->vtime)) {
+                next = &stream;
+            }
+        }
+        if (!next) {
+            break;
+        }
+        std::string_view& data = next->data[next->dataIdx];
+        size_t len = std::min({data.size(), peerMaxFrame_, static_cast<size_t>(next->sendWindow),
+                               static_cast<size_t>(connWindow_)});
+        bool last = len == data.size() && next->dataIdx + 1 == next->data.size();
+        uint8_t flags = last ? FLAG_END_STREAM : 0;
+        if (len < COPY_LIMIT) {
+            AppendFrame_(buff, DATA, flags, next->id, data.substr(0, len));
+        } else {
+            AppendFrameHeader_(buff, DATA, flags, next->id, len);
+            addBuff();
+            iov[cnt].iov_base = const_cast<char*>(data.data());
+            iov[cnt].iov_len = len;
+            cnt++;
+        }
+        data.remove_prefix(len);
+        if (data.empty()) {
+            next->dataIdx++;
+        }
+        out += len;
+        next->sendWindow -= len;
+        connWindow_ -= len;
+        vtime_ = next->vtime;
+        next->vtime += std::max<uint64_t>(1, len * 256 / next->weight);
+        if (last) {
+            /* 取出节点而不移动流, owned中的数据地址不变, 写完之前保持有效 */
+            retired_.push_back(streams_.extract(next->id));
+        }
+    }
+    addBuff();
+    size_t offset = 0;
+    for (int i = 0; i < cnt; i++) {
+        if (!iov[i].iov_base) {
+            iov[i].iov_base = const_cast<char*>(buff.Peek()) + offset;
+            offset += iov[i].iov_len;
+        }
+    }
+    return cnt;
+}
+
+void Http2Session::AppendFrame_(Buffer& buff, uint8_t type, uint8_t flags, uint32_t id, std::string_view payload) {
+    AppendFrameHeader_(buff, type, flags, id, payload.size());
+    if (!payload.empty()) {
+        buff.Append(payload.data(), payload.size());
+    }
+}
+
+void Http2Session::AppendFrameHeader_(Buffer& buff, uint8_t type, uint8_t flags, uint32_t id, size_t len) {
+    char header[FRAME_HEADER_LEN];
+    header[0] = static_cast<char>(len >> 16);
+    header[1] = static_cast<char>(len >> 8);
+    header[2] = static_cast<char>(len);
+    header[3] = static_cast<char>(type);
+    header[4] = static_cast<char>(flags);
+    WriteUint32(header + 5, id);
+    buff.Append(header, FRAME_HEADER_LEN);
+}
+
+/**
+ * @brief 头部块超过对端帧大小上限时拆成HEADERS + CONTINUATION
+*/
+void Http2Session::AppendHeaders_(uint32_t id, std::string_view block, bool endStream) {
+    uint8_t type = HEADERS;
+    uint8_t flags = endStream ? FLAG_END_STREAM : 0;
+    do {
+        std::string_view fragment = block.substr(0, peerMaxFrame_);
+        block.remove_prefix(fragment.size());
+        AppendFrame_(control_, type, flags | (block.empty() ? FLAG_END_HEADERS : 0), id, fragment);
+        type = CONTINUATION;
+        flags = 0;
+    } while (!block.empty());
+}
+
+void Http2Session::SendWindowUpdate_(uint32_t id, uint32_t increment) {
+    char payload[4];
+    WriteUint32(payload, increment);
+    AppendFrame_(control_, WINDOW_UPDATE, 0, id, std::string_view(payload, sizeof(payload)));
+}
+
+void Http2Session::SendRstStream_(uint32_t id, ErrorCode error) {
+    char payload[4];
+    WriteUint32(payload, error);
+    AppendFrame_(control_, RST_STREAM, 0, id, std::string_view(payload, sizeof(payload)));
+}
+
+/**
+ * @brief 连接错误: 发送GOAWAY, 之后不再处理任何帧
+ * @return 总是false, 便于在处理函数中直接返回
+*/
+bool Http2Session::SendGoAway_(ErrorCode error) {
+    if (!fatal_) {
+        LOG_WARN("http2 connection error: %u", error);
+        char payload[8];
+        WriteUint32(payload, lastStreamId_);
+        WriteUint32(payload + 4, error);
+        AppendFrame_(control_, GOAWAY, 0, 0, std::string_view(payload, sizeof(payload)));
+        fatal_ = true;
+    }
+    return false;
+}
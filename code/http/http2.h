@@ -0,0 +1,189 @@
+#ifndef HTTP2_H
+#define HTTP2_H
+
+#include <stdint.h>
+#include <sys/uio.h>
+
+#include <deque>
+#include <map>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "../buffer/buffer.h"
+#include "filecache.h"
+#include "hpack.h"
+
+class HttpRequest;
+class HttpResponse;
+
+/**
+ * @brief 一个HTTP/2明文(h2c)连接的会话状态(RFC 9113)
+ * HttpConn收到连接前言或h2c升级请求后创建, 之后读到的字节交给Feed拆帧, 请求完整的流按到达顺序取出,
+ * 仍由路由和HttpResponse生成响应, 再由Respond把HTTP/1格式的响应头转成HPACK;
+ * 数据帧按流量控制窗口和权重公平调度, 每次Flush最多输出OUTPUT_LIMIT字节, 写完后再继续;
+ * 数据帧的负载不拷贝, iovec直接指向文件缓存的映射或流自己保存的数据
+*/
+class Http2Session {
+public:
+    Http2Session();
+
+    enum PrefaceState {
+        NOT_PREFACE,
+        PARTIAL_PREFACE,    // 已收到的字节是前言的前缀, 需要等待更多数据
+        PREFACE,
+    };
+
+    /**
+     * @brief 读缓冲区开头是否为客户端连接前言(prior knowledge)
+    */
+    static PrefaceState CheckPreface(const Buffer& buff);
+
+    /**
+     * @brief 是否为可以接受的 Upgrade: h2c 请求(带HTTP2-Settings且没有请求体)
+    */
+    static bool IsUpgradeRequest(const HttpRequest& request);
+
+    /**
+     * @brief h2c升级: 应用HTTP2-Settings中的设置, 升级请求本身成为已半关闭的流1
+     * @return HTTP2-Settings格式错误返回false, 此时应按HTTP/1处理请求
+    */
+    bool Upgrade(std::string_view settings);
+
+    /**
+     * @brief 处理缓冲区中所有完整的帧
+     * @return 发生连接错误时返回false, GOAWAY已放入输出
+    */
+    bool Feed(Buffer& buff);
+
+    /**
+     * @brief 取出下一个请求已完整的流
+    */
+    bool NextRequest(uint32_t* id);
+
+    /**
+     * @brief 用流中的伪头部/头部/请求体填充请求
+    */
+    void BuildRequest(uint32_t id, HttpRequest* request) const;
+
+    /**
+     * @brief 生成流的响应, 响应头编码为HEADERS帧, 响应体留待Flush按窗口发送
+    */
+    void Respond(uint32_t id, HttpResponse& response);
+
+    /**
+     * @brief 输出一批帧: 控制帧和数据帧的帧头追加到buff, 与数据帧的负载按顺序填入iov
+     * 上一次Flush的输出必须已经写完, 期间结束的流要保留到下一次Flush才释放
+     * @return 填入的iovec个数, 为0时没有要发送的数据
+    */
+    int Flush(Buffer& buff, struct iovec* iov, int maxIov);
+
+    /**
+     * @brief 发生连接错误, 或对端GOAWAY后所有流均已结束
+    */
+    bool IsClosing() const { return fatal_ || (goAway_ && streams_.empty()); }
+
+    static const uint32_t UPGRADE_STREAM = 1;           // h2c升级请求所在的流
+    static const uint32_t MAX_CONCURRENT_STREAMS = 100; // 同时处理的流数上限
+    static const size_t OUTPUT_LIMIT = 64 * 1024;       // 单次Flush输出的数据上限
+    static const size_t COPY_LIMIT = 256;               // 小于此长度的负载直接拷贝进buff, 节省iovec
+
+private:
+    enum FrameType : uint8_t {
+        DATA = 0x0,
+        HEADERS = 0x1,
+        PRIORITY = 0x2,
+        RST_STREAM = 0x3,
+        SETTINGS = 0x4,
+        PUSH_PROMISE = 0x5,
+        PING = 0x6,
+        GOAWAY = 0x7,
+        WINDOW_UPDATE = 0x8,
+        CONTINUATION = 0x9,
+    };
+
+    enum ErrorCode : uint32_t {
+        NO_ERROR = 0x0,
+        PROTOCOL_ERROR = 0x1,
+        INTERNAL_ERROR = 0x2,
+        FLOW_CONTROL_ERROR = 0x3,
+        STREAM_CLOSED = 0x5,
+        FRAME_SIZE_ERROR = 0x6,
+        REFUSED_STREAM = 0x7,
+        CANCEL = 0x8,
+        COMPRESSION_ERROR = 0x9,
+        ENHANCE_YOUR_CALM = 0xb,
+    };
+
+    struct Stream {
+        uint32_t id = 0;
+        bool remoteClosed = false;  // 已收到END_STREAM, 请求完整
+        bool responded = false;     // 已生成响应
+        bool head = false;          // HEAD请求, 不发送响应体
+        int weight = 16;            // 优先级权重 1~256
+        int64_t sendWindow = 0;     // 发送窗口
+        uint64_t vtime = 0;         // 加权公平调度的虚拟时间, 发送n字节后增加 n*256/weight
+
+        std::vector<std::pair<std::string, std::string>> fields;   // 请求头部, 含伪头部
+        std::string body;           // 请求体
+
+        FileRef file;               // 响应体引用的缓存文件
+        std::string owned;          // 不在文件中的响应体数据(动态内容, multipart分隔头)
+        std::vector<std::string_view> data; // 待发送的响应体数据段
+        size_t dataIdx = 0;         // 第一个未发送完的数据段
+    };
+
+    bool HandleFrame_(uint8_t type, uint8_t flags, uint32_t id, std::string_view payload);
+    bool OnData_(uint8_t flags, uint32_t id, std::string_view payload);
+    bool OnHeaders_(uint8_t flags, uint32_t id, std::string_view payload);
+    bool OnPriority_(uint32_t id, std::string_view payload);
+    bool OnRstStream_(uint32_t id, std::string_view payload);
+    bool OnSettings_(uint8_t flags, uint32_t id, std::string_view payload);
+    bool OnPing_(uint8_t flags, uint32_t id, std::string_view payload);
+    bool OnWindowUpdate_(uint32_t id, std::string_view payload);
+    bool OnContinuation_(uint8_t flags, uint32_t id, std::string_view payload);
+    bool OnHeaderBlock_();
+
+    bool ApplySettings_(std::string_view payload);
+    void SetWeight_(Stream* stream, std::string_view priority);
+    Stream* Find_(uint32_t id);
+    void Close_(uint32_t id);
+    bool HasPendingData_(const Stream& stream) const;
+
+    void AppendFrame_(Buffer& buff, uint8_t type, uint8_t flags, uint32_t id, std::string_view payload);
+    void AppendFrameHeader_(Buffer& buff, uint8_t type, uint8_t flags, uint32_t id, size_t len);
+    void AppendHeaders_(uint32_t id, std::string_view block, bool endStream);
+    void SendWindowUpdate_(uint32_t id, uint32_t increment);
+    void SendRstStream_(uint32_t id, ErrorCode error);
+    bool SendGoAway_(ErrorCode error);
+
+    bool prefaceReceived_;      // 已收到连接前言
+    bool settingsReceived_;     // 已收到对端第一个SETTINGS
+    bool goAway_;               // 对端已发送GOAWAY
+    bool fatal_;                // 发生连接错误, 已发送GOAWAY
+    uint32_t lastStreamId_;     // 对端打开的最大流ID
+
+    std::map<uint32_t, Stream> streams_;    // 活跃的流
+    std::vector<std::map<uint32_t, Stream>::node_type> retired_;   // 本次输出中结束的流, 负载仍被iovec引用
+    std::deque<uint32_t> ready_;            // 请求已完整、等待处理的流
+
+    /* 跨HEADERS和CONTINUATION累积的头部块 */
+    uint32_t headerStream_;     // 正在接收头部块的流, 0表示没有
+    bool headerEndStream_;      // 该HEADERS帧带有END_STREAM
+    bool headerRefused_;        // 该流被拒绝, 头部块只解码以维护HPACK状态
+    std::string headerBlock_;
+
+    int64_t connWindow_;        // 连接级发送窗口
+    int64_t initialWindow_;     // 对端SETTINGS_INITIAL_WINDOW_SIZE
+    size_t peerMaxFrame_;       // 对端SETTINGS_MAX_FRAME_SIZE
+    uint64_t vtime_;            // 调度器的当前虚拟时间, 新的流从这里开始
+
+    HpackDecoder decoder_;
+    Buffer control_;            // 控制帧与HEADERS帧, 先于数据帧发送
+    Buffer scratch_;            // 生成HTTP/1格式响应头的临时缓冲
+    std::string lower_;         // 转小写的头部名
+    std::string block_;         // 编码后的头部块
+};
+
+#endif
@@ -1,16 +1,31 @@
 #include "httpconn.h"
 
+#include <netinet/tcp.h>
+
 const char* HttpConn::srcDir;
+const Router* HttpConn::router;
 std::atomic<int> HttpConn::userCount;
 bool HttpConn::isET;
+int HttpConn::timeoutMS;
+int HttpConn::keepAliveMax;
+int HttpConn::headerTimeoutMS = 10000;
+int HttpConn::bodyTimeoutMS = 10000;
+int HttpConn::bodyMinRate = 1024;
+int HttpConn::writeTimeoutMS = 10000;
+int HttpConn::writeMinRate = 4096;
 
 /**
  * @brief 构造函数
 */
-HttpConn::HttpConn() {
+HttpConn::HttpConn()
+    : request_(&arena_), response_(&arena_), isWebSocket_(false), phase_(HEADER), phaseStart_(0), phaseBytes_(0), tasks_(0) {
     fd_ = -1;
     addr_ = {0};
     isClose_ = true;
+    iovCnt_ = iovIdx_ = 0;
+    requestCount_ = 0;
+    bodyLen_ = 0;
+    timer_.data = this;
 }
 
 /**
@@ -28,9 +43,20 @@ void HttpConn::init(int fd, const sockaddr_in& addr) {
     userCount++;
     addr_ = addr;
     fd_ = fd;
-    writeBuff_.RetrieveAll();
-    readBuff_.RetrieveAll();
+    ReleaseBuffers_();
+    iovCnt_ = iovIdx_ = 0;
+    requestCount_ = 0;
+    http2_.reset();
+    ws_.reset();
+    isWebSocket_ = false;
+    proxy_.reset();
+    tls_.reset();
+    if (TlsContext::Instance()->Enabled()) {
+        tls_.reset(new TlsConn(fd));
+    }
     isClose_ = false;
+    phase_ = IDLE;
+    SetPhase(HEADER);
     LOG_INFO("Client[%d](%s:%d) in, userCount:%d", fd_, GetIP(), GetPort(), (int)userCount);
 }
 
@@ -39,10 +65,28 @@ void HttpConn::init(int fd, const sockaddr_in& addr) {
 */
 void HttpConn::Close() {
     response_.UnmapFile();
+    http2_.reset();
+    /* 上游连接在关闭客户端fd之前从Epoller注销并关闭 */
+    proxy_.reset();
+    if (ws_) {
+        /* 先离开端点, 关闭fd之后不会再有广播唤醒它 */
+        WebSocketHub::Instance()->Leave(ws_.get());
+        if (ws_->GetEndpoint()->handler.onClose) {
+            ws_->GetEndpoint()->handler.onClose(*ws_);
+        }
+        ws_.reset();
+        isWebSocket_ = false;
+    }
     if (isClose_ == false) {
         isClose_ = true;
         userCount--;
+        if (tls_) {
+            tls_->Shutdown();
+        }
+        tls_.reset();
         close(fd_);
+        /* users_中的连接对象会被复用, 关闭后不再持有缓冲区内存 */
+        ReleaseBuffers_();
         LOG_INFO("Client[%d](%s:%d) quit, UserCount:%d", fd_, GetIP(), GetPort(), (int)userCount);
     }
 }
@@ -51,28 +95,352 @@ void HttpConn::Close() {
  * @brief 处理请求
 */
 bool HttpConn::process() {
+    if (IsHandshaking()) {
+        return tls_->WantWrite();
+    }
+    if (ws_) {
+        return ProcessWebSocket_();
+    }
+    if (http2_) {
+        return ProcessHttp2_();
+    }
+    if (bodyLen_ > 0) {
+        /* 分段收取请求体期间请求头已经解析, 不重置请求 */
+        return TakeBody_() && HandleRequest_();
+    }
+    arena_.Reset();
     request_.Init();
     if (readBuff_.ReadableBytes() <= 0) {
+        /* 只有完成过请求的连接才进入keep-alive空闲, 新连接(包括刚完成TLS握手的)仍受请求头期限限制 */
+        SetPhase(requestCount_ > 0 ? IDLE : HEADER);
+        return false;
+    }
+    /* HTTP/2 prior knowledge: 连接以前言开头 */
+    switch (Http2Session::CheckPreface(readBuff_)) {
+        case Http2Session::PARTIAL_PREFACE:
+            SetPhase(HEADER);
+            return false;
+        case Http2Session::PREFACE:
+            http2_.reset(new Http2Session());
+            return ProcessHttp2_();
+        default:
+            break;
+    }
+    /* 请求没有收全时继续读, 由定时器按阶段限制等待时间; 超过长度上限的请求不再等待 */
+    size_t bodyLen = 0;
+    int errCode = 0;
+    HttpRequest::PARSE_STATE pending = HttpRequest::CheckComplete(readBuff_, &bodyLen, &errCode);
+    if (errCode) {
+        LOG_WARN("Client[%d] request body length unknown", fd_);
+        return RejectRequest_(errCode);
+    }
+    if (pending == HttpRequest::HEADERS && readBuff_.ReadableBytes() > HttpRequest::MAX_HEADER_SIZE) {
+        LOG_WARN("Client[%d] request header too large", fd_);
+        return RejectRequest_(400);
+    }
+    if (bodyLen > HttpRequest::MAX_BODY_SIZE) {
+        LOG_WARN("Client[%d] request body too large: %zu", fd_, bodyLen);
+        return RejectRequest_(400);
+    }
+    if (pending == HttpRequest::BODY && bodyLen >= HttpRequest::CHAIN_BODY_SIZE) {
+        /* 较大的请求体不在读缓冲区中累积: 先解析请求头, 之后的数据转存到分段缓冲区, 读缓冲区不随之扩容 */
+        if (!request_.ParseHead(readBuff_)) {
+            return RejectRequest_(400);
+        }
+        bodyLen_ = bodyLen;
+        return TakeBody_() && HandleRequest_();
+    }
+    if (pending != HttpRequest::FINISH) {
+        SetPhase(pending == HttpRequest::HEADERS ? HEADER : BODY);
+        return false;
+    }
+    if (!request_.parse(readBuff_, bodyLen)) {
+        return RejectRequest_(400);
+    }
+    return HandleRequest_();
+}
+
+/**
+ * @brief 把读到的请求体转存到分段缓冲区; 直接读入分段缓冲区时多读的后续请求移回读缓冲区
+ * @return 请求体是否已收全, 收全时设置到请求中
+*/
+bool HttpConn::TakeBody_() {
+    size_t have = bodyBuff_.ReadableBytes();
+    if (have < bodyLen_ && readBuff_.ReadableBytes() > 0) {
+        size_t len = std::min(bodyLen_ - have, readBuff_.ReadableBytes());
+        bodyBuff_.Append(readBuff_.Peek(), len);
+        readBuff_.Retrieve(len);
+    } else if (have > bodyLen_) {
+        assert(readBuff_.ReadableBytes() == 0);
+        struct iovec iov[ChainBuffer::MAX_IOV];
+        for (size_t offset = bodyLen_; offset < have;) {
+            int cnt = bodyBuff_.PeekIov(iov, ChainBuffer::MAX_IOV, offset);
+            for (int i = 0; i < cnt; i++) {
+                readBuff_.Append(iov[i].iov_base, iov[i].iov_len);
+                offset += iov[i].iov_len;
+            }
+        }
+        bodyBuff_.Truncate(bodyLen_);
+    }
+    if (bodyBuff_.ReadableBytes() < bodyLen_) {
+        SetPhase(BODY);
+        return false;
+    }
+    request_.SetBody(bodyBuff_);
+    bodyBuff_.RetrieveAll();
+    bodyLen_ = 0;
+    return true;
+}
+
+/**
+ * @brief 处理解析完成的请求: 协议升级, 路由, 反向代理或生成响应
+*/
+bool HttpConn::HandleRequest_() {
+    /* 请求已收全, 路由处理期间(可能较慢, 如查询数据库)不再按请求头期限计时 */
+    SetPhase(BUSY);
+    LOG_DEBUG("%.*s", (int)request_.path().size(), request_.path().data());
+    if (Http2Session::IsUpgradeRequest(request_) && UpgradeHttp2_()) {
+        return true;
+    }
+    if (WebSocket::IsUpgradeRequest(request_)) {
+        WebSocketEndpoint* endpoint = WebSocketHub::Instance()->Find(request_.path());
+        if (endpoint) {
+            return UpgradeWebSocket_(endpoint);
+        }
+    }
+    /* 保持连接: 客户端要求且未达到单连接请求数上限 */
+    requestCount_++;
+    bool keepAlive = request_.IsKeepAlive() && (keepAliveMax <= 0 || requestCount_ < keepAliveMax);
+    response_.Init(request_.path(), keepAlive, 200, &request_);
+    response_.SetKeepAlive(timeoutMS / 1000, keepAliveMax > 0 ? keepAliveMax - requestCount_ : 0);
+    Route_();
+    if (response_.Proxy()) {
+        /* 只转发长度确定的请求体, 分块请求体暂不支持 */
+        if (!request_.header(HttpHeader::TRANSFER_ENCODING).empty()) {
+            return RejectRequest_(501);
+        }
+        char ip[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &addr_.sin_addr, ip, sizeof(ip));
+        proxy_.reset(new ProxySession(fd_, response_.Proxy(), tls_.get()));
+        proxy_->Start(request_, ip, keepAlive);
+        return true;
+    }
+    MakeResponse_();
+    return true;
+}
+
+/**
+ * @brief 无法继续解析的请求: 丢弃已读到的数据, 回复错误后关闭
+*/
+bool HttpConn::RejectRequest_(int code) {
+    readBuff_.RetrieveAll();
+    bodyBuff_.RetrieveAll();
+    bodyLen_ = 0;
+    response_.Init(request_.path(), false, code);
+    MakeResponse_();
+    return true;
+}
+
+/**
+ * @brief 进入新阶段时记录开始时间并清零计数, 同一阶段内重复调用不重新计时
+*/
+void HttpConn::SetPhase(Phase phase) {
+    if (phase_.load(std::memory_order_relaxed) == phase) {
+        return;
+    }
+    phaseStart_.store(CoarseClock::Instance()->Now().time_since_epoch().count(), std::memory_order_relaxed);
+    phaseBytes_.store(0, std::memory_order_relaxed);
+    phase_.store(phase, std::memory_order_relaxed);
+}
+
+/**
+ * @brief 请求头: 进入阶段后的固定期限, 防止慢速发送请求头长期占用连接;
+ * 请求体和响应: 基础期限加上按最低速率换算的已传输字节数, 速率低于最低速率时最终超时;
+ * 空闲和其他: 最近一次读写事件之后的空闲时间
+*/
+TimeStamp HttpConn::Deadline() const {
+    TimeStamp start{SteadyClock::duration(phaseStart_.load(std::memory_order_relaxed))};
+    uint64_t bytes = phaseBytes_.load(std::memory_order_relaxed);
+    switch (GetPhase()) {
+        case HEADER:
+            return start + MS(headerTimeoutMS);
+        case BODY:
+            if (bodyMinRate <= 0) {
+                return lastActive_ + MS(bodyTimeoutMS);
+            }
+            return start + MS(bodyTimeoutMS) + MS(bytes * 1000 / bodyMinRate);
+        case WRITE:
+            if (writeMinRate <= 0) {
+                return lastActive_ + MS(writeTimeoutMS);
+            }
+            return start + MS(writeTimeoutMS) + MS(bytes * 1000 / writeMinRate);
+        default:
+            return lastActive_ + MS(timeoutMS);
+    }
+}
+
+/**
+ * @brief 代理结束: 释放上游连接, 上游没有给出响应时返回502
+*/
+bool HttpConn::FinishProxy() {
+    assert(proxy_);
+    bool failed = proxy_->GetStatus() == ProxySession::FAILED;
+    bool responded = proxy_->Responded();
+    bool keepAlive = proxy_->IsKeepAlive();
+    proxy_.reset();
+    if (!failed) {
+        return keepAlive;
+    }
+    if (responded) {
         return false;
-    } else if (request_.parse(readBuff_)) {
-        LOG_DEBUG("%s", request_.path().c_str());
-        response_.Init(srcDir, request_.path(), request_.IsKeepAlive(), 200);
-    } else {
-        response_.Init(srcDir, request_.path(), false, 400);
     }
+    response_.SetCode(502);
+    MakeResponse_();
+    return true;
+}
+
+/**
+ * @brief 生成响应, 依次放入iovec, 进入发送阶段
+*/
+void HttpConn::MakeResponse_() {
+    SetPhase(WRITE);
     response_.MakeResponse(writeBuff_);
+    iovCnt_ = iovIdx_ = 0;
+    // 缓存的响应头, 直接引用文件缓存, 不拷贝
+    std::string_view header = response_.HeaderBlock();
+    AddIov_(header.data(), header.size());
     // 响应头
-    iov_[0].iov_base = const_cast<char*>(writeBuff_.Peek());
-    iov_[0].iov_len = writeBuff_.ReadableBytes();
-    iovCnt_ = 1;
-    // 文件
-    if (response_.FileLen() > 0 && response_.File()) {
-        iov_[1].iov_base = response_.File();
-        iov_[1].iov_len = response_.FileLen();
-        iovCnt_ = 2;
-    }
-    LOG_DEBUG("filesize:%d, %d  to %d", response_.FileLen(), iovCnt_, ToWriteBytes());
-    return true;
+    AddIov_(writeBuff_.Peek(), writeBuff_.ReadableBytes());
+    // 文件, 区间请求时为多个数据段
+    for (size_t i = 0; i < response_.BodyCount(); i++) {
+        AddIov_(response_.Body(i).data(), response_.Body(i).size());
+    }
+    LOG_DEBUG("code:%d, %d iovec to %d", response_.Code(), iovCnt_, ToWriteBytes());
+}
+
+/**
+ * @brief h2c升级: 回复101, 升级请求的响应在流1上以HTTP/2发送
+*/
+bool HttpConn::UpgradeHttp2_() {
+    std::unique_ptr<Http2Session> session(new Http2Session());
+    if (!session->Upgrade(request_.header(HttpHeader::HTTP2_SETTINGS))) {
+        return false;
+    }
+    http2_ = std::move(session);
+    writeBuff_.Append("HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nUpgrade: h2c\r\n\r\n");
+    response_.Init(request_.path(), false, 200, &request_);
+    Route_();
+    http2_->Respond(Http2Session::UPGRADE_STREAM, response_);
+    return ProcessHttp2_();
+}
+
+/**
+ * @brief HTTP/2: 拆帧, 依次处理请求完整的流, 再输出一批帧
+ * 每个流仍走路由和HttpResponse, 单请求数据的arena在流之间重置
+*/
+bool HttpConn::ProcessHttp2_() {
+    SetPhase(BUSY);
+    http2_->Feed(readBuff_);
+    uint32_t id;
+    while (http2_->NextRequest(&id)) {
+        arena_.Reset();
+        request_.Init();
+        http2_->BuildRequest(id, &request_);
+        LOG_DEBUG("h2 stream %u: %.*s", id, (int)request_.path().size(), request_.path().data());
+        response_.Init(request_.path(), false, 200, &request_);
+        Route_();
+        http2_->Respond(id, response_);
+    }
+    iovIdx_ = 0;
+    iovCnt_ = http2_->Flush(writeBuff_, iov_, MAX_IOV);
+    return iovCnt_ > 0;
+}
+
+/**
+ * @brief WebSocket升级: 101响应与之后的帧都走WebSocket自己的发送队列
+ * 连接不再受HTTP空闲定时器管理, 改用TCP keepalive探测失效的对端
+*/
+bool HttpConn::UpgradeWebSocket_(WebSocketEndpoint* endpoint) {
+    ws_.reset(new WebSocket(fd_, endpoint, tls_.get()));
+    ws_->Accept(request_.header(HttpHeader::SEC_WEBSOCKET_KEY));
+    isWebSocket_ = true;
+    int optval = 1;
+    setsockopt(fd_, SOL_SOCKET, SO_KEEPALIVE, &optval, sizeof(optval));
+    optval = 60;
+    setsockopt(fd_, IPPROTO_TCP, TCP_KEEPIDLE, &optval, sizeof(optval));
+    optval = 10;
+    setsockopt(fd_, IPPROTO_TCP, TCP_KEEPINTVL, &optval, sizeof(optval));
+    optval = 3;
+    setsockopt(fd_, IPPROTO_TCP, TCP_KEEPCNT, &optval, sizeof(optval));
+    LOG_INFO("Client[%d] websocket %s", fd_, endpoint->path.c_str());
+    WebSocketHub::Instance()->Join(ws_.get());
+    if (endpoint->handler.onOpen) {
+        endpoint->handler.onOpen(*ws_);
+    }
+    return ProcessWebSocket_();
+}
+
+/**
+ * @brief WebSocket: 解析已到达的帧, 握手请求之后紧跟的帧也在这里处理
+*/
+bool HttpConn::ProcessWebSocket_() {
+    ws_->Feed(readBuff_);
+    readBuff_.Shrink();
+    return ws_->QueuedBytes() > 0;
+}
+
+/**
+ * @brief 追加一个待发送的iovec, 忽略空数据
+*/
+void HttpConn::AddIov_(const char* data, size_t len) {
+    if (len == 0) {
+        return;
+    }
+    assert(iovCnt_ < MAX_IOV);
+    iov_[iovCnt_].iov_base = const_cast<char*>(data);
+    iov_[iovCnt_].iov_len = len;
+    iovCnt_++;
+}
+
+/**
+ * @brief 待发送的字节数
+*/
+int HttpConn::ToWriteBytes() const {
+    if (ws_) {
+        return ws_->QueuedBytes();
+    }
+    size_t bytes = 0;
+    for (int i = iovIdx_; i < iovCnt_; i++) {
+        bytes += iov_[i].iov_len;
+    }
+    return bytes;
+}
+
+/**
+ * @brief 按路由表分发请求, 处理函数决定返回文件还是生成内容
+*/
+void HttpConn::Route_() {
+    assert(router && router->IsFrozen());
+    const Router::Handler* handler = nullptr;
+    unsigned allowed = 0;
+    switch (router->Find(request_.method(), request_.path(), &handler, &request_.params(), &allowed)) {
+        case Router::MATCHED:
+            (*handler)(request_, response_);
+            break;
+        case Router::NOT_ALLOWED:
+            /* RFC 9110 15.5.6: 405必须带Allow头 */
+            response_.SetCode(405);
+            response_.SetAllow(Router::AllowList(allowed));
+            break;
+        default:
+            response_.SetCode(404);
+            break;
+    }
+    if (http2_ && response_.Proxy()) {
+        /* 代理只支持HTTP/1连接, HTTP/2的流共用一个连接, 无法splice */
+        response_.SetProxy(nullptr);
+        response_.SetCode(502);
+    }
 }
 
 /**
@@ -82,10 +450,18 @@ bool HttpConn::process() {
 ssize_t HttpConn::read(int* saveErrno) {
     ssize_t len = -1;
     do {
-        len = readBuff_.ReadFd(fd_, saveErrno);
+        if (tls_) {
+            len = tls_->Read(readBuff_, saveErrno);
+        } else if (bodyLen_ > 0) {
+            /* 正在收取较大的请求体, 直接读入分段缓冲区 */
+            len = bodyBuff_.ReadFd(fd_, saveErrno);
+        } else {
+            len = readBuff_.ReadFd(fd_, saveErrno);
+        }
         if (len <= 0) {
             break;
         }
+        phaseBytes_.fetch_add(len, std::memory_order_relaxed);
     } while (isET);
     return len;
 }
@@ -95,31 +471,58 @@ ssize_t HttpConn::read(int* saveErrno) {
  * @param saveErrno 错误码
 */
 ssize_t HttpConn::write(int* saveErrno) {
+    if (ws_) {
+        return ws_->Write(saveErrno);
+    }
     ssize_t len = -1;
     do {
-        len = writev(fd_, iov_, iovCnt_);
+        if (iovIdx_ == iovCnt_) {
+            break;
+        }
+        /* TLS连接启用kTLS时同样直接writev, 否则经OpenSSL加密 */
+        if (tls_) {
+            len = tls_->Writev(iov_ + iovIdx_, iovCnt_ - iovIdx_);
+        } else {
+            len = writev(fd_, iov_ + iovIdx_, iovCnt_ - iovIdx_);
+        }
         if (len <= 0) {
             *saveErrno = errno;
             break;
         }
-        if (iov_[0].iov_len + iov_[1].iov_len == 0) {
-            break;
-        } else if (static_cast<size_t>(len) > iov_[0].iov_len) {
-            iov_[1].iov_base = (uint8_t*)iov_[1].iov_base + (len - iov_[0].iov_len);
-            iov_[1].iov_len -= (len - iov_[0].iov_len);
-            if (iov_[0].iov_len) {
-                writeBuff_.RetrieveAll();
-                iov_[0].iov_len = 0;
-            }
-        } else {
-            iov_[0].iov_base = (uint8_t*)iov_[0].iov_base + len;
-            iov_[0].iov_len -= len;
-            writeBuff_.Retrieve(len);
+        phaseBytes_.fetch_add(len, std::memory_order_relaxed);
+        /* 跳过已发送完的iovec, 调整第一个未发送完的 */
+        size_t sent = len;
+        while (iovIdx_ < iovCnt_ && sent >= iov_[iovIdx_].iov_len) {
+            sent -= iov_[iovIdx_].iov_len;
+            iov_[iovIdx_].iov_len = 0;
+            iovIdx_++;
+        }
+        if (sent > 0) {
+            iov_[iovIdx_].iov_base = (uint8_t*)iov_[iovIdx_].iov_base + sent;
+            iov_[iovIdx_].iov_len -= sent;
         }
     } while (isET || ToWriteBytes() > 10240);
+    if (iovIdx_ == iovCnt_) {
+        /* 响应发送完: 等待下一个请求的keep-alive连接不持有缓冲区, 流水线请求留下的数据保留 */
+        writeBuff_.RetrieveAll();
+        writeBuff_.Shrink();
+        readBuff_.Shrink();
+    }
     return len;
 }
 
+/**
+ * @brief 清空并归还读写缓冲区的内存
+*/
+void HttpConn::ReleaseBuffers_() {
+    readBuff_.RetrieveAll();
+    readBuff_.Shrink();
+    writeBuff_.RetrieveAll();
+    writeBuff_.Shrink();
+    bodyBuff_.RetrieveAll();
+    bodyLen_ = 0;
+}
+
 
 /**
  * @brief 获取连接描述符
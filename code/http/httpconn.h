@@ -7,15 +7,36 @@
 #include <sys/types.h>
 #include <sys/uio.h>
 
+#include <atomic>
+#include <memory>
+
+#include "../buffer/arena.h"
 #include "../buffer/buffer.h"
 #include "../log/log.h"
 #include "../pool/sqlconnRAII.h"
+#include "../timer/timingwheel.h"
+#include "http2.h"
 #include "httprequest.h"
 #include "httpresponse.h"
+#include "proxy.h"
+#include "router.h"
+#include "tls.h"
+#include "websocket.h"
 
 
 class HttpConn {
 public:
+    /**
+     * @brief 连接当前所处的阶段, 决定超时的计算方式
+    */
+    enum Phase {
+        HEADER,     // 等待请求头收全(新连接在收到第一个字节前也算), 期限固定, 读到数据不延长
+        BODY,       // 等待请求体, 每收到bodyMinRate字节期限延长1秒
+        WRITE,      // 发送响应, 每发出writeMinRate字节期限延长1秒
+        IDLE,       // keep-alive连接等待下一个请求
+        BUSY,       // 代理、HTTP/2等, 按空闲时间计算
+    };
+
     HttpConn();
     
     ~HttpConn();
@@ -38,27 +59,135 @@ public:
     
     bool process();
     
-    int ToWriteBytes() { return iov_[0].iov_len + iov_[1].iov_len; }
-    
-    bool IsKeepAlive() const { return request_.IsKeepAlive(); }
+    int ToWriteBytes() const;
+    
+    /**
+     * @brief 当前响应发送完后是否保持连接, HTTP/2连接直到会话结束, WebSocket连接直到关闭帧发送
+    */
+    bool IsKeepAlive() const {
+        if (ws_) {
+            return !ws_->IsClosing();
+        }
+        return http2_ ? !http2_->IsClosing() : response_.IsKeepAlive();
+    }
+
+    /**
+     * @brief 是否已升级为WebSocket, 主线程的定时器回调也会读取
+    */
+    bool IsWebSocket() const { return isWebSocket_; }
+    WebSocket* GetWebSocket() const { return ws_.get(); }
+
+    /**
+     * @brief TLS握手尚未完成, 可写事件用于继续握手
+    */
+    bool IsHandshaking() const { return tls_ && !tls_->Established(); }
+
+    /**
+     * @brief 正在代理的请求, 为空时不在代理中
+    */
+    ProxySession* GetProxy() const { return proxy_.get(); }
+
+    /**
+     * @brief 代理结束(DONE/FAILED)后调用; 上游未响应时改为生成502响应
+     * @return 连接能否继续使用, 为true时可能有待发送的502响应
+    */
+    bool FinishProxy();
+
+    /**
+     * @brief 空闲超时的定时器节点, data指向本连接, 只由主线程的时间轮操作
+    */
+    TimerNode* GetTimer() { return &timer_; }
+    bool IsClosed() const { return isClose_; }
+
+    /**
+     * @brief 记录最近一次读写事件的时间, 只由主线程读写; 定时器到期时据此判断是否真的空闲
+    */
+    void Touch(TimeStamp now) { lastActive_ = now; }
+    TimeStamp LastActive() const { return lastActive_; }
+
+    /**
+     * @brief 切换阶段, 阶段变化时重新开始计时和计数; 由处理连接的工作线程调用,
+     * 主线程只在连接没有交给工作线程时(事件分发之前)调用
+    */
+    void SetPhase(Phase phase);
+    Phase GetPhase() const { return static_cast<Phase>(phase_.load(std::memory_order_relaxed)); }
+
+    /**
+     * @brief 交给工作线程的任务数: 主线程分发前加一, 工作线程处理完减一;
+     * 不为0时连接由工作线程使用, 主线程的定时器不能关闭它
+    */
+    void Dispatch() { tasks_.fetch_add(1, std::memory_order_relaxed); }
+    void Finish() { tasks_.fetch_sub(1, std::memory_order_release); }
+    bool IsDispatched() const { return tasks_.load(std::memory_order_acquire) > 0; }
+
+    /**
+     * @brief 按当前阶段计算的超时时间, 由主线程的定时器读取
+    */
+    TimeStamp Deadline() const;
+
+    /**
+     * @brief 定时器节点当前设定的到期时间, 只由主线程读写
+    */
+    TimeStamp ArmedDeadline() const { return armedDeadline_; }
+    void SetArmedDeadline(TimeStamp deadline) { armedDeadline_ = deadline; }
     
     static bool isET;
+    static int timeoutMS;       // keep-alive空闲超时, 通过Keep-Alive头告知客户端; 代理、HTTP/2按此计算空闲
+    static int headerTimeoutMS; // 收全请求头的期限
+    static int bodyTimeoutMS;   // 请求体的基础期限
+    static int bodyMinRate;     // 请求体的最低速率(字节/秒), <=0时改为无进展超时
+    static int writeTimeoutMS;  // 发送响应的基础期限
+    static int writeMinRate;    // 发送响应的最低速率(字节/秒), <=0时改为无进展超时
+    static int keepAliveMax;    // 单个连接最多处理的请求数, <=0表示不限制
     static const char* srcDir;
+    static const Router* router;
     static std::atomic<int> userCount;
 
 private:
+    void Route_();
+    void AddIov_(const char* data, size_t len);
+    bool UpgradeHttp2_();
+    bool ProcessHttp2_();
+    bool UpgradeWebSocket_(WebSocketEndpoint* endpoint);
+    bool ProcessWebSocket_();
+    void MakeResponse_();
+    bool TakeBody_();
+    bool HandleRequest_();
+    bool RejectRequest_(int code);
+    void ReleaseBuffers_();
+
     int fd_;                    // socket文件描述符
     struct sockaddr_in addr_;   // 客户端地址
-    bool isClose_;              // 是否关闭连接
+    std::atomic<bool> isClose_; // 是否关闭连接, 主线程的定时器回调也会读取
+    int requestCount_;          // 该连接已处理的请求数
     
+    static const int MAX_IOV = 2 + HttpResponse::MAX_BODY;
     int iovCnt_;                // 写缓冲区中有多少个iovec
-    struct iovec iov_[2];       // 两个iovec，一个是Buffer缓冲区，一个是mmfile
+    int iovIdx_;                // 第一个未发送完的iovec
+    struct iovec iov_[MAX_IOV]; // 依次为缓存的响应头, Buffer缓冲区, 文件数据段, 空的不放入; HTTP/2时为帧头片段与数据帧负载交替
     
     Buffer readBuff_;           // 读缓冲区
     Buffer writeBuff_;          // 写缓冲区
-    
+    ChainBuffer bodyBuff_;      // 较大的请求体在收全之前分段存放, 不在读缓冲区中扩容搬移
+    size_t bodyLen_;            // 正在分段收取的请求体长度, 为0时不在收取
+
+    Arena arena_;               // 单请求数据的分配器, 每个请求开始时重置
     HttpRequest request_;       // 请求
     HttpResponse response_;     // 响应
+
+    std::unique_ptr<Http2Session> http2_;   // 升级为HTTP/2后的会话, 为空时按HTTP/1处理
+    std::unique_ptr<WebSocket> ws_;         // 升级为WebSocket后的连接
+    std::atomic<bool> isWebSocket_;
+    std::unique_ptr<ProxySession> proxy_;   // 当前请求的反向代理过程
+    std::unique_ptr<TlsConn> tls_;          // TLS监听上的连接状态, 为空时为明文
+    TimerNode timer_;                       // 嵌入的定时器节点
+    TimeStamp lastActive_;                  // 最近一次读写事件的时间
+    TimeStamp armedDeadline_;               // 定时器节点设定的到期时间
+
+    std::atomic<int> phase_;                // Phase, 工作线程写, 主线程读
+    std::atomic<int64_t> phaseStart_;       // 进入当前阶段的单调时间(纳秒)
+    std::atomic<uint64_t> phaseBytes_;      // 当前阶段读到或发出的字节数
+    std::atomic<int> tasks_;                // 已分发、尚未处理完的任务数, 连接复用时不清零
 };
 
 #endif
\ No newline at end of file
@@ -1,140 +1,217 @@
 #include "httprequest.h"
 
-const std::unordered_set<std::string> HttpRequest::DEFAULT_HTML{
-    "/index", "/register", "/login", "/welcome", "/video", "/picture",
-};
+#include <strings.h>
 
-const std::unordered_map<std::string, int> HttpRequest::DEFAULT_HTML_TAG{
-    {"/register.html", 0},
-    {"/login.html", 1},
-};
+#include <charconv>
 
 /**
  * @brief 初始化HttpRequest对象
 */
 void HttpRequest::Init() {
-    method_ = path_ = version_ = body_ = "";
+    method_ = path_ = query_ = version_ = body_ = std::string_view();
     state_ = REQUEST_LINE;
-    header_.clear();
+    header_.fill(std::string_view());
+    others_.clear();
     post_.clear();
+    params_.Clear();
 }
 
 /**
- * @brief 解析请求
+ * @brief 解析请求: 请求行和请求头逐行解析, 请求体按长度取出
 */
-bool HttpRequest::parse(Buffer& buff) {
-    const char CRLF[] = "\r\n";
-    if (buff.ReadableBytes() <= 0) {
+bool HttpRequest::parse(Buffer& buff, size_t bodyLen) {
+    if (!ParseHead(buff)) {
         return false;
     }
-    while (buff.ReadableBytes() && state_ != FINISH) {
-        const char* lineEnd = std::search(buff.Peek(), buff.BeginWriteConst(), CRLF, CRLF + 2);  // 找到\r\n
-        std::string line(buff.Peek(), lineEnd);
-        switch (state_) {
-            case REQUEST_LINE:
-                if (!ParseRequestLine_(line)) {
-                    return false;
-                }
-                ParsePath_();
-                break;
-            case HEADERS:
-                ParseHeader_(line);
-                if (buff.ReadableBytes() <= 2) {
-                    state_ = FINISH;
-                }
-                break;
-            case BODY:
-                ParseBody_(line);
-                break;
-            default:
-                break;
-        }
-        if (lineEnd == buff.BeginWrite()) {
-            break;
+    assert(buff.ReadableBytes() >= bodyLen);
+    ParseBody_(std::string_view(buff.Peek(), bodyLen));
+    buff.Retrieve(bodyLen);
+    return true;
+}
+
+/**
+ * @brief 逐行解析请求行和请求头, 遇到空行后停在BODY状态
+*/
+bool HttpRequest::ParseHead(Buffer& buff) {
+    while (state_ != BODY) {
+        const char* lineEnd = buff.FindCRLF();
+        if (!lineEnd) {
+            return false;
         }
+        std::string_view line(buff.Peek(), lineEnd - buff.Peek());
+        bool ok = state_ == REQUEST_LINE ? ParseRequestLine_(line) : ParseHeader_(line);
         buff.RetrieveUntil(lineEnd + 2);
+        if (!ok) {
+            return false;
+        }
     }
-    LOG_DEBUG("[%s], [%s], [%s]", method_.c_str(), path_.c_str(), version_.c_str());
+    LOG_DEBUG("[%.*s], [%.*s], [%.*s]", (int)method_.size(), method_.data(), (int)path_.size(),
+              path_.data(), (int)version_.size(), version_.data());
     return true;
 }
 
 /**
- * @brief 解析请求行
+ * @brief 找到空行, 从之前的请求头确定请求体的长度, 没有Content-Length时请求体为空;
+ * 不支持带Transfer-Encoding的请求体, 否则无法确定请求的边界
 */
-bool HttpRequest::ParseRequestLine_(const std::string& line) {
-    // GET / HTTP/1.1
-    std::regex patten("^([^ ]*) ([^ ]*) HTTP/([^ ]*)$");
-    std::smatch subMatch;
-    if (std::regex_match(line, subMatch, patten)) {
-        method_ = subMatch[1];
-        path_ = subMatch[2];
-        version_ = subMatch[3];
-        state_ = HEADERS;
-        return true;
+HttpRequest::PARSE_STATE HttpRequest::CheckComplete(const Buffer& buff, size_t* bodyLen, int* errCode) {
+    assert(bodyLen && errCode);
+    *bodyLen = 0;
+    *errCode = 0;
+    const char* headerEnd = buff.Find("\r\n\r\n");
+    if (!headerEnd) {
+        return HEADERS;
     }
-    LOG_ERROR((line + "RequestLine Error").c_str());
-    return false;
+    const std::string_view contentLength("Content-Length:");
+    const std::string_view transferEncoding("Transfer-Encoding:");
+    bool hasLength = false, chunked = false;
+    const char* lineEnd = nullptr;
+    for (const char* line = buff.Peek(); line < headerEnd; line = lineEnd + 2) {
+        lineEnd = buff.FindCRLF(line);
+        size_t len = lineEnd - line;
+        if (len >= transferEncoding.size() && strncasecmp(line, transferEncoding.data(), transferEncoding.size()) == 0) {
+            chunked = true;
+            continue;
+        }
+        if (len < contentLength.size() || strncasecmp(line, contentLength.data(), contentLength.size()) != 0) {
+            continue;
+        }
+        const char* value = line + contentLength.size();
+        const char* valueEnd = lineEnd;
+        while (value < valueEnd && (*value == ' ' || *value == '\t')) {
+            value++;
+        }
+        while (valueEnd > value && (valueEnd[-1] == ' ' || valueEnd[-1] == '\t')) {
+            valueEnd--;
+        }
+        size_t n = 0;
+        auto res = std::from_chars(value, valueEnd, n);
+        if (value == valueEnd || res.ec != std::errc() || res.ptr != valueEnd || (hasLength && n != *bodyLen)) {
+            *errCode = 400;
+            return FINISH;
+        }
+        hasLength = true;
+        *bodyLen = n;
+    }
+    if (chunked) {
+        *errCode = hasLength ? 400 : 501;
+        *bodyLen = 0;
+        return FINISH;
+    }
+    size_t headerLen = headerEnd + 4 - buff.Peek();
+    return buff.ReadableBytes() - headerLen >= *bodyLen ? FINISH : BODY;
 }
 
 /**
- * @brief 解析请求路径
+ * @brief 解析请求行
 */
-void HttpRequest::ParsePath_() {
-    if (path_ == "/") {
-        path_ = "/index.html";
-    } else {
-        for (auto& item : DEFAULT_HTML) {
-            if (item == path_) {
-                path_ += ".html";
-                break;
-            }
+bool HttpRequest::ParseRequestLine_(std::string_view line) {
+    // GET / HTTP/1.1
+    const size_t methodEnd = line.find(' ');
+    const size_t pathEnd = methodEnd == std::string_view::npos ? methodEnd : line.find(' ', methodEnd + 1);
+    if (pathEnd != std::string_view::npos) {
+        std::string_view version = line.substr(pathEnd + 1);
+        if (version.substr(0, 5) == "HTTP/" && version.find(' ') == std::string_view::npos) {
+            SetRequestLine(line.substr(0, methodEnd), line.substr(methodEnd + 1, pathEnd - methodEnd - 1),
+                           version.substr(5));
+            state_ = HEADERS;
+            return true;
         }
     }
+    LOG_ERROR("%.*sRequestLine Error", (int)line.size(), line.data());
+    return false;
 }
 
 /**
- * @brief 解析请求头
+ * @brief 解析请求头, 空行结束请求头
 */
-void HttpRequest::ParseHeader_(const std::string& line) {
+bool HttpRequest::ParseHeader_(std::string_view line) {
     // Host: www.baidu.com
-    std::regex patten("^([^:]*): ?(.*)$");
-    std::smatch subMatch;  
-    if (std::regex_match(line, subMatch, patten)) {
-        header_[subMatch[1]] = subMatch[2];
-    } else {
+    if (line.empty()) {
         state_ = BODY;
+        return true;
+    }
+    const size_t colon = line.find(':');
+    if (colon == std::string_view::npos || colon == 0) {
+        LOG_ERROR("%.*sHeader Error", (int)line.size(), line.data());
+        return false;
+    }
+    std::string_view value = line.substr(colon + 1);
+    if (!value.empty() && value.front() == ' ') {
+        value.remove_prefix(1);
     }
+    SetHeader(line.substr(0, colon), value);
+    return true;
 }
 
 /**
  * @brief 解析请求体
 */
-void HttpRequest::ParseBody_(const std::string& line) {
-    body_ = line;
-    ParsePost_();
+void HttpRequest::ParseBody_(std::string_view body) {
+    SetBody(body);
     state_ = FINISH;
-    LOG_DEBUG("Body:%s, len:%d", line.c_str(), line.size());
+    LOG_DEBUG("Body:%.*s, len:%zu", (int)body.size(), body.data(), body.size());
+}
+
+/**
+ * @brief 设置请求行, target为路径加可选的查询串
+*/
+void HttpRequest::SetRequestLine(std::string_view method, std::string_view target, std::string_view version) {
+    method_ = arena_->Copy(method);
+    size_t mark = target.find('?');
+    path_ = arena_->Copy(target.substr(0, mark));
+    query_ = mark == std::string_view::npos ? std::string_view() : arena_->Copy(target.substr(mark + 1));
+    version_ = arena_->Copy(version);
+}
+
+/**
+ * @brief 设置请求头, 未知请求头按原样保存; 重复的Cookie按"; "合并(HTTP/2会拆成多个字段)
+*/
+void HttpRequest::SetHeader(std::string_view name, std::string_view value) {
+    HttpHeader key = LookupHeader(name);
+    if (key == HttpHeader::UNKNOWN) {
+        others_.emplace_back(arena_->Copy(name), arena_->Copy(value));
+        return;
+    }
+    std::string_view& slot = header_[static_cast<size_t>(key)];
+    if (key == HttpHeader::COOKIE && !slot.empty()) {
+        slot = arena_->Concat(arena_->Concat(slot, "; "), value);
+    } else {
+        slot = arena_->Copy(value);
+    }
 }
 
 /**
- * @brief 解析POST请求
+ * @brief 设置请求体, 表单会同时解析出键值对
 */
-void HttpRequest::ParsePost_() {
-    if (method_ == "POST" && header_["Content-Type"] == "application/x-www-form-urlencoded") {
+void HttpRequest::SetBody(std::string_view body) {
+    body_ = arena_->Copy(body);
+    if (header(HttpHeader::CONTENT_TYPE) == "application/x-www-form-urlencoded") {
         ParseFromUrlencoded_();
-        if (DEFAULT_HTML_TAG.count(path_)) {  // 目前post请求只有注册和登录
-            int tag = DEFAULT_HTML_TAG.find(path_)->second;
-            LOG_DEBUG("Tag:%d", tag);
-            if (tag == 0 || tag == 1) { // 目前post请求只有注册和登录
-                bool IsLogin = (tag == 1);
-                if (UserVerify(post_["username"], post_["password"], IsLogin)) {
-                    path_ = "/welcome.html";
-                } else {
-                    path_ = "/error.html";
-                }
-            }
+    }
+}
+
+/**
+ * @brief 按块拷贝分段缓冲区中的请求体, 只有这一次拷贝
+*/
+void HttpRequest::SetBody(const ChainBuffer& body) {
+    size_t len = body.ReadableBytes();
+    char* data = arena_->Allocate(len + 1);
+    struct iovec iov[ChainBuffer::MAX_IOV];
+    size_t copied = 0;
+    while (copied < len) {
+        int cnt = body.PeekIov(iov, ChainBuffer::MAX_IOV, copied);
+        for (int i = 0; i < cnt; i++) {
+            memcpy(data + copied, iov[i].iov_base, iov[i].iov_len);
+            copied += iov[i].iov_len;
         }
     }
+    data[len] = '\0';
+    body_ = std::string_view(data, len);
+    if (header(HttpHeader::CONTENT_TYPE) == "application/x-www-form-urlencoded") {
+        ParseFromUrlencoded_();
+    }
+    state_ = FINISH;
 }
 
 /**
@@ -144,43 +221,45 @@ void HttpRequest::ParseFromUrlencoded_() {
     if (body_.size() == 0) {
         return;
     }
-
-    std::string key, value;
-    int num = 0;
-    int n = body_.size();
-    int i = 0, j = 0;
-
-    for (; i < n; i++) {
-        char ch = body_[i];
-        switch (ch) {
-            case '=':
-                key = body_.substr(j, i - j);
-                j = i + 1;
-                break;
-            case '+':
-                body_[i] = ' ';
-                break;
-            case '%':
-                num = ConverHex(body_[i + 1]) * 16 + ConverHex(body_[i + 2]);
-                body_[i + 2] = num % 10 + '0';
-                body_[i + 1] = num / 10 + '0';
-                i += 2;
-                break;
-            case '&':
-                value = body_.substr(j, i - j);
-                j = i + 1;
-                post_[key] = value;
-                LOG_DEBUG("%s = %s", key.c_str(), value.c_str());
-                break;
-            default:
-                break;
+    // 解码后不会比原文长, 一次性从arena中切出
+    char* out = arena_->Allocate(body_.size());
+    size_t i = 0;
+    while (i < body_.size()) {
+        size_t end = body_.find('&', i);
+        if (end == std::string_view::npos) {
+            end = body_.size();
         }
+        std::string_view item = body_.substr(i, end - i);
+        size_t eq = item.find('=');
+        if (eq != std::string_view::npos) {
+            std::string_view key(out, UrlDecode_(item.substr(0, eq), out));
+            out += key.size();
+            std::string_view value(out, UrlDecode_(item.substr(eq + 1), out));
+            out += value.size();
+            post_.emplace_back(key, value);
+            LOG_DEBUG("%.*s = %.*s", (int)key.size(), key.data(), (int)value.size(), value.data());
+        }
+        i = end + 1;
     }
-    assert(j <= i);
-    if (post_.count(key) == 0 && j < i) {
-        value = body_.substr(j, i - j);
-        post_[key] = value;
+}
+
+/**
+ * @brief url解码, '+'转为空格, %XX转为对应字节
+*/
+size_t HttpRequest::UrlDecode_(std::string_view src, char* dst) {
+    size_t n = 0;
+    for (size_t i = 0; i < src.size(); i++) {
+        if (src[i] == '+') {
+            dst[n++] = ' ';
+        } else if (src[i] == '%' && i + 2 < src.size() && ConverHex(src[i + 1]) >= 0 &&
+                   ConverHex(src[i + 2]) >= 0) {
+            dst[n++] = static_cast<char>(ConverHex(src[i + 1]) * 16 + ConverHex(src[i + 2]));
+            i += 2;
+        } else {
+            dst[n++] = src[i];
+        }
     }
+    return n;
 }
 
 /**
@@ -193,17 +272,20 @@ int HttpRequest::ConverHex(char ch) {
     if (ch >= 'a' && ch <= 'f') {
         return ch - 'a' + 10;
     }
-    return ch;
+    if (ch >= '0' && ch <= '9') {
+        return ch - '0';
+    }
+    return -1;
 }
 
 /**
  * @brief 用户验证
 */
-bool HttpRequest::UserVerify(const std::string& name, const std::string& pwd, bool IsLogin) {
-    if (name == "" || pwd == "") {
+bool HttpRequest::UserVerify(std::string_view name, std::string_view pwd, bool IsLogin) {
+    if (name.empty() || pwd.empty()) {
         return false;
     }
-    LOG_INFO("Verify name:%s pwd:%s", name.c_str(), pwd.c_str());
+    LOG_INFO("Verify name:%.*s pwd:%.*s", (int)name.size(), name.data(), (int)pwd.size(), pwd.data());
     MYSQL* sql;
     SqlConnRAII(&sql, SqlConnPool::Instance());
     assert(sql);
@@ -216,8 +298,8 @@ bool HttpRequest::UserVerify(const std::string& name, const std::string& pwd, bo
         flag = true;
     }
     /* 查询用户及密码 */
-    snprintf(order, 256, "SELECT username, password FROM user WHERE username='%s' LIMIT 1",
-            name.c_str());
+    snprintf(order, 256, "SELECT username, password FROM user WHERE username='%.*s' LIMIT 1",
+            (int)name.size(), name.data());
     LOG_DEBUG("%s", order);
 
     if (mysql_query(sql, order)) {
@@ -228,7 +310,7 @@ bool HttpRequest::UserVerify(const std::string& name, const std::string& pwd, bo
 
     while (MYSQL_ROW row = mysql_fetch_row(res)) {
         LOG_DEBUG("MYSQL ROW: %s %s", row[0], row[1]);
-        std::string password(row[1]);
+        std::string_view password(row[1]);
         /* 注册行为 且 用户名未被使用*/
         if (IsLogin) {
             if (pwd == password) {
@@ -248,8 +330,8 @@ bool HttpRequest::UserVerify(const std::string& name, const std::string& pwd, bo
     if (!IsLogin && flag == true) {
         LOG_DEBUG("regirster!");
         bzero(order, 256);
-        snprintf(order, 256, "INSERT INTO user(username, password) VALUES('%s','%s')",
-                name.c_str(), pwd.c_str());
+        snprintf(order, 256, "INSERT INTO user(username, password) VALUES('%.*s','%.*s')",
+                (int)name.size(), name.data(), (int)pwd.size(), pwd.data());
         LOG_DEBUG("%s", order);
         if (mysql_query(sql, order)) {
         LOG_DEBUG("Insert error!");
@@ -265,51 +347,74 @@ bool HttpRequest::UserVerify(const std::string& name, const std::string& pwd, bo
  * @brief 判断是否为长连接
 */
 bool HttpRequest::IsKeepAlive() const {
-    if (header_.count("Connection") == 1) {
-        return header_.find("Connection")->second == "keep-alive" && version_ == "1.1";
+    /* Connection是逗号分隔的token列表, 不区分大小写 */
+    bool close = false, keepAlive = false;
+    std::string_view value = header(HttpHeader::CONNECTION);
+    while (!value.empty()) {
+        size_t comma = value.find(',');
+        std::string_view token = value.substr(0, comma);
+        value = comma == std::string_view::npos ? std::string_view() : value.substr(comma + 1);
+        while (!token.empty() && (token.front() == ' ' || token.front() == '\t')) {
+            token.remove_prefix(1);
+        }
+        while (!token.empty() && (token.back() == ' ' || token.back() == '\t')) {
+            token.remove_suffix(1);
+        }
+        if (httptable::NoCaseKey::Equal(token, "close")) {
+            close = true;
+        } else if (httptable::NoCaseKey::Equal(token, "keep-alive")) {
+            keepAlive = true;
+        }
     }
-    return false;
+    if (close) {
+        return false;
+    }
+    /* HTTP/1.1默认保持连接, HTTP/1.0需要显式请求 */
+    return version_ == "1.1" || keepAlive;
 }
 
 /**
  * @brief 获取POST请求的值
 */
-std::string HttpRequest::GetPost(const std::string& key) const {
-    assert(key != "");
-    if (post_.count(key) == 1) {
-        return post_.find(key)->second;
+std::string_view HttpRequest::GetPost(std::string_view key) const {
+    assert(!key.empty());
+    for (const auto& item : post_) {
+        if (item.first == key) {
+            return item.second;
+        }
     }
-    return "";
+    return std::string_view();
 }
 
 /**
- * @brief 获取POST请求的值
+ * @brief 获取请求头, 不存在时返回空串
 */
-std::string HttpRequest::GetPost(const char* key) const {
-    assert(key != nullptr);
-    if (post_.count(key) == 1) {
-        return post_.find(key)->second;
-    }
-    return "";
+std::string_view HttpRequest::header(HttpHeader key) const {
+    assert(key != HttpHeader::UNKNOWN);
+    return header_[static_cast<size_t>(key)];
 }
 
 /**
- * @brief 获取请求路径
+ * @brief 获取路由匹配到的路径参数
 */
-std::string HttpRequest::path() const { return path_; }
+std::string_view HttpRequest::param(std::string_view name) const { return params_.Get(name); }
 
 /**
  * @brief 获取请求路径
 */
-std::string& HttpRequest::path() { return path_; }
+std::string_view HttpRequest::path() const { return path_; }
+
+/**
+ * @brief 获取查询串('?'之后的部分)
+*/
+std::string_view HttpRequest::query() const { return query_; }
 
 /**
  * @brief 获取请求方法
 */
-std::string HttpRequest::method() const { return method_; }
+std::string_view HttpRequest::method() const { return method_; }
 
 /**
  * @brief 获取请求版本
 */
-std::string HttpRequest::version() const { return version_; }
-
+std::string_view HttpRequest::version() const { return version_; }
@@ -4,15 +4,19 @@
 #include <errno.h>
 #include <mysql/mysql.h>
 
-#include <regex>
-#include <string>
-#include <unordered_map>
-#include <unordered_set>
+#include <algorithm>
+#include <array>
+#include <string_view>
+#include <utility>
+#include <vector>
 
+#include "../buffer/arena.h"
 #include "../buffer/buffer.h"
 #include "../log/log.h"
 #include "../pool/sqlconnRAII.h"
 #include "../pool/sqlconnpool.h"
+#include "httptable.h"
+#include "router.h"
 
 class HttpRequest {
 public:
@@ -34,38 +38,82 @@ public:
         CLOSED_CONNECTION,
     };
 
-    HttpRequest() { Init(); }
+    explicit HttpRequest(Arena* arena) : arena_(arena) {
+        assert(arena_);
+        Init();
+    }
     ~HttpRequest() = default;
 
     void Init();
-    bool parse(Buffer& buff);
 
-    std::string path() const;
-    std::string& path();
-    std::string method() const;
-    std::string version() const;
-    std::string GetPost(const std::string& key) const;
-    std::string GetPost(const char* key) const;
+    /**
+     * @brief 解析CheckComplete确认已收全的请求, 只消费这一个请求的数据, 之后的流水线请求留在缓冲区中
+     * @param bodyLen CheckComplete得到的请求体长度
+    */
+    bool parse(Buffer& buff, size_t bodyLen);
+
+    /**
+     * @brief 只解析已收全的请求行和请求头, 消费到空行为止; 请求体另行收取后用SetBody设置
+    */
+    bool ParseHead(Buffer& buff);
+
+    /**
+     * @brief 检查缓冲区开头的请求是否已收全, 不消费数据
+     * @param bodyLen 请求头收全时为Content-Length声明的请求体长度, 否则为0
+     * @param errCode 请求头收全但请求体的长度无法确定时为应答的状态码:
+     * 带Transfer-Encoding为501(同时带Content-Length为400), Content-Length不是数字或多个值不一致为400; 否则为0
+     * @return 收全或出错返回FINISH; 请求头未收全返回HEADERS; 请求体未收全返回BODY
+    */
+    static PARSE_STATE CheckComplete(const Buffer& buff, size_t* bodyLen, int* errCode);
+
+    std::string_view path() const;
+    std::string_view query() const;
+    std::string_view method() const;
+    std::string_view version() const;
+    std::string_view GetPost(std::string_view key) const;
+    std::string_view header(HttpHeader key) const;
+    std::string_view body() const { return body_; }
+
+    /**
+     * @brief 不在HttpHeader中的请求头, 按到达顺序保存, 供反向代理转发
+    */
+    const std::vector<std::pair<std::string_view, std::string_view>>& OtherHeaders() const { return others_; }
+    std::string_view param(std::string_view name) const;
+    RouteParams& params() { return params_; }
 
     bool IsKeepAlive() const;
 
+    /* 供HTTP/2等非文本协议直接填充请求, 数据均复制到arena中 */
+    void SetRequestLine(std::string_view method, std::string_view target, std::string_view version);
+    void SetHeader(std::string_view name, std::string_view value);
+    void SetBody(std::string_view body);
+
+    /**
+     * @brief 分段收取的请求体拼接到arena中, 请求解析完成
+    */
+    void SetBody(const ChainBuffer& body);
+
+    static bool UserVerify(std::string_view name, std::string_view pwd, bool reg);
+
+    static constexpr size_t MAX_HEADER_SIZE = 16 * 1024;    // 请求行和请求头的最大长度
+    static constexpr size_t MAX_BODY_SIZE = 1024 * 1024;    // 请求体的最大长度
+    static constexpr size_t CHAIN_BODY_SIZE = 64 * 1024;    // 不小于该长度且未收全的请求体改存到分段缓冲区
+
     private:
-    bool ParseRequestLine_(const std::string& line);
-    void ParseHeader_(const std::string& line);
-    void ParseBody_(const std::string& line);
+    bool ParseRequestLine_(std::string_view line);
+    bool ParseHeader_(std::string_view line);
+    void ParseBody_(std::string_view body);
 
-    void ParsePath_();
-    void ParsePost_();
     void ParseFromUrlencoded_();
 
-    static bool UserVerify(const std::string& name, const std::string& pwd, bool reg);
-
+    Arena* arena_;      // 请求数据所在的arena, 由HttpConn持有并在每个请求开始时重置
     PARSE_STATE state_; // PARSE_STATE请求解析状态
-    std::string method_, path_, version_, body_; // 请求方法，路径，版本，请求体
-    std::unordered_map<std::string, std::string> header_; // 请求头
-    std::unordered_map<std::string, std::string> post_; // post请求体
-    static const std::unordered_set<std::string> DEFAULT_HTML; // 默认网页
-    static const std::unordered_map<std::string, int> DEFAULT_HTML_TAG; // 默认网页标签
+    std::string_view method_, path_, query_, version_, body_; // 请求方法，路径，查询串，版本，请求体
+    std::array<std::string_view, static_cast<size_t>(HttpHeader::COUNT)> header_; // 已知请求头, 按枚举下标存放
+    std::vector<std::pair<std::string_view, std::string_view>> others_; // 其余请求头, 清空时保留容量
+    std::vector<std::pair<std::string_view, std::string_view>> post_; // post请求体, 清空时保留容量
+    RouteParams params_; // 路由匹配到的路径参数
+    static size_t UrlDecode_(std::string_view src, char* dst); // url解码, 返回解码后长度
     static int ConverHex(char ch); // 字符转16进制
 };
 
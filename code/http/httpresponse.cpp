@@ -1,52 +1,60 @@
 #include "httpresponse.h"
 
+#include <atomic>
+
+#include "httprequest.h"
 
-const std::unordered_map<std::string, std::string> HttpResponse::SUFFIX_TYPE = {
-    {".html", "text/html"},
-    {".avi", "video/x-msvideo"},
-    {".gif", "image/gif"},
-    {".xhtml", "application/xhtml+xml"},
-    {".xml", "text/xml"},
-    {".txt", "text/plain"},
-    {".jpg", "image/jpeg"},
-    {".jpeg", "image/jpeg"},
-    {".au", "audio/basic"},
-    {".mpeg", "video/mpeg"},
-    {".rtf", "application/rtf"},
-    {".pdf", "application/pdf"},
-    {".mp4", "video/mp4"},
-    {".flv", "video/flv"},
-    {".word", "application/nsword"},
-    {".png", "image/png"},
-    {".mpg", "video/mpeg"},
-    {".tar", "application/x-tar"},
-    {".css", "text/css "},
-    {".js", "text/javascript "},
-    {".gz", "application/x-gzip"},
-};
 
-const std::unordered_map<int, std::string> HttpResponse::CODE_STATUS = {
+namespace {
+
+// 状态码和状态信息的映射
+constexpr auto CODE_STATUS = httptable::MakeStaticMap<httptable::IntKey, std::string_view>({
     {200, "OK"},
+    {201, "Created"},
+    {204, "No Content"},
+    {301, "Moved Permanently"},
+    {302, "Found"},
+    {206, "Partial Content"},
+    {304, "Not Modified"},
     {400, "Bad Request"},
     {403, "Forbidden"},
     {404, "Not Found"},
-};
+    {405, "Method Not Allowed"},
+    {416, "Range Not Satisfiable"},
+    {500, "Internal Server Error"},
+    {501, "Not Implemented"},
+    {502, "Bad Gateway"},
+    {503, "Service Unavailable"},
+});
+static_assert(CODE_STATUS.Valid(), "no perfect hash seed for CODE_STATUS");
 
-const std::unordered_map<int, std::string> HttpResponse::ERROR_CODE = {
-    {400, "/400.html"},
-    {403, "/403.html"},
-    {404, "/404.html"},
-};
+// 错误页面状态码 -> ERROR_PAGES下标
+constexpr auto ERROR_CODE = httptable::MakeStaticMap<httptable::IntKey, int>({
+    {400, 0},
+    {403, 1},
+    {404, 2},
+    {405, 3},
+    {503, 4},
+    {502, 5},
+});
+static_assert(ERROR_CODE.Valid(), "no perfect hash seed for ERROR_CODE");
+
+// 启动时预先生成的错误响应, 之后只读
+HttpResponse::ErrorPage ERROR_PAGES[ERROR_CODE.size()];
+
+}  // namespace
 
 /**
  * @brief 构造函数
 */
-HttpResponse::HttpResponse() {
+HttpResponse::HttpResponse(Arena* arena) : arena_(arena), request_(nullptr), proxy_(nullptr) {
+  assert(arena_);
   code_ = -1;
-  path_ = srcDir_ = "";
+  hasContent_ = false;
+  isHead_ = false;
   isKeepAlive_ = false;
-  mmFile_ = nullptr;
-  mmFileStat_ = {0};
+  keepAliveTimeout_ = keepAliveMax_ = 0;
+  bodyCnt_ = 0;
 };
 
 /**
@@ -57,149 +65,561 @@ HttpResponse::~HttpResponse() { UnmapFile(); }
 /**
  * @brief 初始化
 */
-void HttpResponse::Init(const std::string& srcDir, std::string& path, bool isKeepAlive, int code) {
-    assert(srcDir != "");
-    if (mmFile_) {
-        UnmapFile();
-    }
+void HttpResponse::Init(std::string_view path, bool isKeepAlive, int code, const HttpRequest* request) {
+    UnmapFile();
+    request_ = request;
     code_ = code;
     isKeepAlive_ = isKeepAlive;
+    keepAliveTimeout_ = keepAliveMax_ = 0;
     path_ = path;
-    srcDir_ = srcDir;
-    mmFile_ = nullptr;
-    mmFileStat_ = {0};
+    hasContent_ = false;
+    isHead_ = false;
+    type_ = content_ = allow_ = headerBlock_ = std::string_view();
+    bodyCnt_ = 0;
+    proxy_ = nullptr;
 }
 
 /**
- * @brief 释放内存映射
+ * @brief 改为返回资源目录下的另一个文件
 */
-void HttpResponse::UnmapFile() {
-    if (mmFile_) {
-        munmap(mmFile_, mmFileStat_.st_size);
-        mmFile_ = nullptr;
-    }
+void HttpResponse::SetFile(std::string_view path) {
+    path_ = path;
+    hasContent_ = false;
+}
+
+/**
+ * @brief 返回处理函数生成的内容, body复制进arena
+*/
+void HttpResponse::SetContent(int code, std::string_view type, std::string_view body) {
+    code_ = code;
+    type_ = arena_->Copy(type);
+    content_ = arena_->Copy(body);
+    hasContent_ = true;
 }
 
 /**
-* @brief 将响应信息写入Buffer对象
+ * @brief 释放对缓存映射的引用
+*/
+void HttpResponse::UnmapFile() { file_.reset(); }
+
+/**
+* @brief 将响应信息写入Buffer对象; HEAD请求的响应头与GET相同(包括Content-length), 但不带响应体
 */
 void HttpResponse::MakeResponse(Buffer& buff) {
-    /* 判断请求的资源文件 */
-    if (stat((srcDir_ + path_).data(), &mmFileStat_) < 0 || S_ISDIR(mmFileStat_.st_mode)) { // 目录
-        code_ = 404;
-    } else if (!(mmFileStat_.st_mode & S_IROTH)) {  // 权限
-        code_ = 403;
-    } else if (code_ == -1) {
+    if (code_ == -1) {
         code_ = 200;
     }
-    ErrorHtml_();
+    isHead_ = request_ && request_->method() == "HEAD";
+    if (!hasContent_) {
+        /* 从文件缓存打开请求的资源, 已经确定是错误时直接返回错误页面 */
+        if (code_ == 200) {
+            code_ = FileCache::Instance()->Open(path_, &file_);
+        }
+        if (code_ == 200 && file_) {
+            /* 区间请求只针对原文件, 不协商压缩 */
+            bool isRange = IsRangeRequest_();
+            if (!isRange) {
+                SelectEncoding_();
+            }
+            if (IsNotModified_()) {
+                code_ = 304;
+                headerBlock_ = file_->notModified[isKeepAlive_];
+                AddVolatileHeader_(buff);
+                return;
+            }
+            if (isRange && MakeRangeResponse_(buff)) {
+                return;
+            }
+            /* 缓存命中: 固定响应头直接引用缓存, Buffer中只写易变头部 */
+            headerBlock_ = file_->header[isKeepAlive_];
+            AddVolatileHeader_(buff);
+            AddBody_(std::string_view(file_->data, file_->size));
+            return;
+        }
+        /* 错误页面: 预先生成的响应头和页面, 不访问文件 */
+        const ErrorPage* page = FindErrorPage(code_);
+        if (page) {
+            file_.reset();
+            headerBlock_ = page->header[isKeepAlive_];
+            AddVolatileHeader_(buff);
+            AddBody_(page->body);
+            return;
+        }
+    }
     AddStateLine_(buff);
     AddHeader_(buff);
     AddContent_(buff);
 }
 
 /**
- * @brief 错误页面
+ * @brief 读取资源目录下的错误页面(/400.html等)并生成完整的响应头, 文件不存在时使用简单页面
 */
-void HttpResponse::ErrorHtml_() {
-    if (ERROR_CODE.count(code_) == 1) {
-        stat((srcDir_ + path_).data(), &mmFileStat_);
-        path_ = ERROR_CODE.find(code_)->second;
+void HttpResponse::InitErrorPages(const char* srcDir) {
+    assert(srcDir);
+    std::string dir(srcDir);
+    while (!dir.empty() && dir.back() == '/') {
+        dir.pop_back();
+    }
+    for (auto& entry : ERROR_CODE) {
+        ErrorPage& page = ERROR_PAGES[entry.value];
+        page.code = entry.key;
+        page.body.clear();
+
+        char path[32];
+        snprintf(path, sizeof(path), "/%d.html", entry.key);
+        int fd = open((dir + path).c_str(), O_RDONLY);
+        if (fd >= 0) {
+            char buf[4096];
+            ssize_t len;
+            while ((len = read(fd, buf, sizeof(buf))) > 0) {
+                page.body.append(buf, len);
+            }
+            close(fd);
+        }
+        if (page.body.empty()) {
+            Buffer buff(256);
+            AppendErrorHtml_(buff, entry.key, "");
+            page.body = buff.RetrieveAllToStr();
+        }
+        for (int keepAlive = 0; keepAlive < 2; keepAlive++) {
+            Buffer buff(256);
+            AppendStateLine_(buff, entry.key);
+            AppendHeader_(buff, keepAlive, "text/html");
+            AppendContentLength_(buff, page.body.size());
+            page.header[keepAlive] = buff.RetrieveAllToStr();
+        }
     }
 }
 
+/**
+ * @brief 查找预先生成的错误响应, 不存在或未初始化时返回nullptr
+*/
+const HttpResponse::ErrorPage* HttpResponse::FindErrorPage(int code) {
+    const int* idx = ERROR_CODE.Find(code);
+    return idx && ERROR_PAGES[*idx].code == code ? &ERROR_PAGES[*idx] : nullptr;
+}
+
+/**
+ * @brief 按Accept-Encoding选择压缩版本, 压缩率高的优先
+*/
+void HttpResponse::SelectEncoding_() {
+    if (!file_->vary || !request_) {
+        return;
+    }
+    uint32_t accepted = Compressor::ParseAcceptEncoding(request_->header(HttpHeader::ACCEPT_ENCODING));
+    const ContentEncoding prefer[] = {ContentEncoding::BR, ContentEncoding::ZSTD, ContentEncoding::GZIP};
+    for (ContentEncoding enc : prefer) {
+        const FileRef& variant = file_->variants[static_cast<int>(enc)];
+        if ((accepted & (1u << static_cast<int>(enc))) && variant) {
+            file_ = variant;
+            return;
+        }
+    }
+}
+
+/**
+ * @brief 条件请求: If-None-Match优先, 没有时比较If-Modified-Since
+*/
+bool HttpResponse::IsNotModified_() const {
+    if (!request_ || (request_->method() != "GET" && request_->method() != "HEAD")) {
+        return false;
+    }
+    std::string_view inm = request_->header(HttpHeader::IF_NONE_MATCH);
+    if (!inm.empty()) {
+        /* 弱比较: 忽略W/前缀 */
+        std::string_view etag = file_->etag;
+        while (!inm.empty()) {
+            size_t comma = inm.find(',');
+            std::string_view tag = inm.substr(0, comma);
+            inm = comma == std::string_view::npos ? std::string_view() : inm.substr(comma + 1);
+            while (!tag.empty() && (tag.front() == ' ' || tag.front() == '\t')) {
+                tag.remove_prefix(1);
+            }
+            while (!tag.empty() && (tag.back() == ' ' || tag.back() == '\t')) {
+                tag.remove_suffix(1);
+            }
+            if (tag.substr(0, 2) == "W/") {
+                tag.remove_prefix(2);
+            }
+            if (tag == "*" || tag == etag) {
+                return true;
+            }
+        }
+        return false;
+    }
+    time_t since;
+    std::string_view ims = request_->header(HttpHeader::IF_MODIFIED_SINCE);
+    return !ims.empty() && ParseDate(ims, &since) && file_->mtime <= since;
+}
+
 /**
  * @brief 添加状态行
 */
 void HttpResponse::AddStateLine_(Buffer& buff) {
-    std::string status;
-    if (CODE_STATUS.count(code_) == 1) {
-        status = CODE_STATUS.find(code_)->second;
-    } else {
+    if (!CODE_STATUS.Find(code_)) {
         code_ = 400;
-        status = CODE_STATUS.find(400)->second;
     }
-    buff.Append("HTTP/1.1 " + std::to_string(code_) + " " + status + "\r\n");
+    AppendStateLine_(buff, code_);
 }
 
 /**
  * @brief 添加响应头
 */
-void HttpResponse::AddHeader_(Buffer& buff) {
-    buff.Append("Connection: ");
-    if (isKeepAlive_) {
-        buff.Append("keep-alive\r\n");
-        buff.Append("keep-alive: max=6, timeout=120\r\n");
-    } else {
-        buff.Append("close\r\n");
-    }
-    buff.Append("Content-type: " + GetFileType_() + "\r\n");
-}
+void HttpResponse::AddHeader_(Buffer& buff) { AppendHeader_(buff, isKeepAlive_, GetFileType_()); }
 
 /**
  * @brief 添加响应体
 */
 void HttpResponse::AddContent_(Buffer& buff) {
-    int srcFd = open((srcDir_ + path_).data(), O_RDONLY);
-    if (srcFd < 0) {
+    if (hasContent_) {
+        AppendContentLength_(buff, content_.size());
+        AddVolatileHeader_(buff);
+        if (!isHead_) {
+            buff.Append(content_.data(), content_.size());
+        }
+        return;
+    }
+    if (!file_) {
         ErrorContent(buff, "File NotFound!");
         return;
     }
+    LOG_DEBUG("file path %.*s", (int)path_.size(), path_.data());
+    AppendContentLength_(buff, file_->size);
+    AddVolatileHeader_(buff);
+    AddBody_(std::string_view(file_->data, file_->size));
+}
 
-    // 将文件映射到内存
-    LOG_DEBUG("file path %s", (srcDir_ + path_).data());
-    int* mmRet = (int*)mmap(0, mmFileStat_.st_size, PROT_READ, MAP_PRIVATE, srcFd, 0);
-    if (*mmRet == -1) {
-        ErrorContent(buff, "File NotFound!");
+/**
+ * @brief 追加一个数据段, 忽略空数据; HEAD请求不发送数据段
+*/
+void HttpResponse::AddBody_(std::string_view data) {
+    if (data.empty() || isHead_) {
         return;
     }
-    mmFile_ = (char*)mmRet;
-    close(srcFd);
-    buff.Append("Content-length: " + std::to_string(mmFileStat_.st_size) + "\r\n\r\n");
+    assert(bodyCnt_ < MAX_BODY);
+    body_[bodyCnt_++] = data;
 }
 
 /**
- * @brief 获取文件类型
+ * @brief 是否需要按Range处理: GET请求, 且If-Range(如果有)与当前文件一致
+*/
+bool HttpResponse::IsRangeRequest_() const {
+    if (!request_ || request_->method() != "GET" || request_->header(HttpHeader::RANGE).empty()) {
+        return false;
+    }
+    std::string_view ifRange = request_->header(HttpHeader::IF_RANGE);
+    if (ifRange.empty()) {
+        return true;
+    }
+    if (ifRange[0] == '"') {
+        return ifRange == file_->etag;  // 强比较, 弱ETag不匹配
+    }
+    if (ifRange.substr(0, 2) == "W/") {
+        return false;
+    }
+    time_t date;
+    return ParseDate(ifRange, &date) && date == file_->mtime;
+}
+
+/**
+ * @brief 解析Range: bytes=a-b, c-, -n
+ * @return 满足的区间个数, 0表示都不可满足(416), -1表示格式错误或区间过多(忽略Range)
 */
-std::string HttpResponse::GetFileType_() {
-    std::string::size_type idx = path_.find_last_of('.');
-    if (idx == std::string::npos) {
-        return "text/plain";
+int HttpResponse::ParseRange_(std::string_view value, size_t size, Range* ranges) {
+    if (value.substr(0, 6) != "bytes=") {
+        return -1;
     }
-    std::string suffix = path_.substr(idx);
-    if (SUFFIX_TYPE.count(suffix) == 1) {
-        return SUFFIX_TYPE.find(suffix)->second;
+    value.remove_prefix(6);
+    int cnt = 0;
+    while (!value.empty()) {
+        size_t comma = value.find(',');
+        std::string_view spec = value.substr(0, comma);
+        value = comma == std::string_view::npos ? std::string_view() : value.substr(comma + 1);
+        while (!spec.empty() && spec.front() == ' ') {
+            spec.remove_prefix(1);
+        }
+        while (!spec.empty() && spec.back() == ' ') {
+            spec.remove_suffix(1);
+        }
+        size_t dash = spec.find('-');
+        if (dash == std::string_view::npos) {
+            return -1;
+        }
+        std::string_view first = spec.substr(0, dash), last = spec.substr(dash + 1);
+        if ((first.empty() && last.empty()) || first.size() > 18 || last.size() > 18) {
+            return -1;
+        }
+        size_t a = 0, b = 0;
+        for (char ch : first) {
+            if (ch < '0' || ch > '9') {
+                return -1;
+            }
+            a = a * 10 + (ch - '0');
+        }
+        for (char ch : last) {
+            if (ch < '0' || ch > '9') {
+                return -1;
+            }
+            b = b * 10 + (ch - '0');
+        }
+        Range range;
+        if (first.empty()) {
+            /* 后缀区间: 最后b个字节 */
+            if (b == 0 || size == 0) {
+                continue;
+            }
+            range.start = b >= size ? 0 : size - b;
+            range.end = size;
+        } else {
+            if (!last.empty() && b < a) {
+                return -1;
+            }
+            if (a >= size) {
+                continue;  // 不可满足, 跳过
+            }
+            range.start = a;
+            range.end = last.empty() || b >= size ? size : b + 1;
+        }
+        if (cnt == MAX_RANGES) {
+            return -1;
+        }
+        ranges[cnt++] = range;
     }
-    return "text/plain";
+    return cnt;
 }
 
 /**
- * @brief 错误页面
+ * @brief 生成206/416响应, Range格式错误时返回false, 按200处理
 */
-void HttpResponse::ErrorContent(Buffer& buff, std::string message) {
-    std::string body;
-    std::string status;
-    body += "<html><title>Error</title>";
-    body += "<body bgcolor=\"ffffff\">";
-    if (CODE_STATUS.count(code_) == 1) {
-        status = CODE_STATUS.find(code_)->second;
+bool HttpResponse::MakeRangeResponse_(Buffer& buff) {
+    Range ranges[MAX_RANGES];
+    int cnt = ParseRange_(request_->header(HttpHeader::RANGE), file_->size, ranges);
+    if (cnt < 0) {
+        return false;
+    }
+    char line[128];
+    if (cnt == 0) {
+        code_ = 416;
+        AppendStateLine_(buff, code_);
+        AppendHeader_(buff, isKeepAlive_, "text/html");
+        int n = snprintf(line, sizeof(line), "Content-Range: bytes */%zu\r\n", file_->size);
+        buff.Append(line, n);
+        ErrorContent(buff, "Requested Range Not Satisfiable");
+        return true;
+    }
+
+    code_ = 206;
+    if (cnt == 1) {
+        AppendFileHeader_(buff, *file_, isKeepAlive_, code_, file_->type);
+        int n = snprintf(line, sizeof(line), "Content-Range: bytes %zu-%zu/%zu\r\n", ranges[0].start,
+                         ranges[0].end - 1, file_->size);
+        buff.Append(line, n);
+        AppendContentLength_(buff, ranges[0].end - ranges[0].start);
+        AddVolatileHeader_(buff);
+        AddBody_(std::string_view(file_->data + ranges[0].start, ranges[0].end - ranges[0].start));
+        return true;
+    }
+
+    /* 多区间: multipart/byteranges, 分隔头放在arena中, 文件区间直接引用映射 */
+    static std::atomic<uint64_t> boundarySeq(time(nullptr));
+    char boundary[24];
+    snprintf(boundary, sizeof(boundary), "%016llx", (unsigned long long)boundarySeq++);
+    std::string_view type = arena_->Concat("multipart/byteranges; boundary=", boundary);
+    size_t length = 0;
+    for (int i = 0; i < cnt; i++) {
+        int n = snprintf(line, sizeof(line), "%s--%s\r\nContent-type: ", i ? "\r\n" : "", boundary);
+        std::string_view part = arena_->Concat(std::string_view(line, n), file_->type);
+        n = snprintf(line, sizeof(line), "\r\nContent-Range: bytes %zu-%zu/%zu\r\n\r\n", ranges[i].start,
+                     ranges[i].end - 1, file_->size);
+        part = arena_->Concat(part, std::string_view(line, n));
+        AddBody_(part);
+        AddBody_(std::string_view(file_->data + ranges[i].start, ranges[i].end - ranges[i].start));
+        length += part.size() + ranges[i].end - ranges[i].start;
+    }
+    int n = snprintf(line, sizeof(line), "\r\n--%s--\r\n", boundary);
+    std::string_view tail = arena_->Copy(std::string_view(line, n));
+    AddBody_(tail);
+    length += tail.size();
+
+    AppendFileHeader_(buff, *file_, isKeepAlive_, code_, type);
+    AppendContentLength_(buff, length);
+    AddVolatileHeader_(buff);
+    return true;
+}
+
+/**
+ * @brief 添加每次响应都不同的头部, 并以空行结束响应头
+*/
+void HttpResponse::AddVolatileHeader_(Buffer& buff) {
+    if (isKeepAlive_ && (keepAliveTimeout_ > 0 || keepAliveMax_ > 0)) {
+        char line[64];
+        int n = 0;
+        if (keepAliveTimeout_ > 0 && keepAliveMax_ > 0) {
+            n = snprintf(line, sizeof(line), "Keep-Alive: timeout=%d, max=%d\r\n", keepAliveTimeout_, keepAliveMax_);
+        } else if (keepAliveTimeout_ > 0) {
+            n = snprintf(line, sizeof(line), "Keep-Alive: timeout=%d\r\n", keepAliveTimeout_);
+        } else {
+            n = snprintf(line, sizeof(line), "Keep-Alive: max=%d\r\n", keepAliveMax_);
+        }
+        buff.Append(line, n);
+    }
+    if (!allow_.empty()) {
+        buff.Append("Allow: ", 7);
+        buff.Append(allow_.data(), allow_.size());
+        buff.Append("\r\n", 2);
+    }
+    std::string_view date = CoarseClock::Instance()->HttpDate();
+    buff.Append("Date: ", 6);
+    buff.Append(date.data(), date.size());
+    buff.Append("\r\n\r\n", 4);
+}
+
+/**
+ * @brief 生成静态文件的固定响应头
+*/
+std::string HttpResponse::StaticHeader(const CachedFile& file, bool isKeepAlive, bool notModified) {
+    Buffer buff(256);
+    if (notModified) {
+        AppendFileHeader_(buff, file, isKeepAlive, 304, std::string_view());
     } else {
-        status = "Bad Request";
+        AppendFileHeader_(buff, file, isKeepAlive, 200, file.type);
+        AppendContentLength_(buff, file.size);
     }
-    body += std::to_string(code_) + " : " + status + "\n";
-    body += "<p>" + message + "</p>";
-    body += "<hr><em> WebServer</em></body></html>";
+    return buff.RetrieveAllToStr();
+}
 
-    buff.Append("Content-length: " + std::to_string(body.size()) + "\r\n\r\n");
-    buff.Append(body);
+/**
+ * @brief 写入静态文件响应的状态行和实体头部, 不含Content-length
+ * @param type Content-type, 为空时不写(304)
+*/
+void HttpResponse::AppendFileHeader_(Buffer& buff, const CachedFile& file, bool isKeepAlive, int code,
+                                     std::string_view type) {
+    AppendStateLine_(buff, code);
+    AppendHeader_(buff, isKeepAlive, type);
+    if (code != 304) {
+        buff.Append("Accept-Ranges: bytes\r\n");
+        if (!file.encoding.empty()) {
+            buff.Append("Content-Encoding: ");
+            buff.Append(file.encoding.data(), file.encoding.size());
+            buff.Append("\r\n", 2);
+        }
+    }
+    if (file.vary) {
+        buff.Append("Vary: Accept-Encoding\r\n");
+    }
+    buff.Append("ETag: " + file.etag + "\r\n");
+    char date[32];
+    size_t len = FormatDate(file.mtime, date, sizeof(date));
+    buff.Append("Last-Modified: ");
+    buff.Append(date, len);
+    buff.Append("\r\n", 2);
+    if (!file.cacheControl.empty()) {
+        buff.Append("Cache-Control: " + file.cacheControl + "\r\n");
+    }
 }
 
 /**
- * @brief 获取文件内容
+ * @brief 格式化为HTTP日期(RFC 7231 IMF-fixdate)
 */
-char* HttpResponse::File() { return mmFile_; }
+size_t HttpResponse::FormatDate(time_t t, char* buf, size_t len) {
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    return strftime(buf, len, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+}
+
+/**
+ * @brief 解析HTTP日期, 只支持IMF-fixdate
+*/
+bool HttpResponse::ParseDate(std::string_view str, time_t* t) {
+    char buf[64];
+    if (str.size() >= sizeof(buf)) {
+        return false;
+    }
+    memcpy(buf, str.data(), str.size());
+    buf[str.size()] = '\0';
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    const char* end = strptime(buf, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    if (!end || *end != '\0') {
+        return false;
+    }
+    *t = timegm(&tm);
+    return true;
+}
 
 /**
- * @brief 获取文件大小
+ * @brief 写入状态行
 */
-size_t HttpResponse::FileLen() const { return mmFileStat_.st_size; }
+void HttpResponse::AppendStateLine_(Buffer& buff, int code) {
+    const char digits[3] = {char('0' + code / 100), char('0' + code / 10 % 10), char('0' + code % 10)};
+    std::string_view status = CODE_STATUS.Get(code, "Bad Request");
+    buff.Append("HTTP/1.1 ", 9);
+    buff.Append(digits, 3);
+    buff.Append(" ", 1);
+    buff.Append(status.data(), status.size());
+    buff.Append("\r\n", 2);
+}
+
+/**
+ * @brief 写入连接和类型头部
+*/
+void HttpResponse::AppendHeader_(Buffer& buff, bool isKeepAlive, std::string_view type) {
+    if (isKeepAlive) {
+        buff.Append("Connection: keep-alive\r\n", 24);
+    } else {
+        buff.Append("Connection: close\r\n", 19);
+    }
+    if (!type.empty()) {
+        buff.Append("Content-type: ", 14);
+        buff.Append(type.data(), type.size());
+        buff.Append("\r\n", 2);
+    }
+}
+
+/**
+ * @brief 写入Content-length
+*/
+void HttpResponse::AppendContentLength_(Buffer& buff, size_t len) {
+    char line[48];
+    int n = snprintf(line, sizeof(line), "Content-length: %zu\r\n", len);
+    buff.Append(line, n);
+}
+
+/**
+ * @brief 获取文件类型
+*/
+std::string_view HttpResponse::GetFileType_() const {
+    if (hasContent_) {
+        return type_;
+    }
+    return file_ ? file_->type : LookupMimeType(path_);
+}
+
+/**
+ * @brief 错误页面
+*/
+void HttpResponse::ErrorContent(Buffer& buff, std::string_view message) {
+    Buffer body(256);
+    AppendErrorHtml_(body, code_, message);
+    AppendContentLength_(buff, body.ReadableBytes());
+    AddVolatileHeader_(buff);
+    if (!isHead_) {
+        buff.Append(body);
+    }
+}
+
+/**
+ * @brief 写入简单的错误页面
+*/
+void HttpResponse::AppendErrorHtml_(Buffer& buff, int code, std::string_view message) {
+    const char digits[3] = {char('0' + code / 100), char('0' + code / 10 % 10), char('0' + code % 10)};
+    std::string_view status = CODE_STATUS.Get(code, "Bad Request");
+    buff.Append("<html><title>Error</title><body bgcolor=\"ffffff\">");
+    buff.Append(digits, 3);
+    buff.Append(" : ", 3);
+    buff.Append(status.data(), status.size());
+    buff.Append("\n<p>", 4);
+    buff.Append(message.data(), message.size());
+    buff.Append("</p><hr><em> WebServer</em></body></html>");
+}
+
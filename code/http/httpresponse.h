@@ -1,50 +1,141 @@
 #ifndef HTTP_RESPONSE_H
 #define HTTP_RESPONSE_H
 
-#include <fcntl.h>
-#include <sys/mman.h>
-#include <sys/stat.h>
-#include <unistd.h>
+#include <string.h>
+#include <time.h>
 
-#include <unordered_map>
+#include <string_view>
 
+#include "../buffer/arena.h"
 #include "../buffer/buffer.h"
 #include "../log/log.h"
+#include "../timer/clock.h"
+#include "filecache.h"
+#include "httptable.h"
+
+class HttpRequest;
+struct UpstreamGroup;
 
 class HttpResponse {
 public:
-    HttpResponse();
+    explicit HttpResponse(Arena* arena);
     ~HttpResponse();
 
-    void Init(const std::string& srcDir, std::string& path, bool isKeepAlive = false,
-        int code = -1);
+    void Init(std::string_view path, bool isKeepAlive = false, int code = -1,
+              const HttpRequest* request = nullptr);
     void MakeResponse(Buffer& buff);
     void UnmapFile();
-    char* File();
-    size_t FileLen() const;
-    void ErrorContent(Buffer& buff, std::string message);
+    std::string_view HeaderBlock() const { return headerBlock_; }
+
+    /**
+     * @brief 响应头之后要发送的数据段: 文件(或其中的区间)与multipart分隔头, 不在Buffer中
+    */
+    size_t BodyCount() const { return bodyCnt_; }
+    std::string_view Body(size_t i) const { assert(i < bodyCnt_); return body_[i]; }
+    void ErrorContent(Buffer& buff, std::string_view message);
     int Code() const { return code_; }
 
+    /**
+     * @brief 响应引用的缓存文件, 数据段可能指向其中; 需要在响应之后继续持有数据时复制此引用
+    */
+    const FileRef& File() const { return file_; }
+    bool IsKeepAlive() const { return isKeepAlive_; }
+
+    /**
+     * @brief 保持连接时通过Keep-Alive头告知客户端的空闲超时(秒)和剩余请求数, <=0表示不限制
+    */
+    void SetKeepAlive(int timeoutSec, int maxLeft) { keepAliveTimeout_ = timeoutSec; keepAliveMax_ = maxLeft; }
+
+    /* 供路由处理函数使用 */
+    void SetCode(int code) { code_ = code; }
+    void SetFile(std::string_view path);
+    void SetContent(int code, std::string_view type, std::string_view body);
+
+    /**
+     * @brief 405响应的Allow头, 列出路径支持的方法, 复制进arena
+    */
+    void SetAllow(std::string_view methods) { allow_ = arena_->Copy(methods); }
+
+    /**
+     * @brief 转发给上游组, 由HttpConn代理, 不再生成本地响应
+    */
+    void SetProxy(UpstreamGroup* group) { proxy_ = group; }
+    UpstreamGroup* Proxy() const { return proxy_; }
+
+    /**
+     * @brief 生成静态文件200/304响应的固定响应头(不含易变头部和结尾空行), 由文件缓存预先计算
+    */
+    static std::string StaticHeader(const CachedFile& file, bool isKeepAlive, bool notModified);
+
+    static size_t FormatDate(time_t t, char* buf, size_t len);
+
+    /**
+     * @brief 预先生成的错误响应, 响应头同样不含易变头部和结尾空行
+    */
+    struct ErrorPage {
+        int code = 0;
+        std::string header[2];  // 下标为是否keep-alive
+        std::string body;
+    };
+
+    /**
+     * @brief 启动时加载错误页面, 之后400/403/404/405/502/503直接返回内存中的页面
+    */
+    static void InitErrorPages(const char* srcDir);
+    static const ErrorPage* FindErrorPage(int code);
+
+    static const int MAX_RANGES = 8;                    // 单个请求最多的区间数, 超过时返回整个文件
+    static const int MAX_BODY = 2 * MAX_RANGES + 1;     // 数据段上限: 每个区间一个分隔头和一段文件, 加结束分隔
+    static bool ParseDate(std::string_view str, time_t* t);
+
 private:
     void AddStateLine_(Buffer& buff);
     void AddHeader_(Buffer& buff);
     void AddContent_(Buffer& buff);
+    void AddVolatileHeader_(Buffer& buff);
 
-    void ErrorHtml_();
-    std::string GetFileType_();
+    static void AppendStateLine_(Buffer& buff, int code);
+    static void AppendHeader_(Buffer& buff, bool isKeepAlive, std::string_view type);
+    static void AppendContentLength_(Buffer& buff, size_t len);
+
+    static void AppendErrorHtml_(Buffer& buff, int code, std::string_view message);
+    void SelectEncoding_();
+    bool IsNotModified_() const;
+    bool IsRangeRequest_() const;
+    bool MakeRangeResponse_(Buffer& buff);
+    void AddBody_(std::string_view data);
+
+    struct Range {
+        size_t start;           // 起始偏移
+        size_t end;             // 结束偏移(不含)
+    };
+    static int ParseRange_(std::string_view value, size_t size, Range* ranges);
+
+    static void AppendFileHeader_(Buffer& buff, const CachedFile& file, bool isKeepAlive, int code,
+                                  std::string_view type);
+    std::string_view GetFileType_() const;
 
     int code_;                  // 状态码
     bool isKeepAlive_;          // 是否保持连接
+    int keepAliveTimeout_;      // Keep-Alive: timeout
+    int keepAliveMax_;          // Keep-Alive: max
+
+    Arena* arena_;              // 所属连接的arena
+    const HttpRequest* request_; // 对应的请求, 解析失败时为空
+    std::string_view path_;     // 相对资源目录的请求路径
 
-    std::string path_;          // 请求的路径
-    std::string srcDir_;        // 资源路径
+    bool hasContent_;           // 是否为处理函数生成的内存响应体
+    bool isHead_;               // HEAD请求, 只发送响应头
+    std::string_view type_;     // 内存响应体的类型
+    std::string_view content_;  // 内存响应体, 位于arena中
+    std::string_view allow_;    // Allow头的值, 为空时不发送
 
-    char* mmFile_;              // 内存映射
-    struct stat mmFileStat_;    // 文件属性
+    UpstreamGroup* proxy_;      // 代理的目标上游组, 为空时本地响应
 
-    static const std::unordered_map<std::string, std::string> SUFFIX_TYPE;  // 文件后缀名和文件类型的映射
-    static const std::unordered_map<int, std::string> CODE_STATUS;          // 状态码和状态信息的映射
-    static const std::unordered_map<int, std::string> ERROR_CODE;            // 错误页面状态码的映射
+    FileRef file_;              // 文件缓存中的映射, 持有引用直到响应发送完毕
+    std::string_view headerBlock_; // 缓存中预先生成的响应头, 为空时响应头全部在Buffer中
+    std::string_view body_[MAX_BODY]; // 响应头之后的数据段
+    size_t bodyCnt_;            // 数据段个数
 };
 
 #endif 
\ No newline at end of file
@@ -0,0 +1,296 @@
+#ifndef HTTP_TABLE_H
+#define HTTP_TABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <array>
+#include <string_view>
+
+/**
+ * @brief 编译期完美哈希表
+ * 构造时在编译期搜索一个种子, 使所有key落在互不冲突的槽位上,
+ * 查找只需一次哈希、一次取槽和一次比较, 不分配内存
+*/
+namespace httptable {
+
+constexpr char ToLower(char ch) { return (ch >= 'A' && ch <= 'Z') ? ch - 'A' + 'a' : ch; }
+
+/**
+ * @brief 区分大小写的字符串key(路径)
+*/
+struct ExactKey {
+    typedef std::string_view Key;
+    static constexpr uint32_t Hash(Key key, uint32_t seed) {
+        uint32_t h = 2166136261u ^ seed;
+        for (char ch : key) {
+            h = (h ^ static_cast<uint8_t>(ch)) * 16777619u;
+        }
+        return h ^ (h >> 15);
+    }
+    static constexpr bool Equal(Key a, Key b) { return a == b; }
+};
+
+/**
+ * @brief 不区分大小写的字符串key(请求头, 文件后缀)
+*/
+struct NoCaseKey {
+    typedef std::string_view Key;
+    static constexpr uint32_t Hash(Key key, uint32_t seed) {
+        uint32_t h = 2166136261u ^ seed;
+        for (char ch : key) {
+            h = (h ^ static_cast<uint8_t>(ToLower(ch))) * 16777619u;
+        }
+        return h ^ (h >> 15);
+    }
+    static constexpr bool Equal(Key a, Key b) {
+        if (a.size() != b.size()) {
+            return false;
+        }
+        for (size_t i = 0; i < a.size(); i++) {
+            if (ToLower(a[i]) != ToLower(b[i])) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+/**
+ * @brief 整数key(状态码)
+*/
+struct IntKey {
+    typedef int Key;
+    static constexpr uint32_t Hash(Key key, uint32_t seed) {
+        uint32_t h = static_cast<uint32_t>(key) * 2654435761u + seed * 40503u;
+        return h ^ (h >> 13);
+    }
+    static constexpr bool Equal(Key a, Key b) { return a == b; }
+};
+
+/**
+ * @brief 槽位数取不小于4N的2的幂, 保证种子搜索很快收敛
+*/
+constexpr size_t SlotsFor(size_t n) {
+    size_t slots = 1;
+    while (slots < n * 4) {
+        slots <<= 1;
+    }
+    return slots;
+}
+
+template <class Traits, class V, size_t N>
+class StaticMap {
+public:
+    typedef typename Traits::Key Key;
+    struct Entry {
+        Key key{};
+        V value{};
+    };
+
+    constexpr explicit StaticMap(const Entry (&entries)[N]) : entries_(), slots_(), seed_(0) {
+        static_assert(N > 0 && N < EMPTY, "table size out of range");
+        for (size_t i = 0; i < N; i++) {
+            entries_[i] = entries[i];
+        }
+        for (uint32_t seed = 1; seed < MAX_SEED; seed++) {
+            if (TrySeed_(seed)) {
+                seed_ = seed;
+                return;
+            }
+        }
+    }
+
+    /**
+     * @brief 查找key, 不存在返回nullptr
+    */
+    constexpr const V* Find(Key key) const {
+        const uint8_t idx = slots_[Traits::Hash(key, seed_) & (SLOTS - 1)];
+        if (idx != EMPTY && Traits::Equal(entries_[idx].key, key)) {
+            return &entries_[idx].value;
+        }
+        return nullptr;
+    }
+
+    /**
+     * @brief 查找key, 不存在返回默认值
+    */
+    constexpr V Get(Key key, V def) const {
+        const V* value = Find(key);
+        return value ? *value : def;
+    }
+
+    constexpr bool Valid() const { return seed_ != 0; }
+    constexpr size_t size() const { return N; }
+    constexpr const Entry* begin() const { return entries_.data(); }
+    constexpr const Entry* end() const { return entries_.data() + N; }
+
+private:
+    constexpr bool TrySeed_(uint32_t seed) {
+        for (size_t i = 0; i < SLOTS; i++) {
+            slots_[i] = EMPTY;
+        }
+        for (size_t i = 0; i < N; i++) {
+            const size_t h = Traits::Hash(entries_[i].key, seed) & (SLOTS - 1);
+            if (slots_[h] != EMPTY) {
+                return false;
+            }
+            slots_[h] = static_cast<uint8_t>(i);
+        }
+        return true;
+    }
+
+    static constexpr size_t SLOTS = SlotsFor(N);
+    static constexpr uint8_t EMPTY = 0xff;
+    static constexpr uint32_t MAX_SEED = 4096;
+
+    std::array<Entry, N> entries_;     // 原始条目
+    std::array<uint8_t, SLOTS> slots_; // 槽位 -> 条目下标
+    uint32_t seed_;                    // 无冲突的哈希种子
+};
+
+/**
+ * @brief 构造StaticMap, 由初始化列表推导条目数
+*/
+template <class Traits, class V, size_t N>
+constexpr StaticMap<Traits, V, N> MakeStaticMap(
+    const typename StaticMap<Traits, V, N>::Entry (&entries)[N]) {
+    return StaticMap<Traits, V, N>(entries);
+}
+
+/**
+ * @brief 逗号分隔的token列表(Connection/Upgrade等)中是否包含指定token, 不区分大小写
+*/
+constexpr bool ContainsToken(std::string_view value, std::string_view token) {
+    while (!value.empty()) {
+        size_t comma = value.find(',');
+        std::string_view item = value.substr(0, comma);
+        value = comma == std::string_view::npos ? std::string_view() : value.substr(comma + 1);
+        while (!item.empty() && (item.front() == ' ' || item.front() == '\t')) {
+            item.remove_prefix(1);
+        }
+        while (!item.empty() && (item.back() == ' ' || item.back() == '\t')) {
+            item.remove_suffix(1);
+        }
+        if (NoCaseKey::Equal(item, token)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+}  // namespace httptable
+
+/**
+ * @brief 已知的请求头, 解析时存入以枚举为下标的固定槽位
+*/
+enum class HttpHeader : uint8_t {
+    HOST,
+    CONNECTION,
+    KEEP_ALIVE,
+    CONTENT_TYPE,
+    CONTENT_LENGTH,
+    TRANSFER_ENCODING,
+    ACCEPT,
+    ACCEPT_ENCODING,
+    ACCEPT_LANGUAGE,
+    USER_AGENT,
+    REFERER,
+    COOKIE,
+    CACHE_CONTROL,
+    IF_NONE_MATCH,
+    IF_MODIFIED_SINCE,
+    RANGE,
+    IF_RANGE,
+    UPGRADE,
+    EXPECT,
+    HTTP2_SETTINGS,
+    SEC_WEBSOCKET_KEY,
+    SEC_WEBSOCKET_VERSION,
+    COUNT,
+    UNKNOWN = COUNT,
+};
+
+inline constexpr auto HEADER_TABLE = httptable::MakeStaticMap<httptable::NoCaseKey, HttpHeader>({
+    {"Host", HttpHeader::HOST},
+    {"Connection", HttpHeader::CONNECTION},
+    {"Keep-Alive", HttpHeader::KEEP_ALIVE},
+    {"Content-Type", HttpHeader::CONTENT_TYPE},
+    {"Content-Length", HttpHeader::CONTENT_LENGTH},
+    {"Transfer-Encoding", HttpHeader::TRANSFER_ENCODING},
+    {"Accept", HttpHeader::ACCEPT},
+    {"Accept-Encoding", HttpHeader::ACCEPT_ENCODING},
+    {"Accept-Language", HttpHeader::ACCEPT_LANGUAGE},
+    {"User-Agent", HttpHeader::USER_AGENT},
+    {"Referer", HttpHeader::REFERER},
+    {"Cookie", HttpHeader::COOKIE},
+    {"Cache-Control", HttpHeader::CACHE_CONTROL},
+    {"If-None-Match", HttpHeader::IF_NONE_MATCH},
+    {"If-Modified-Since", HttpHeader::IF_MODIFIED_SINCE},
+    {"Range", HttpHeader::RANGE},
+    {"If-Range", HttpHeader::IF_RANGE},
+    {"Upgrade", HttpHeader::UPGRADE},
+    {"Expect", HttpHeader::EXPECT},
+    {"HTTP2-Settings", HttpHeader::HTTP2_SETTINGS},
+    {"Sec-WebSocket-Key", HttpHeader::SEC_WEBSOCKET_KEY},
+    {"Sec-WebSocket-Version", HttpHeader::SEC_WEBSOCKET_VERSION},
+});
+static_assert(HEADER_TABLE.Valid(), "no perfect hash seed for HEADER_TABLE");
+static_assert(HEADER_TABLE.size() == static_cast<size_t>(HttpHeader::COUNT),
+              "HEADER_TABLE out of sync with HttpHeader");
+
+/**
+ * @brief 请求头名称 -> 枚举, 未知请求头返回UNKNOWN
+*/
+constexpr HttpHeader LookupHeader(std::string_view name) {
+    return HEADER_TABLE.Get(name, HttpHeader::UNKNOWN);
+}
+
+/**
+ * @brief 文件后缀名和文件类型的映射
+*/
+inline constexpr auto SUFFIX_TYPE = httptable::MakeStaticMap<httptable::NoCaseKey, std::string_view>({
+    {".html", "text/html"},
+    {".avi", "video/x-msvideo"},
+    {".gif", "image/gif"},
+    {".xhtml", "application/xhtml+xml"},
+    {".xml", "text/xml"},
+    {".txt", "text/plain"},
+    {".jpg", "image/jpeg"},
+    {".jpeg", "image/jpeg"},
+    {".au", "audio/basic"},
+    {".mpeg", "video/mpeg"},
+    {".rtf", "application/rtf"},
+    {".pdf", "application/pdf"},
+    {".mp4", "video/mp4"},
+    {".flv", "video/flv"},
+    {".word", "application/nsword"},
+    {".png", "image/png"},
+    {".mpg", "video/mpeg"},
+    {".tar", "application/x-tar"},
+    {".css", "text/css"},
+    {".js", "text/javascript"},
+    {".gz", "application/x-gzip"},
+    {".ico", "image/x-icon"},
+    {".svg", "image/svg+xml"},
+    {".json", "application/json"},
+    {".woff", "font/woff"},
+    {".woff2", "font/woff2"},
+    {".ttf", "font/ttf"},
+    {".otf", "font/otf"},
+    {".eot", "application/vnd.ms-fontobject"},
+});
+static_assert(SUFFIX_TYPE.Valid(), "no perfect hash seed for SUFFIX_TYPE");
+
+/**
+ * @brief 按文件后缀获取MIME类型, 未知后缀返回text/plain
+*/
+constexpr std::string_view LookupMimeType(std::string_view path) {
+    const size_t dot = path.find_last_of('.');
+    if (dot == std::string_view::npos || path.find('/', dot) != std::string_view::npos) {
+        return "text/plain";
+    }
+    return SUFFIX_TYPE.Get(path.substr(dot), "text/plain");
+}
+
+#endif
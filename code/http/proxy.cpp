@@ -0,0 +1,626 @@
+#include "proxy.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "httprequest.h"
+#include "tls.h"
+
+std::function<void(int fd)> ProxySession::unwatch_;
+
+namespace {
+
+const int MAX_TRIES = 2;    // 连接失败或复用连接失效时最多尝试的次数
+
+/**
+ * @brief 逐跳头部, 只对当前连接有效, 不转发
+*/
+bool IsHopByHop(std::string_view name) {
+    static const char* const NAMES[] = {"Proxy-Connection", "TE", "Trailer", "X-Forwarded-For"};
+    for (const char* hop : NAMES) {
+        if (httptable::NoCaseKey::Equal(name, hop)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Buffer::Append不接受空指针, 空的string_view直接跳过
+*/
+void AppendView(Buffer& buff, std::string_view str) {
+    if (!str.empty()) {
+        buff.Append(str.data(), str.size());
+    }
+}
+
+void AppendField(Buffer& buff, std::string_view name, std::string_view value) {
+    AppendView(buff, name);
+    buff.Append(": ", 2);
+    AppendView(buff, value);
+    buff.Append("\r\n", 2);
+}
+
+int HexValue(char ch) {
+    if (ch >= '0' && ch <= '9') {
+        return ch - '0';
+    }
+    ch = httptable::ToLower(ch);
+    return (ch >= 'a' && ch <= 'f') ? ch - 'a' + 10 : -1;
+}
+
+}  // namespace
+
+ProxySession::ProxySession(int clientFd, UpstreamGroup* group, TlsConn* tls)
+    : clientFd_(clientFd), group_(group), tls_(tls), status_(FAILED), phase_(CONNECT), watchedFd_(-1),
+      tries_(1), responded_(false), keepAlive_(false), headRequest_(false), idempotent_(false),
+      upstreamKeepAlive_(false), requestSent_(0), in_(4096), mode_(NO_BODY), remaining_(0),
+      piped_(0), chunkState_(CHUNK_SIZE), chunkLeft_(0) {
+    assert(group_);
+    pipe_[0] = pipe_[1] = -1;
+}
+
+ProxySession::~ProxySession() { Finish(); }
+
+/**
+ * @brief 请求行原样转发, 去掉逐跳头部, 追加X-Forwarded-For/X-Forwarded-Proto, 请求体按实际长度重新声明
+*/
+ProxySession::Status ProxySession::Start(const HttpRequest& request, const char* clientIp, bool keepAlive) {
+    keepAlive_ = keepAlive;
+    std::string_view method = request.method();
+    headRequest_ = method == "HEAD";
+    idempotent_ = method == "GET" || headRequest_ || method == "PUT" || method == "DELETE" || method == "OPTIONS";
+
+    AppendView(request_, method);
+    request_.Append(" ", 1);
+    AppendView(request_, request.path());
+    if (!request.query().empty()) {
+        request_.Append("?", 1);
+        AppendView(request_, request.query());
+    }
+    request_.Append(" HTTP/1.1\r\n");
+    for (auto& entry : HEADER_TABLE) {
+        switch (entry.value) {
+            case HttpHeader::CONNECTION:
+            case HttpHeader::KEEP_ALIVE:
+            case HttpHeader::UPGRADE:
+            case HttpHeader::HTTP2_SETTINGS:
+            case HttpHeader::TRANSFER_ENCODING:
+            case HttpHeader::CONTENT_LENGTH:
+            case HttpHeader::EXPECT:
+                continue;
+            default:
+                break;
+        }
+        std::string_view value = request.header(entry.value);
+        if (!value.empty()) {
+            AppendField(request_, entry.key, value);
+        }
+    }
+    if (request.header(HttpHeader::HOST).empty()) {
+        AppendField(request_, "Host", group_->name);
+    }
+    std::string_view forwarded;
+    for (auto& field : request.OtherHeaders()) {
+        if (httptable::NoCaseKey::Equal(field.first, "X-Forwarded-For")) {
+            forwarded = field.second;
+        } else if (!IsHopByHop(field.first)) {
+            AppendField(request_, field.first, field.second);
+        }
+    }
+    request_.Append("X-Forwarded-For: ");
+    if (!forwarded.empty()) {
+        AppendView(request_, forwarded);
+        request_.Append(", ", 2);
+    }
+    request_.Append(std::string(clientIp));
+    request_.Append(tls_ ? "\r\nX-Forwarded-Proto: https\r\n" : "\r\nX-Forwarded-Proto: http\r\n");
+    /* 请求体已按客户端的Content-Length完整取出, 原样转发; 带Transfer-Encoding的请求在解析前已被拒绝 */
+    std::string_view body = request.body();
+    if (!body.empty() || method == "POST" || method == "PUT" || method == "PATCH") {
+        request_.Append("Content-Length: " + std::to_string(body.size()) + "\r\n");
+    }
+    request_.Append("Connection: keep-alive\r\n\r\n");
+    AppendView(request_, body);
+
+    if (!UpstreamPool::Instance()->Acquire(group_, &conn_)) {
+        return status_ = Fail_("no upstream available");
+    }
+    phase_ = conn_.connecting ? CONNECT : SEND_REQUEST;
+    return Run_();
+}
+
+ProxySession::Status ProxySession::OnUpstream() { return Run_(); }
+
+ProxySession::Status ProxySession::OnClient() { return Run_(); }
+
+/**
+ * @brief 从当前阶段推进到需要等待某个fd为止
+*/
+ProxySession::Status ProxySession::Run_() {
+    switch (phase_) {
+        case CONNECT:
+            return status_ = Connect_();
+        case SEND_REQUEST:
+            return status_ = SendRequest_();
+        case READ_HEAD:
+            return status_ = ReadHead_();
+        case RELAY:
+            return status_ = Relay_();
+        default:
+            return status_;
+    }
+}
+
+/**
+ * @brief 非阻塞connect: 可写后检查SO_ERROR
+*/
+ProxySession::Status ProxySession::Connect_() {
+    struct pollfd pfd = {conn_.fd, POLLOUT, 0};
+    if (poll(&pfd, 1, 0) == 0) {
+        return WAIT_UPSTREAM_WRITE;
+    }
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if (getsockopt(conn_.fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0) {
+        LOG_WARN("upstream %s connect error: %d", conn_.server->name.c_str(), err);
+        UpstreamPool::Instance()->ReportFailure(conn_.server);
+        return Retry_() ? Run_() : Fail_("connect failed");
+    }
+    conn_.connecting = false;
+    phase_ = SEND_REQUEST;
+    return Run_();
+}
+
+ProxySession::Status ProxySession::SendRequest_() {
+    while (requestSent_ < request_.ReadableBytes()) {
+        ssize_t len = send(conn_.fd, request_.Peek() + requestSent_, request_.ReadableBytes() - requestSent_,
+                           MSG_NOSIGNAL);
+        if (len < 0) {
+            if (errno == EAGAIN) {
+                return WAIT_UPSTREAM_WRITE;
+            }
+            /* 复用的连接已被上游关闭 */
+            return Retry_() ? Run_() : Fail_("send request failed");
+        }
+        requestSent_ += len;
+    }
+    phase_ = READ_HEAD;
+    return Run_();
+}
+
+/**
+ * @brief 读取响应头, 跳过1xx临时响应, 101视为失败; 多读到的响应体数据转入待发送
+*/
+ProxySession::Status ProxySession::ReadHead_() {
+    while (true) {
+        std::string_view data = in_.View();
+        size_t end = data.find("\r\n\r\n");
+        if (end != std::string_view::npos) {
+            std::string_view head = data.substr(0, end + 2);
+            if (head.size() > 12 && head.substr(0, 7) == "HTTP/1." && head[9] == '1') {
+                /* 101之后不再是HTTP, 代理不支持协议切换 */
+                if (head.substr(9, 3) == "101") {
+                    return Fail_("unexpected 101 response");
+                }
+                in_.Retrieve(end + 4);
+                continue;
+            }
+            if (!ParseHead_(head)) {
+                return Fail_("bad response head");
+            }
+            in_.Retrieve(end + 4);
+            UpstreamPool::Instance()->ReportSuccess(conn_.server);
+
+            /* 响应头之后已经读到的数据 */
+            size_t extra = in_.ReadableBytes();
+            size_t used = 0;
+            if (mode_ == LENGTH) {
+                used = std::min<uint64_t>(extra, remaining_);
+                remaining_ -= used;
+            } else if (mode_ == CHUNKED) {
+                used = TrackChunks_(in_.Peek(), extra);
+            } else if (mode_ == UNTIL_CLOSE) {
+                used = extra;
+            }
+            out_.Append(in_.Peek(), used);
+            if (used < extra) {
+                upstreamKeepAlive_ = false;
+            }
+            in_.RetrieveAll();
+            phase_ = RELAY;
+            return Run_();
+        }
+        if (in_.ReadableBytes() > MAX_HEAD) {
+            return Fail_("response head too large");
+        }
+        int err = 0;
+        ssize_t len = in_.ReadFd(conn_.fd, &err);
+        if (len < 0 && err == EAGAIN) {
+            return WAIT_UPSTREAM_READ;
+        }
+        if (len <= 0) {
+            if (in_.ReadableBytes() == 0 && conn_.reused && idempotent_) {
+                /* 空闲连接在放回后被上游关闭, 换一个连接重发 */
+                return Retry_() ? Run_() : Fail_("upstream closed");
+            }
+            if (!conn_.reused) {
+                UpstreamPool::Instance()->ReportFailure(conn_.server);
+            }
+            return Fail_("upstream closed before response");
+        }
+    }
+}
+
+/**
+ * @brief 状态行统一为HTTP/1.1, 去掉上游的连接管理头部, 按客户端连接重新生成Connection
+*/
+bool ProxySession::ParseHead_(std::string_view head) {
+    size_t lineEnd = head.find("\r\n");
+    std::string_view line = head.substr(0, lineEnd);
+    if (line.size() < 12 || line.substr(0, 7) != "HTTP/1." || line[8] != ' ') {
+        return false;
+    }
+    int code = 0;
+    for (size_t i = 9; i < 12; i++) {
+        if (line[i] < '0' || line[i] > '9') {
+            return false;
+        }
+        code = code * 10 + (line[i] - '0');
+    }
+    upstreamKeepAlive_ = line[7] != '0';
+    out_.Append("HTTP/1.1");
+    out_.Append(line.substr(8));
+    out_.Append("\r\n", 2);
+
+    bool chunked = false, hasLength = false;
+    uint64_t length = 0;
+    head.remove_prefix(lineEnd + 2);
+    while (!head.empty()) {
+        lineEnd = head.find("\r\n");
+        line = head.substr(0, lineEnd);
+        head.remove_prefix(lineEnd + 2);
+        size_t colon = line.find(':');
+        if (colon == std::string_view::npos) {
+            continue;
+        }
+        std::string_view name = line.substr(0, colon);
+        std::string_view value = line.substr(colon + 1);
+        while (!value.empty() && (value.front() == ' ' || value.front() == '\t')) {
+            value.remove_prefix(1);
+        }
+        switch (LookupHeader(name)) {
+            case HttpHeader::CONNECTION:
+                if (httptable::ContainsToken(value, "close")) {
+                    upstreamKeepAlive_ = false;
+                } else if (httptable::ContainsToken(value, "keep-alive")) {
+                    upstreamKeepAlive_ = true;
+                }
+                continue;
+            case HttpHeader::KEEP_ALIVE:
+                continue;
+            case HttpHeader::TRANSFER_ENCODING:
+                chunked = httptable::ContainsToken(value, "chunked");
+                break;
+            case HttpHeader::CONTENT_LENGTH:
+                hasLength = !value.empty();
+                length = 0;
+                for (char ch : value) {
+                    if (ch < '0' || ch > '9') {
+                        return false;
+                    }
+                    length = length * 10 + (ch - '0');
+                }
+                break;
+            default:
+                if (httptable::NoCaseKey::Equal(name, "Proxy-Connection")) {
+                    continue;
+                }
+                break;
+        }
+        out_.Append(line);
+        out_.Append("\r\n", 2);
+    }
+
+    if (headRequest_ || code == 204 || code == 304) {
+        mode_ = NO_BODY;
+    } else if (chunked) {
+        mode_ = CHUNKED;
+    } else if (hasLength) {
+        mode_ = length > 0 ? LENGTH : NO_BODY;
+        remaining_ = length;
+    } else {
+        /* 没有长度的响应体以关闭连接结束, 客户端连接也只能关闭 */
+        mode_ = UNTIL_CLOSE;
+        upstreamKeepAlive_ = false;
+        keepAlive_ = false;
+    }
+    out_.Append(keepAlive_ ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n");
+    return true;
+}
+
+/**
+ * @brief 先发送缓冲中的数据, 再按响应体的类型转发
+*/
+ProxySession::Status ProxySession::Relay_() {
+    Status wait;
+    if (!FlushClient_(&wait)) {
+        return wait;
+    }
+    switch (mode_) {
+        case LENGTH:
+        case UNTIL_CLOSE:
+            /* OpenSSL加密的客户端连接不能splice, 经用户态中转 */
+            return tls_ && !tls_->KtlsSend() ? Copy_() : Splice_();
+        case CHUNKED:
+            return RelayChunked_();
+        default:
+            phase_ = FINISHED;
+            return DONE;
+    }
+}
+
+/**
+ * @brief 上游socket -> 管道 -> 客户端socket, 管道清空后才继续读上游,
+ * 所以从上游splice得到EAGAIN一定是上游没有数据
+*/
+ProxySession::Status ProxySession::Splice_() {
+    if (pipe_[0] < 0 && !UpstreamPool::Instance()->AcquirePipe(pipe_)) {
+        return Fail_("no pipe");
+    }
+    while (true) {
+        if (piped_ > 0) {
+            ssize_t len = splice(pipe_[0], nullptr, clientFd_, nullptr, piped_, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (len < 0) {
+                return errno == EAGAIN ? WAIT_CLIENT_WRITE : Fail_("client closed");
+            }
+            responded_ = true;
+            piped_ -= len;
+            continue;
+        }
+        if (mode_ == LENGTH && remaining_ == 0) {
+            break;
+        }
+        size_t want = mode_ == LENGTH ? std::min<uint64_t>(remaining_, SPLICE_CHUNK) : SPLICE_CHUNK;
+        ssize_t len = splice(conn_.fd, nullptr, pipe_[1], nullptr, want, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (len < 0) {
+            return errno == EAGAIN ? WAIT_UPSTREAM_READ : Fail_("upstream read error");
+        }
+        if (len == 0) {
+            if (mode_ == UNTIL_CLOSE) {
+                break;
+            }
+            return Fail_("upstream closed in body");
+        }
+        piped_ += len;
+        if (mode_ == LENGTH) {
+            remaining_ -= len;
+        }
+    }
+    phase_ = FINISHED;
+    return DONE;
+}
+
+/**
+ * @brief chunked响应体原样转发, 只跟踪分块边界以确定响应在哪里结束
+*/
+ProxySession::Status ProxySession::RelayChunked_() {
+    while (true) {
+        Status wait;
+        if (!FlushClient_(&wait)) {
+            return wait;
+        }
+        if (chunkState_ == CHUNK_END) {
+            phase_ = FINISHED;
+            return DONE;
+        }
+        int err = 0;
+        ssize_t len = out_.ReadFd(conn_.fd, &err);
+        if (len < 0) {
+            return err == EAGAIN ? WAIT_UPSTREAM_READ : Fail_("upstream read error");
+        }
+        if (len == 0) {
+            return Fail_("upstream closed in body");
+        }
+        /* 新读到的数据在尾块的剩余空间和一个新块中, 最多两段 */
+        size_t offset = out_.ReadableBytes() - len;
+        struct iovec iov[2];
+        int cnt = out_.PeekIov(iov, 2, offset);
+        for (int i = 0; i < cnt; i++) {
+            size_t used = TrackChunks_(static_cast<const char*>(iov[i].iov_base), iov[i].iov_len);
+            offset += used;
+            if (used < iov[i].iov_len) {
+                break;
+            }
+        }
+        Truncate_(offset);
+    }
+}
+
+/**
+ * @brief 与Splice_相同的转发, 数据经out_拷贝, 由FlushClient_加密发送
+*/
+ProxySession::Status ProxySession::Copy_() {
+    while (true) {
+        Status wait;
+        if (!FlushClient_(&wait)) {
+            return wait;
+        }
+        if (mode_ == LENGTH && remaining_ == 0) {
+            break;
+        }
+        int err = 0;
+        ssize_t len = out_.ReadFd(conn_.fd, &err);
+        if (len < 0) {
+            return err == EAGAIN ? WAIT_UPSTREAM_READ : Fail_("upstream read error");
+        }
+        if (len == 0) {
+            if (mode_ == UNTIL_CLOSE) {
+                break;
+            }
+            return Fail_("upstream closed in body");
+        }
+        if (mode_ == LENGTH) {
+            size_t used = std::min<uint64_t>(remaining_, len);
+            remaining_ -= used;
+            Truncate_(out_.ReadableBytes() - len + used);
+        }
+    }
+    phase_ = FINISHED;
+    return DONE;
+}
+
+/**
+ * @brief out_中只保留属于本次响应的前used字节; 多出的数据不转发, 连接也不再复用
+*/
+void ProxySession::Truncate_(size_t used) {
+    if (used == out_.ReadableBytes()) {
+        return;
+    }
+    out_.Truncate(used);
+    upstreamKeepAlive_ = false;
+}
+
+/**
+ * @brief 把out_写给客户端, 跨块的数据一次聚集写出
+ * @return 写完返回true; 否则wait为需要等待的事件或FAILED
+*/
+bool ProxySession::FlushClient_(Status* wait) {
+    while (out_.ReadableBytes() > 0) {
+        struct iovec iov[ChainBuffer::MAX_IOV];
+        int cnt = out_.PeekIov(iov, ChainBuffer::MAX_IOV);
+        ssize_t len;
+        if (tls_) {
+            len = tls_->Writev(iov, cnt);
+        } else {
+            struct msghdr msg = {};
+            msg.msg_iov = iov;
+            msg.msg_iovlen = cnt;
+            len = sendmsg(clientFd_, &msg, MSG_NOSIGNAL);
+        }
+        if (len < 0) {
+            *wait = errno == EAGAIN ? WAIT_CLIENT_WRITE : Fail_("client closed");
+            return false;
+        }
+        responded_ = true;
+        out_.Retrieve(len);
+    }
+    return true;
+}
+
+/**
+ * @brief 消费chunked数据直到响应结束(最后一个分块和trailer之后的空行)
+ * @return 属于本次响应的字节数
+*/
+size_t ProxySession::TrackChunks_(const char* data, size_t len) {
+    size_t i = 0;
+    while (i < len && chunkState_ != CHUNK_END) {
+        char ch = data[i];
+        switch (chunkState_) {
+            case CHUNK_SIZE:
+            case CHUNK_EXT:
+                i++;
+                if (ch == '\n') {
+                    chunkState_ = chunkLeft_ > 0 ? CHUNK_DATA : TRAILER_START;
+                } else if (chunkState_ == CHUNK_SIZE && HexValue(ch) >= 0 && chunkLeft_ < (1ull << 56)) {
+                    chunkLeft_ = chunkLeft_ * 16 + HexValue(ch);
+                } else {
+                    chunkState_ = CHUNK_EXT;
+                }
+                break;
+            case CHUNK_DATA: {
+                uint64_t take = std::min<uint64_t>(chunkLeft_, len - i);
+                i += take;
+                chunkLeft_ -= take;
+                if (chunkLeft_ == 0) {
+                    chunkState_ = CHUNK_DATA_END;
+                }
+                break;
+            }
+            case CHUNK_DATA_END:
+                i++;
+                if (ch == '\n') {
+                    chunkState_ = CHUNK_SIZE;
+                }
+                break;
+            case TRAILER_START:
+                i++;
+                chunkState_ = ch == '\n' ? CHUNK_END : ch == '\r' ? TRAILER_LF : TRAILER_LINE;
+                break;
+            case TRAILER_LINE:
+                i++;
+                if (ch == '\n') {
+                    chunkState_ = TRAILER_START;
+                }
+                break;
+            case TRAILER_LF:
+                i++;
+                chunkState_ = ch == '\n' ? CHUNK_END : TRAILER_LINE;
+                break;
+            default:
+                break;
+        }
+    }
+    return i;
+}
+
+/**
+ * @brief 换一个连接从头重发请求, 只在还没有读到任何响应数据时进行
+*/
+bool ProxySession::Retry_() {
+    if (tries_ >= MAX_TRIES || responded_ || in_.ReadableBytes() > 0) {
+        return false;
+    }
+    tries_++;
+    const UpstreamServer* failed = conn_.server;
+    ReleaseConn_(false);
+    requestSent_ = 0;
+    if (!UpstreamPool::Instance()->Acquire(group_, &conn_, failed)) {
+        return false;
+    }
+    phase_ = conn_.connecting ? CONNECT : SEND_REQUEST;
+    return true;
+}
+
+ProxySession::Status ProxySession::Fail_(const char* what) {
+    LOG_WARN("proxy %s: %s", group_->name.c_str(), what);
+    upstreamKeepAlive_ = false;
+    phase_ = FINISHED;
+    return FAILED;
+}
+
+/**
+ * @brief 先从Epoller注销再归还/关闭, 之后该fd号可能被其他连接复用
+*/
+void ProxySession::ReleaseConn_(bool reusable) {
+    if (conn_.fd < 0) {
+        return;
+    }
+    if (watchedFd_ == conn_.fd) {
+        if (unwatch_) {
+            unwatch_(conn_.fd);
+        }
+        watchedFd_ = -1;
+    }
+    UpstreamPool::Instance()->Release(&conn_, reusable);
+}
+
+void ProxySession::Finish() {
+    bool complete = status_ == DONE && piped_ == 0 && mode_ != UNTIL_CLOSE;
+    ReleaseConn_(complete && upstreamKeepAlive_);
+    if (pipe_[0] >= 0) {
+        if (piped_ == 0) {
+            UpstreamPool::Instance()->ReleasePipe(pipe_);
+        } else {
+            close(pipe_[0]);
+            close(pipe_[1]);
+            pipe_[0] = pipe_[1] = -1;
+        }
+    }
+}
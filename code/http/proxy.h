@@ -0,0 +1,154 @@
+#ifndef PROXY_H
+#define PROXY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <functional>
+#include <string_view>
+
+#include "../buffer/buffer.h"
+#include "../buffer/chainbuffer.h"
+#include "../pool/upstreampool.h"
+
+class HttpRequest;
+class TlsConn;
+
+/**
+ * @brief 一个请求的反向代理过程, 由HttpConn持有
+ * 请求改写后发往上游, 响应头改写后转发给客户端; 定长和读到关闭为止的响应体通过管道splice,
+ * 数据不经过用户态(客户端为TLS且未启用kTLS时经用户态拷贝后加密), chunked响应体边转发边跟踪分块以找到结尾.
+ * 每一步只推进到某个fd EAGAIN为止, 返回接下来要等待的事件, 由WebServer在同一个Epoller上注册,
+ * 任一时刻只等待一个fd, 同一会话不会被两个工作线程同时处理
+*/
+class ProxySession {
+public:
+    enum Status {
+        WAIT_UPSTREAM_READ,     // 等待上游可读
+        WAIT_UPSTREAM_WRITE,    // 等待上游可写(connect完成或请求未发送完)
+        WAIT_CLIENT_WRITE,      // 等待客户端可写
+        DONE,                   // 响应已完整转发
+        FAILED,                 // 出错, Responded()为false时可以改为返回502
+    };
+
+    /**
+     * @param tls 客户端连接的TLS状态, 为空时为明文
+    */
+    ProxySession(int clientFd, UpstreamGroup* group, TlsConn* tls = nullptr);
+    ~ProxySession();
+
+    ProxySession(const ProxySession&) = delete;
+    ProxySession& operator=(const ProxySession&) = delete;
+
+    /**
+     * @brief 改写请求并开始转发
+     * @param clientIp 追加到X-Forwarded-For
+     * @param keepAlive 客户端连接在响应后是否保持
+    */
+    Status Start(const HttpRequest& request, const char* clientIp, bool keepAlive);
+
+    Status OnUpstream();
+    Status OnClient();
+    Status GetStatus() const { return status_; }
+
+    int UpstreamFd() const { return conn_.fd; }
+
+    /**
+     * @brief 已注册到Epoller的上游fd, 由WebServer维护; 换连接或结束时通过unwatch回调先注销
+    */
+    int WatchedFd() const { return watchedFd_; }
+    void SetWatchedFd(int fd) { watchedFd_ = fd; }
+    static void SetUnwatch(const std::function<void(int fd)>& unwatch) { unwatch_ = unwatch; }
+
+    /**
+     * @brief 是否已向客户端发送了响应的任何部分
+    */
+    bool Responded() const { return responded_; }
+
+    /**
+     * @brief 响应完成后客户端连接能否继续使用(读到关闭为止的响应体只能关闭连接)
+    */
+    bool IsKeepAlive() const { return keepAlive_; }
+
+    /**
+     * @brief 结束会话: 完整读完响应的上游连接放回连接池, 否则关闭
+    */
+    void Finish();
+
+    static constexpr size_t MAX_HEAD = 16 * 1024;       // 上游响应头上限
+    static constexpr size_t SPLICE_CHUNK = 64 * 1024;   // 单次splice的字节数, 与管道容量一致
+
+private:
+    enum Phase {
+        CONNECT,        // 等待非阻塞connect完成
+        SEND_REQUEST,   // 发送请求
+        READ_HEAD,      // 读取响应头
+        RELAY,          // 转发响应头之后的数据
+        FINISHED,
+    };
+
+    enum BodyMode {
+        NO_BODY,
+        LENGTH,         // Content-Length
+        CHUNKED,        // Transfer-Encoding: chunked
+        UNTIL_CLOSE,    // 读到上游关闭为止
+    };
+
+    Status Run_();
+    Status Connect_();
+    Status SendRequest_();
+    Status ReadHead_();
+    Status Relay_();
+    Status Splice_();
+    Status RelayChunked_();
+    Status Copy_();
+    void Truncate_(size_t used);
+    Status Fail_(const char* what);
+    bool Retry_();
+    void ReleaseConn_(bool reusable);
+    bool ParseHead_(std::string_view head);
+    bool FlushClient_(Status* wait);
+    size_t TrackChunks_(const char* data, size_t len);
+
+    int clientFd_;
+    UpstreamGroup* group_;
+    TlsConn* tls_;              // 由HttpConn持有
+    UpstreamConn conn_;
+    Status status_;
+    Phase phase_;
+    int watchedFd_;
+    int tries_;                 // 已尝试的上游连接数
+    bool responded_;            // 已向客户端写出数据
+    bool keepAlive_;            // 客户端连接保持
+    bool headRequest_;          // HEAD请求, 响应没有响应体
+    bool idempotent_;           // 失效的复用连接上可以重试
+    bool upstreamKeepAlive_;    // 上游连接可以复用
+
+    Buffer request_;            // 改写后的请求, 重试时从头发送
+    size_t requestSent_;
+    Buffer in_;                 // 从上游读到的响应头和chunked数据
+    ChainBuffer out_;           // 待发往客户端的数据(改写后的响应头, 多读到的响应体), 池化的块链
+
+    BodyMode mode_;
+    uint64_t remaining_;        // LENGTH: 还要从上游读取的字节数
+    int pipe_[2];               // splice用的管道
+    size_t piped_;              // 管道中还未写给客户端的字节数
+
+    /* chunked分块跟踪 */
+    enum ChunkState {
+        CHUNK_SIZE,             // 分块大小行
+        CHUNK_EXT,              // 大小之后的扩展, 直到LF
+        CHUNK_DATA,
+        CHUNK_DATA_END,         // 分块数据之后的CRLF
+        TRAILER_START,          // 最后一个分块之后: 行首
+        TRAILER_LINE,           // 跳过一行trailer
+        TRAILER_LF,             // 空行的LF
+        CHUNK_END,
+    };
+    ChunkState chunkState_;
+    uint64_t chunkLeft_;
+
+    static std::function<void(int fd)> unwatch_;
+};
+
+#endif
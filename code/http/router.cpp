@@ -0,0 +1,306 @@
+#include "router.h"
+
+#include <algorithm>
+
+#include "../log/log.h"
+#include "httptable.h"
+
+namespace {
+
+constexpr auto METHOD_TABLE = httptable::MakeStaticMap<httptable::ExactKey, Router::METHOD>({
+    {"GET", Router::GET},
+    {"HEAD", Router::HEAD},
+    {"POST", Router::POST},
+    {"PUT", Router::PUT},
+    {"DELETE", Router::DELETE},
+    {"OPTIONS", Router::OPTIONS},
+    {"PATCH", Router::PATCH},
+    {"*", Router::ANY},
+});
+static_assert(METHOD_TABLE.Valid(), "no perfect hash seed for METHOD_TABLE");
+
+size_t CommonPrefix(std::string_view a, std::string_view b) {
+    size_t i = 0;
+    while (i < a.size() && i < b.size() && a[i] == b[i]) {
+        i++;
+    }
+    return i;
+}
+
+}  // namespace
+
+/**
+ * @brief 路由树节点
+ * 静态子节点按首字符区分, 参数子节点和前缀子节点各至多一个
+*/
+struct Router::Node {
+    Node() { handlers.fill(-1); }
+
+    Node* FindChild(char ch) const {
+        for (auto& child : children) {
+            if (child->prefix[0] == ch) {
+                return child.get();
+            }
+        }
+        return nullptr;
+    }
+
+    std::string prefix;                           // 静态节点的边标签
+    std::string name;                             // 参数/前缀节点的参数名
+    std::vector<std::unique_ptr<Node>> children;  // 静态子节点
+    std::unique_ptr<Node> param;                  // :name 子节点, 匹配到下一个'/'
+    std::unique_ptr<Node> catchAll;               // *name 子节点, 匹配剩余全部
+    std::array<int, METHOD_COUNT> handlers;       // 各方法的处理函数下标, -1表示无
+};
+
+/**
+ * @brief 获取路径参数
+*/
+std::string_view RouteParams::Get(std::string_view name) const {
+    for (size_t i = 0; i < size_; i++) {
+        if (items_[i].first == name) {
+            return items_[i].second;
+        }
+    }
+    return std::string_view();
+}
+
+/**
+ * @brief 添加路径参数
+*/
+void RouteParams::Push(std::string_view name, std::string_view value) {
+    assert(size_ < MAX_PARAMS);
+    items_[size_++] = {name, value};
+}
+
+Router::Router() : root_(new Node()), frozen_(false) {}
+
+Router::~Router() = default;
+
+/**
+ * @brief 方法名转枚举
+*/
+Router::METHOD Router::ParseMethod(std::string_view method) {
+    return METHOD_TABLE.Get(method, UNKNOWN_METHOD);
+}
+
+/**
+ * @brief 注册路由
+*/
+void Router::Add(std::string_view method, std::string_view pattern, const Handler& handler) {
+    assert(!frozen_);
+    assert(!pattern.empty() && pattern[0] == '/');
+    assert(handler);
+    METHOD m = ParseMethod(method);
+    assert(m != UNKNOWN_METHOD);
+    Node* node = Insert_(pattern);
+    if (!node) {
+        LOG_ERROR("Route %.*s %.*s conflicts with an existing route: a static and a parameter segment at the "
+                  "same position, ignored", (int)method.size(), method.data(), (int)pattern.size(), pattern.data());
+        return;
+    }
+    if (node->handlers[m] != -1) {
+        LOG_WARN("Route %.*s %.*s registered twice, the latter wins", (int)method.size(), method.data(),
+                 (int)pattern.size(), pattern.data());
+    }
+    node->handlers[m] = handlers_.size();
+    handlers_.push_back(handler);
+}
+
+/**
+ * @brief 插入模式串, 返回模式串末尾对应的节点; 同一节点会同时有静态子节点和参数子节点时返回nullptr.
+ * 冲突在修改节点之前检出, 之前经过的节点分裂不改变已有路由的匹配结果
+*/
+Router::Node* Router::Insert_(std::string_view pattern) {
+    Node* node = root_.get();
+    while (!pattern.empty()) {
+        if (pattern[0] == ':') {
+            /* 参数段: 到下一个'/'为止 */
+            size_t end = pattern.find('/');
+            if (end == std::string_view::npos) {
+                end = pattern.size();
+            }
+            std::string_view name = pattern.substr(1, end - 1);
+            assert(!name.empty());
+            if (!node->param && !node->children.empty()) {
+                return nullptr;
+            }
+            if (!node->param) {
+                node->param.reset(new Node());
+                node->param->name.assign(name.data(), name.size());
+            }
+            assert(node->param->name == name);  // 同一位置的参数名必须一致
+            node = node->param.get();
+            pattern.remove_prefix(end);
+        } else if (pattern[0] == '*') {
+            /* 前缀段: 必须位于模式串末尾 */
+            std::string_view name = pattern.substr(1);
+            assert(name.find('/') == std::string_view::npos);
+            if (!node->catchAll) {
+                node->catchAll.reset(new Node());
+                node->catchAll->name.assign(name.data(), name.size());
+            }
+            assert(node->catchAll->name == name);
+            return node->catchAll.get();
+        } else {
+            /* 静态段: 与已有子节点共享最长公共前缀, 必要时分裂节点 */
+            std::string_view text = pattern.substr(0, pattern.find_first_of(":*"));
+            if (node->param) {
+                return nullptr;
+            }
+            Node* child = node->FindChild(text[0]);
+            if (!child) {
+                node->children.emplace_back(new Node());
+                child = node->children.back().get();
+                child->prefix.assign(text.data(), text.size());
+                node = child;
+                pattern.remove_prefix(text.size());
+                continue;
+            }
+            size_t common = CommonPrefix(child->prefix, text);
+            if (common < child->prefix.size()) {
+                std::unique_ptr<Node> split(new Node());
+                split->prefix = child->prefix.substr(0, common);
+                for (auto& slot : node->children) {
+                    if (slot.get() == child) {
+                        slot.swap(split);  // slot 指向新的中间节点, split 持有原子节点
+                        child->prefix.erase(0, common);
+                        slot->children.push_back(std::move(split));
+                        child = slot.get();
+                        break;
+                    }
+                }
+            }
+            node = child;
+            pattern.remove_prefix(common);
+        }
+    }
+    return node;
+}
+
+/**
+ * @brief 取节点上对应方法的处理函数, HEAD没有注册时退化为GET
+*/
+const Router::Handler* Router::NodeHandler_(const Node* node, METHOD method) const {
+    int idx = node->handlers[method];
+    if (idx == -1 && method == HEAD) {
+        idx = node->handlers[GET];
+    }
+    if (idx == -1) {
+        idx = node->handlers[ANY];
+    }
+    return idx == -1 ? nullptr : &handlers_[idx];
+}
+
+/**
+ * @brief 节点上注册了处理函数的方法集合, 注册了任意方法时为全部方法; 有GET时HEAD也可用
+*/
+unsigned Router::NodeMethods_(const Node* node) {
+    if (node->handlers[ANY] != -1) {
+        return (1u << ANY) - 1;
+    }
+    unsigned methods = 0;
+    for (int m = 0; m < ANY; m++) {
+        if (node->handlers[m] != -1) {
+            methods |= 1u << m;
+        }
+    }
+    if (methods & (1u << GET)) {
+        methods |= 1u << HEAD;
+    }
+    return methods;
+}
+
+/**
+ * @brief 方法集合转为Allow头的值
+*/
+std::string Router::AllowList(unsigned allowed) {
+    static const char* const NAMES[ANY] = {"GET", "HEAD", "POST", "PUT", "DELETE", "OPTIONS", "PATCH"};
+    std::string list;
+    for (int m = 0; m < ANY; m++) {
+        if (allowed & (1u << m)) {
+            if (!list.empty()) {
+                list += ", ";
+            }
+            list += NAMES[m];
+        }
+    }
+    return list;
+}
+
+/**
+ * @brief 单趟匹配, 不回溯: 注册时保证同一节点不会同时有静态子节点和参数子节点, 每一步至多一条路可走,
+ * 路径中的每个字符只比较一次. 沿途记下最深的、注册了该方法的前缀路由, 精确路径不存在或方法不匹配时退回到它,
+ * 优先级仍为 静态 > 参数 > 前缀.
+ * 前缀路由只对它注册过的方法算作路径存在, 否则只注册了GET的静态文件前缀路由会让任何路径的其他方法都变成405
+*/
+Router::MATCH_RESULT Router::Find(std::string_view method, std::string_view path,
+                                  const Handler** handler, RouteParams* params, unsigned* allowed) const {
+    assert(handler && params);
+    *handler = nullptr;
+    params->Clear();
+    if (allowed) {
+        *allowed = 0;
+    }
+    METHOD m = ParseMethod(method);
+    if (m == ANY) {
+        m = UNKNOWN_METHOD;
+    }
+    if (path.empty()) {
+        return NOT_FOUND;
+    }
+    const Node* node = root_.get();
+    const Node* fallback = nullptr;     // 最深的可用前缀路由
+    std::string_view fallbackPath;      // 它匹配的剩余路径
+    size_t fallbackParams = 0;          // 到达它时已有的参数个数
+    while (node) {
+        if (node->catchAll && m != UNKNOWN_METHOD && NodeHandler_(node->catchAll.get(), m)) {
+            fallback = node->catchAll.get();
+            fallbackPath = path;
+            fallbackParams = params->size();
+        }
+        if (path.empty()) {
+            break;
+        }
+        if (const Node* child = node->FindChild(path[0])) {
+            if (path.compare(0, child->prefix.size(), child->prefix) != 0) {
+                node = nullptr;
+                break;
+            }
+            path.remove_prefix(child->prefix.size());
+            node = child;
+        } else if (node->param && path[0] != '/') {
+            /* 参数段匹配到下一个'/'为止, 不能为空 */
+            std::string_view value = path.substr(0, path.find('/'));
+            params->Push(node->param->name, value);
+            path.remove_prefix(value.size());
+            node = node->param.get();
+        } else {
+            node = nullptr;
+        }
+    }
+
+    bool pathFound = false;
+    if (node) {
+        if (m != UNKNOWN_METHOD && (*handler = NodeHandler_(node, m))) {
+            return MATCHED;
+        }
+        unsigned methods = NodeMethods_(node);
+        pathFound = methods != 0;
+        if (allowed) {
+            *allowed = methods;
+        }
+    }
+    if (fallback) {
+        while (params->size() > fallbackParams) {
+            params->Pop();
+        }
+        params->Push(fallback->name, fallbackPath);
+        *handler = NodeHandler_(fallback, m);
+        if (allowed) {
+            *allowed = 0;
+        }
+        return MATCHED;
+    }
+    return pathFound ? NOT_ALLOWED : NOT_FOUND;
+}
@@ -0,0 +1,116 @@
+#ifndef ROUTER_H
+#define ROUTER_H
+
+#include <assert.h>
+
+#include <array>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+class HttpRequest;
+class HttpResponse;
+
+/**
+ * @brief 路由匹配得到的路径参数(:name 与 *name)
+*/
+class RouteParams {
+public:
+    RouteParams() : size_(0) {}
+
+    /**
+     * @brief 获取参数值, 不存在时返回空串
+    */
+    std::string_view Get(std::string_view name) const;
+
+    void Push(std::string_view name, std::string_view value);
+    void Pop() { assert(size_ > 0); size_--; }
+    void Clear() { size_ = 0; }
+    size_t size() const { return size_; }
+
+    static const size_t MAX_PARAMS = 8; // 单条路由的最大参数个数
+
+private:
+    std::array<std::pair<std::string_view, std::string_view>, MAX_PARAMS> items_;
+    size_t size_;
+};
+
+/**
+ * @brief 压缩前缀树(radix tree)路由
+ * 支持静态路由(/login), 参数路由(/user/:id)和前缀路由(以 *file 结尾, 匹配剩余路径),
+ * 启动时注册, Freeze之后只读, 工作线程可以并发查找.
+ * 同一位置不能既有静态段又有参数段(如 /user/new 与 /user/:id), 后注册的冲突路由被拒绝,
+ * 这样查找时每个位置至多一条路可走, 不需要回溯
+*/
+class Router {
+public:
+    typedef std::function<void(HttpRequest& req, HttpResponse& resp)> Handler;
+
+    enum METHOD {
+        GET = 0,
+        HEAD,
+        POST,
+        PUT,
+        DELETE,
+        OPTIONS,
+        PATCH,
+        ANY,            // 匹配任意方法, 仅用于注册
+        METHOD_COUNT,
+        UNKNOWN_METHOD = METHOD_COUNT,
+    };
+
+    enum MATCH_RESULT {
+        MATCHED = 0,    // 找到处理函数
+        NOT_FOUND,      // 路径不存在
+        NOT_ALLOWED,    // 路径存在但方法不匹配
+    };
+
+    Router();
+    ~Router();
+
+    /**
+     * @brief 注册路由, method为"GET"/"POST"等, "*"表示任意方法
+     * 与已有路由在同一位置出现静态段和参数段的冲突时记录错误并忽略该路由
+    */
+    void Add(std::string_view method, std::string_view pattern, const Handler& handler);
+    void Get(std::string_view pattern, const Handler& handler) { Add("GET", pattern, handler); }
+    void Post(std::string_view pattern, const Handler& handler) { Add("POST", pattern, handler); }
+
+    /**
+     * @brief 冻结路由表, 之后不允许再注册
+    */
+    void Freeze() { frozen_ = true; }
+    bool IsFrozen() const { return frozen_; }
+
+    /**
+     * @brief 查找路由, 单趟匹配, 复杂度与路径长度成正比
+     * @param handler 匹配成功时指向处理函数
+     * @param params 匹配到的路径参数, 指向请求本身的数据
+     * @param allowed 不为空时, 返回NOT_ALLOWED的同时填入该路径支持的方法(按METHOD的位), 用于Allow头
+    */
+    MATCH_RESULT Find(std::string_view method, std::string_view path, const Handler** handler,
+                      RouteParams* params, unsigned* allowed = nullptr) const;
+
+    static METHOD ParseMethod(std::string_view method);
+
+    /**
+     * @brief 把Find得到的方法集合写成Allow头的值, 如"GET, HEAD, POST"
+    */
+    static std::string AllowList(unsigned allowed);
+
+private:
+    struct Node;
+
+    Node* Insert_(std::string_view pattern);
+    const Handler* NodeHandler_(const Node* node, METHOD method) const;
+    static unsigned NodeMethods_(const Node* node);
+
+    std::unique_ptr<Node> root_;    // 根节点, 前缀为空
+    std::vector<Handler> handlers_; // 所有处理函数, 节点中保存下标
+    bool frozen_;                   // 是否已冻结
+};
+
+#endif
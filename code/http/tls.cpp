@@ -0,0 +1,235 @@
+#include "tls.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include <openssl/err.h>
+
+#include "../log/log.h"
+
+TlsContext* TlsContext::Instance() {
+    static TlsContext context;
+    return &context;
+}
+
+TlsContext::~TlsContext() {
+    if (ctx_) {
+        SSL_CTX_free(ctx_);
+    }
+}
+
+/**
+ * @brief 至少TLS1.2; 票据密钥由OpenSSL生成并轮换, 服务端缓存按会话ID恢复不支持票据的客户端
+*/
+bool TlsContext::Init(const char* certFile, const char* keyFile, bool http2) {
+    assert(certFile && keyFile);
+    SSL_CTX* ctx = SSL_CTX_new(TLS_server_method());
+    if (!ctx) {
+        LOG_ERROR("SSL_CTX_new error: %s", ERR_error_string(ERR_get_error(), nullptr));
+        return false;
+    }
+    if (SSL_CTX_use_certificate_chain_file(ctx, certFile) != 1 ||
+        SSL_CTX_use_PrivateKey_file(ctx, keyFile, SSL_FILETYPE_PEM) != 1 || SSL_CTX_check_private_key(ctx) != 1) {
+        LOG_ERROR("tls cert %s key %s error: %s", certFile, keyFile, ERR_error_string(ERR_get_error(), nullptr));
+        SSL_CTX_free(ctx);
+        return false;
+    }
+    SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+    /* 客户端不发close_notify直接断开按正常关闭处理 */
+    SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS | SSL_OP_NO_RENEGOTIATION | SSL_OP_CIPHER_SERVER_PREFERENCE |
+                                 SSL_OP_IGNORE_UNEXPECTED_EOF);
+    /* 写入可以部分完成, 重试时缓冲区地址可以变化; 空闲连接释放读写缓冲区 */
+    SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER |
+                              SSL_MODE_RELEASE_BUFFERS);
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+    SSL_CTX_set_session_id_context(ctx, reinterpret_cast<const unsigned char*>("webserver"), 9);
+    SSL_CTX_sess_set_cache_size(ctx, SESSION_CACHE_SIZE);
+    SSL_CTX_set_timeout(ctx, SESSION_TIMEOUT);
+    SSL_CTX_set_alpn_select_cb(ctx, SelectAlpn_, nullptr);
+    if (ctx_) {
+        SSL_CTX_free(ctx_);
+    }
+    ctx_ = ctx;
+    http2_ = http2;
+    LOG_INFO("tls enabled, cert: %s", certFile);
+    return true;
+}
+
+/**
+ * @brief ALPN: 优先h2(客户端随后直接发送HTTP/2前言), 其次http/1.1; 都不支持时不协商, 按HTTP/1处理
+*/
+int TlsContext::SelectAlpn_(SSL* ssl, const unsigned char** out, unsigned char* outlen, const unsigned char* in,
+                            unsigned int inlen, void* arg) {
+    static const unsigned char protos[] = "\x02h2\x08http/1.1";
+    /* 不提供h2时跳过列表中的第一项 */
+    const unsigned char* offer = Instance()->http2_ ? protos : protos + 3;
+    unsigned int offerLen = sizeof(protos) - 1 - (offer - protos);
+    unsigned char* selected = nullptr;
+    if (SSL_select_next_proto(&selected, outlen, offer, offerLen, in, inlen) != OPENSSL_NPN_NEGOTIATED) {
+        return SSL_TLSEXT_ERR_NOACK;
+    }
+    *out = selected;
+    return SSL_TLSEXT_ERR_OK;
+}
+
+TlsConn::TlsConn(int fd) : ssl_(nullptr), established_(false), wantWrite_(false), ktlsSend_(false) {
+    assert(TlsContext::Instance()->Enabled());
+    ssl_ = SSL_new(TlsContext::Instance()->Get());
+    if (ssl_) {
+        SSL_set_fd(ssl_, fd);
+        SSL_set_accept_state(ssl_);
+    } else {
+        LOG_ERROR("SSL_new error: %s", ERR_error_string(ERR_get_error(), nullptr));
+    }
+}
+
+TlsConn::~TlsConn() {
+    if (ssl_) {
+        SSL_free(ssl_);
+    }
+}
+
+/**
+ * @brief 握手完成后检查OpenSSL是否把发送方向交给了内核(需要内核tls模块和支持的加密套件)
+*/
+bool TlsConn::Handshake() {
+    if (established_) {
+        return true;
+    }
+    if (!ssl_) {
+        errno = ENOMEM;
+        return false;
+    }
+    wantWrite_ = false;
+    int ret = SSL_do_handshake(ssl_);
+    if (ret != 1) {
+        if (Fail_(SSL_get_error(ssl_, ret)) == 0) {
+            errno = ECONNRESET;
+        }
+        return false;
+    }
+    established_ = true;
+    ktlsSend_ = BIO_get_ktls_send(SSL_get_wbio(ssl_));
+    LOG_DEBUG("tls[%d] %s %s%s%s", SSL_get_fd(ssl_), SSL_get_version(ssl_), SSL_get_cipher_name(ssl_),
+              SSL_session_reused(ssl_) ? " resumed" : "", ktlsSend_ ? " ktls" : "");
+    return true;
+}
+
+ssize_t TlsConn::Read(Buffer& buff, int* saveErrno) {
+    assert(saveErrno);
+    if (!Handshake()) {
+        *saveErrno = errno;
+        return -1;
+    }
+    ssize_t total = 0;
+    while (true) {
+        buff.EnsureWriteable(RECORD_SIZE);
+        size_t len = 0;
+        int ret = SSL_read_ex(ssl_, buff.BeginWrite(), buff.WritableBytes(), &len);
+        if (ret == 1) {
+            buff.HasWritten(len);
+            total += len;
+            continue;
+        }
+        /* 出错时先返回已读到的数据, 错误会在下次读取时再次出现 */
+        ssize_t err = Fail_(SSL_get_error(ssl_, ret));
+        if (total > 0) {
+            return total;
+        }
+        if (err < 0) {
+            *saveErrno = errno;
+        }
+        return err;
+    }
+}
+
+/**
+ * @brief 未启用kTLS时, 小的iovec拷贝合并成一个记录再加密, 避免响应头等小块各占一个记录;
+ * 不小于一个记录的数据直接交给SSL_write. 重试时从同一位置重新合并, 满足OpenSSL对重试参数的要求
+*/
+ssize_t TlsConn::Writev(const struct iovec* iov, int iovcnt) {
+    if (ktlsSend_) {
+        return writev(SSL_get_fd(ssl_), iov, iovcnt);
+    }
+    if (!established_) {
+        errno = EAGAIN;
+        return -1;
+    }
+    thread_local char record[RECORD_SIZE];
+    ssize_t total = 0;
+    int idx = 0;
+    size_t offset = 0;
+    while (idx < iovcnt) {
+        const char* data = static_cast<const char*>(iov[idx].iov_base) + offset;
+        size_t len = iov[idx].iov_len - offset;
+        if (len < RECORD_SIZE) {
+            len = 0;
+            for (int i = idx; i < iovcnt && len < RECORD_SIZE; i++) {
+                size_t skip = i == idx ? offset : 0;
+                size_t n = std::min(iov[i].iov_len - skip, RECORD_SIZE - len);
+                memcpy(record + len, static_cast<const char*>(iov[i].iov_base) + skip, n);
+                len += n;
+            }
+            data = record;
+        }
+        if (len == 0) {
+            idx++;
+            offset = 0;
+            continue;
+        }
+        size_t written = 0;
+        int ret = SSL_write_ex(ssl_, data, len, &written);
+        if (ret != 1) {
+            if (Fail_(SSL_get_error(ssl_, ret)) == 0) {
+                errno = EPIPE;
+            }
+            return total > 0 ? total : -1;
+        }
+        total += written;
+        /* 跳过已发送的数据 */
+        while (idx < iovcnt && written >= iov[idx].iov_len - offset) {
+            written -= iov[idx].iov_len - offset;
+            offset = 0;
+            idx++;
+        }
+        offset += written;
+    }
+    return total;
+}
+
+void TlsConn::Shutdown() {
+    if (ssl_ && established_) {
+        SSL_shutdown(ssl_);
+        ERR_clear_error();
+    }
+}
+
+/**
+ * @brief SSL错误转换为read/write的约定: 等待读写返回-1且errno为EAGAIN, 对端关闭返回0, 其他错误返回-1
+*/
+ssize_t TlsConn::Fail_(int err) {
+    switch (err) {
+        case SSL_ERROR_WANT_WRITE:
+            wantWrite_ = true;
+            /* fall through */
+        case SSL_ERROR_WANT_READ:
+            errno = EAGAIN;
+            return -1;
+        case SSL_ERROR_ZERO_RETURN:
+            return 0;
+        case SSL_ERROR_SYSCALL:
+            ERR_clear_error();
+            if (errno == 0 || errno == EAGAIN) {
+                errno = ECONNRESET;
+            }
+            return -1;
+        default:
+            LOG_DEBUG("tls[%d] error: %s", SSL_get_fd(ssl_), ERR_error_string(ERR_peek_error(), nullptr));
+            ERR_clear_error();
+            errno = EPROTO;
+            return -1;
+    }
+}
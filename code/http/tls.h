@@ -0,0 +1,102 @@
+#ifndef TLS_H
+#define TLS_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include <openssl/ssl.h>
+
+#include "../buffer/buffer.h"
+
+/**
+ * @brief 监听socket的TLS配置, 全局唯一的SSL_CTX
+ * 会话恢复同时支持服务端会话缓存(TLS1.2会话ID)和会话票据(OpenSSL自动轮换票据密钥);
+ * 开启kTLS后握手完成的连接由内核加解密, 明文的writev/splice直接可用
+*/
+class TlsContext {
+public:
+    static TlsContext* Instance();
+
+    /**
+     * @brief 加载证书链和私钥, 必须在服务启动前调用
+     * @param http2 ALPN是否提供h2; 代理路由只支持HTTP/1, 使用代理时应关闭
+     * @return 证书或私钥无效时返回false, 监听socket保持明文
+    */
+    bool Init(const char* certFile, const char* keyFile, bool http2 = true);
+
+    bool Enabled() const { return ctx_ != nullptr; }
+    SSL_CTX* Get() const { return ctx_; }
+
+    static constexpr long SESSION_TIMEOUT = 3600;       // 会话缓存和票据的有效期(秒)
+    static constexpr long SESSION_CACHE_SIZE = 20480;   // 服务端会话缓存的条目数
+
+private:
+    TlsContext() : ctx_(nullptr), http2_(true) {}
+    ~TlsContext();
+
+    static int SelectAlpn_(SSL* ssl, const unsigned char** out, unsigned char* outlen,
+                           const unsigned char* in, unsigned int inlen, void* arg);
+
+    SSL_CTX* ctx_;
+    bool http2_;
+};
+
+/**
+ * @brief 一个连接上的TLS状态, 由HttpConn持有, 同一时刻只被一个工作线程使用
+ * 非阻塞握手在读事件中推进; 读写接口与read/writev的返回值和errno约定一致,
+ * 调用者不必区分明文和TLS. 发送方向启用了kTLS时writev直接写socket, 文件缓存的数据不经过拷贝
+*/
+class TlsConn {
+public:
+    explicit TlsConn(int fd);
+    ~TlsConn();
+
+    TlsConn(const TlsConn&) = delete;
+    TlsConn& operator=(const TlsConn&) = delete;
+
+    /**
+     * @brief 推进握手
+     * @return 握手完成返回true; 否则errno为EAGAIN(等待读写, WantWrite区分)或其他错误
+    */
+    bool Handshake();
+    bool Established() const { return established_; }
+
+    /**
+     * @brief 握手因socket发送缓冲区满而暂停, 需要等待可写事件
+    */
+    bool WantWrite() const { return wantWrite_; }
+
+    /**
+     * @brief 解密读到的数据追加到buff, 直到socket没有数据为止(TLS记录可能已缓存在SSL中, 不能依赖下次可读事件)
+     * @return 读到的字节数; 对端关闭返回0; 出错返回-1, saveErrno为EAGAIN时表示暂时没有数据
+    */
+    ssize_t Read(Buffer& buff, int* saveErrno);
+
+    /**
+     * @brief 加密发送, 返回值与writev相同; 出错返回-1并设置errno
+    */
+    ssize_t Writev(const struct iovec* iov, int iovcnt);
+
+    /**
+     * @brief 发送方向是否由内核加密, 为true时可以直接对socket使用writev和splice
+    */
+    bool KtlsSend() const { return ktlsSend_; }
+
+    /**
+     * @brief 发送close_notify, 不等待对端回复
+    */
+    void Shutdown();
+
+    static constexpr size_t RECORD_SIZE = 16 * 1024;    // TLS记录的最大明文长度
+
+private:
+    ssize_t Fail_(int err);
+
+    SSL* ssl_;
+    bool established_;
+    bool wantWrite_;
+    bool ktlsSend_;
+};
+
+#endif
@@ -0,0 +1,533 @@
+#include "websocket.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "../log/log.h"
+#include "httprequest.h"
+#include "tls.h"
+
+namespace {
+
+const char WS_GUID[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+const size_t MAX_CONTROL_PAYLOAD = 125;
+const size_t SHRINK_SIZE = 4096;    // 拼接缓冲超过该容量时在消息结束后释放
+
+inline uint32_t Rotl(uint32_t x, int n) { return (x << n) | (x >> (32 - n)); }
+
+/**
+ * @brief SHA-1(RFC 3174), 只用于计算Sec-WebSocket-Accept
+*/
+void Sha1(std::string_view data, uint8_t digest[20]) {
+    uint32_t h[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+    std::string msg(data);
+    uint64_t bits = static_cast<uint64_t>(data.size()) * 8;
+    msg.push_back(static_cast<char>(0x80));
+    while (msg.size() % 64 != 56) {
+        msg.push_back(0);
+    }
+    for (int i = 7; i >= 0; i--) {
+        msg.push_back(static_cast<char>(bits >> (i * 8)));
+    }
+    for (size_t block = 0; block < msg.size(); block += 64) {
+        uint32_t w[80];
+        for (int i = 0; i < 16; i++) {
+            const uint8_t* p = reinterpret_cast<const uint8_t*>(msg.data() + block + i * 4);
+            w[i] = (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | p[3];
+        }
+        for (int i = 16; i < 80; i++) {
+            w[i] = Rotl(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+        }
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+        for (int i = 0; i < 80; i++) {
+            uint32_t f, k;
+            if (i < 20) {
+                f = (b & c) | (~b & d);
+                k = 0x5A827999;
+            } else if (i < 40) {
+                f = b ^ c ^ d;
+                k = 0x6ED9EBA1;
+            } else if (i < 60) {
+                f = (b & c) | (b & d) | (c & d);
+                k = 0x8F1BBCDC;
+            } else {
+                f = b ^ c ^ d;
+                k = 0xCA62C1D6;
+            }
+            uint32_t t = Rotl(a, 5) + f + e + k + w[i];
+            e = d;
+            d = c;
+            c = Rotl(b, 30);
+            b = a;
+            a = t;
+        }
+        h[0] += a;
+        h[1] += b;
+        h[2] += c;
+        h[3] += d;
+        h[4] += e;
+    }
+    for (int i = 0; i < 5; i++) {
+        digest[i * 4] = static_cast<uint8_t>(h[i] >> 24);
+        digest[i * 4 + 1] = static_cast<uint8_t>(h[i] >> 16);
+        digest[i * 4 + 2] = static_cast<uint8_t>(h[i] >> 8);
+        digest[i * 4 + 3] = static_cast<uint8_t>(h[i]);
+    }
+}
+
+std::string Base64Encode(const uint8_t* data, size_t len) {
+    static const char TABLE[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string out;
+    out.reserve((len + 2) / 3 * 4);
+    for (size_t i = 0; i < len; i += 3) {
+        uint32_t n = uint32_t(data[i]) << 16;
+        if (i + 1 < len) {
+            n |= uint32_t(data[i + 1]) << 8;
+        }
+        if (i + 2 < len) {
+            n |= data[i + 2];
+        }
+        out.push_back(TABLE[(n >> 18) & 63]);
+        out.push_back(TABLE[(n >> 12) & 63]);
+        out.push_back(i + 1 < len ? TABLE[(n >> 6) & 63] : '=');
+        out.push_back(i + 2 < len ? TABLE[n & 63] : '=');
+    }
+    return out;
+}
+
+/**
+ * @brief 文本消息必须是合法的UTF-8(RFC 6455 8.1), 拒绝过长编码和代理项
+*/
+bool IsValidUtf8(std::string_view str) {
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(str.data());
+    const uint8_t* end = p + str.size();
+    while (p < end) {
+        uint8_t c = *p;
+        if (c < 0x80) {
+            p++;
+            continue;
+        }
+        int len;
+        uint32_t cp;
+        if ((c & 0xe0) == 0xc0) {
+            len = 2;
+            cp = c & 0x1f;
+        } else if ((c & 0xf0) == 0xe0) {
+            len = 3;
+            cp = c & 0x0f;
+        } else if ((c & 0xf8) == 0xf0) {
+            len = 4;
+            cp = c & 0x07;
+        } else {
+            return false;
+        }
+        if (end - p < len) {
+            return false;
+        }
+        for (int i = 1; i < len; i++) {
+            if ((p[i] & 0xc0) != 0x80) {
+                return false;
+            }
+            cp = (cp << 6) | (p[i] & 0x3f);
+        }
+        if ((len == 2 && cp < 0x80) || (len == 3 && cp < 0x800) || (len == 4 && cp < 0x10000) ||
+            cp > 0x10ffff || (cp >= 0xd800 && cp <= 0xdfff)) {
+            return false;
+        }
+        p += len;
+    }
+    return true;
+}
+
+}  // namespace
+
+WebSocket::WebSocket(int fd, WebSocketEndpoint* endpoint, TlsConn* tls)
+    : fd_(fd), tls_(tls), endpoint_(endpoint), msgOpcode_(TEXT), fragmented_(false), closeReceived_(false),
+      head_(0), offset_(0), queued_(0), busy_(true), closing_(false) {
+    assert(endpoint_);
+}
+
+/**
+ * @brief 握手请求校验, RFC 6455 4.2.1
+*/
+bool WebSocket::IsUpgradeRequest(const HttpRequest& request) {
+    return request.method() == "GET" && request.version() == "1.1" &&
+           httptable::ContainsToken(request.header(HttpHeader::UPGRADE), "websocket") &&
+           httptable::ContainsToken(request.header(HttpHeader::CONNECTION), "upgrade") &&
+           request.header(HttpHeader::SEC_WEBSOCKET_VERSION) == "13" &&
+           !request.header(HttpHeader::SEC_WEBSOCKET_KEY).empty();
+}
+
+/**
+ * @brief Sec-WebSocket-Accept = base64(SHA-1(key + GUID))
+*/
+void WebSocket::Accept(std::string_view key) {
+    uint8_t digest[20];
+    Sha1(std::string(key) + WS_GUID, digest);
+    auto frame = std::make_shared<std::string>(
+        "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+        "Sec-WebSocket-Accept: ");
+    frame->append(Base64Encode(digest, sizeof(digest)));
+    frame->append("\r\n\r\n");
+    Enqueue_(frame, true);
+}
+
+/**
+ * @brief 拆帧, RFC 6455 5.2; 客户端帧必须带掩码, 控制帧不能分片且不超过125字节
+*/
+bool WebSocket::Feed(Buffer& buff) {
+    /* 单帧消息在这里解掩码, 不占用连接自己的内存 */
+    thread_local std::string scratch;
+    while (!closeReceived_ && buff.ReadableBytes() >= 2) {
+        const uint8_t* p = reinterpret_cast<const uint8_t*>(buff.Peek());
+        bool fin = p[0] & 0x80;
+        Opcode opcode = static_cast<Opcode>(p[0] & 0x0f);
+        uint64_t len = p[1] & 0x7f;
+        size_t headerLen = 2;
+        if ((p[0] & 0x70) || !(p[1] & 0x80)) {
+            return Fail_(1002);
+        }
+        if (len == 126) {
+            if (buff.ReadableBytes() < 4) {
+                break;
+            }
+            len = (uint64_t(p[2]) << 8) | p[3];
+            headerLen = 4;
+        } else if (len == 127) {
+            if (buff.ReadableBytes() < 10) {
+                break;
+            }
+            len = 0;
+            for (int i = 2; i < 10; i++) {
+                len = (len << 8) | p[i];
+            }
+            headerLen = 10;
+        }
+
+        bool control = opcode & 0x8;
+        if (control) {
+            if (!fin || len > MAX_CONTROL_PAYLOAD || (opcode != CLOSE && opcode != PING && opcode != PONG)) {
+                return Fail_(1002);
+            }
+        } else if ((opcode != CONTINUATION && opcode != TEXT && opcode != BINARY) ||
+                   (opcode == CONTINUATION) != fragmented_) {
+            return Fail_(1002);
+        } else if (len > MAX_MESSAGE - message_.size()) {
+            return Fail_(1009);
+        }
+        if (buff.ReadableBytes() < headerLen + 4 + len) {
+            break;
+        }
+
+        const uint8_t* mask = p + headerLen;
+        const char* data = reinterpret_cast<const char*>(mask + 4);
+        bool whole = control || (fin && !fragmented_);
+        std::string& target = whole ? scratch : message_;
+        size_t start = whole ? 0 : message_.size();
+        if (whole) {
+            scratch.clear();
+        }
+        target.append(data, len);
+        for (size_t i = 0; i < len; i++) {
+            target[start + i] ^= mask[i % 4];
+        }
+        buff.Retrieve(headerLen + 4 + len);
+
+        if (!control && !fin) {
+            if (!fragmented_) {
+                msgOpcode_ = opcode;
+                fragmented_ = true;
+            }
+            continue;
+        }
+        if (!control && fragmented_) {
+            opcode = msgOpcode_;
+            fragmented_ = false;
+        }
+        bool ok = Dispatch_(opcode, target);
+        if (&target == &message_) {
+            if (message_.capacity() > SHRINK_SIZE) {
+                std::string().swap(message_);
+            } else {
+                message_.clear();
+            }
+        }
+        if (!ok) {
+            return false;
+        }
+    }
+    if (scratch.capacity() > MAX_MESSAGE) {
+        std::string().swap(scratch);
+    }
+    return true;
+}
+
+/**
+ * @brief 处理一条完整的消息或控制帧
+*/
+bool WebSocket::Dispatch_(Opcode opcode, std::string_view payload) {
+    switch (opcode) {
+        case PING:
+            Send(PONG, payload);
+            return true;
+        case PONG:
+            return true;
+        case CLOSE: {
+            /* 回复相同的状态码, 之后不再读取, 关闭帧发送完后断开 */
+            closeReceived_ = true;
+            if (payload.size() == 1) {
+                return Fail_(1002);
+            }
+            if (payload.size() > 2 && !IsValidUtf8(payload.substr(2))) {
+                return Fail_(1007);
+            }
+            uint16_t code = payload.size() >= 2
+                ? static_cast<uint16_t>((static_cast<uint8_t>(payload[0]) << 8) | static_cast<uint8_t>(payload[1]))
+                : 0;
+            Close(code);
+            return true;
+        }
+        default:
+            if (opcode == TEXT && !IsValidUtf8(payload)) {
+                return Fail_(1007);
+            }
+            if (endpoint_->handler.onMessage) {
+                endpoint_->handler.onMessage(*this, opcode, payload);
+            }
+            return true;
+    }
+}
+
+/**
+ * @brief 协议错误: 发送带状态码的关闭帧, 不再读取
+*/
+bool WebSocket::Fail_(uint16_t code) {
+    LOG_WARN("websocket[%d] protocol error, close %u", fd_, code);
+    closeReceived_ = true;
+    Close(code);
+    return false;
+}
+
+/**
+ * @brief 编码服务端帧, 不带掩码
+*/
+WebSocket::Frame WebSocket::MakeFrame_(Opcode opcode, std::string_view payload) {
+    auto frame = std::make_shared<std::string>();
+    frame->reserve(payload.size() + 10);
+    frame->push_back(static_cast<char>(0x80 | opcode));
+    if (payload.size() < 126) {
+        frame->push_back(static_cast<char>(payload.size()));
+    } else if (payload.size() <= 0xffff) {
+        frame->push_back(126);
+        frame->push_back(static_cast<char>(payload.size() >> 8));
+        frame->push_back(static_cast<char>(payload.size()));
+    } else {
+        frame->push_back(127);
+        for (int i = 7; i >= 0; i--) {
+            frame->push_back(static_cast<char>(static_cast<uint64_t>(payload.size()) >> (i * 8)));
+        }
+    }
+    frame->append(payload.data(), payload.size());
+    return frame;
+}
+
+bool WebSocket::Send(Opcode opcode, std::string_view payload) {
+    assert(opcode != CLOSE && opcode != CONTINUATION);
+    if ((opcode & 0x8) && payload.size() > MAX_CONTROL_PAYLOAD) {
+        return false;
+    }
+    return Enqueue_(MakeFrame_(opcode, payload), false);
+}
+
+size_t WebSocket::Broadcast(Opcode opcode, std::string_view payload) {
+    return WebSocketHub::Instance()->Broadcast(endpoint_, opcode, payload);
+}
+
+/**
+ * @brief 关闭帧只发送一次, code为0表示不带状态码
+*/
+void WebSocket::Close(uint16_t code, std::string_view reason) {
+    std::string payload;
+    if (code) {
+        payload.push_back(static_cast<char>(code >> 8));
+        payload.push_back(static_cast<char>(code));
+        payload.append(reason.substr(0, MAX_CONTROL_PAYLOAD - 2));
+    }
+    Frame frame = MakeFrame_(CLOSE, payload);
+    std::lock_guard<std::mutex> locker(mtx_);
+    if (closing_) {
+        return;
+    }
+    closing_ = true;
+    bool wasEmpty = queued_ == 0;
+    queue_.push_back(frame);
+    queued_ += frame->size();
+    if (wasEmpty && !busy_) {
+        WebSocketHub::Instance()->Wakeup(fd_);
+    }
+}
+
+/**
+ * @brief 放入发送队列; 队列由空变为非空且连接空闲时唤醒事件循环
+ * @param force 忽略HIGH_WATER(握手响应)
+*/
+bool WebSocket::Enqueue_(const Frame& frame, bool force) {
+    std::lock_guard<std::mutex> locker(mtx_);
+    if (closing_ || (!force && queued_ >= HIGH_WATER)) {
+        return false;
+    }
+    bool wasEmpty = queued_ == 0;
+    queue_.push_back(frame);
+    queued_ += frame->size();
+    if (wasEmpty && !busy_) {
+        WebSocketHub::Instance()->Wakeup(fd_);
+    }
+    return true;
+}
+
+/**
+ * @brief 发送队列写入socket; 帧内容不可变, writev时不持有锁, 其他线程可以继续追加
+*/
+ssize_t WebSocket::Write(int* saveErrno) {
+    ssize_t len = 0;
+    while (true) {
+        struct iovec iov[MAX_IOV];
+        int cnt = 0;
+        {
+            std::lock_guard<std::mutex> locker(mtx_);
+            for (size_t i = head_; i < queue_.size() && cnt < MAX_IOV; i++, cnt++) {
+                size_t skip = i == head_ ? offset_ : 0;
+                iov[cnt].iov_base = const_cast<char*>(queue_[i]->data() + skip);
+                iov[cnt].iov_len = queue_[i]->size() - skip;
+            }
+        }
+        if (cnt == 0) {
+            break;
+        }
+        len = tls_ ? tls_->Writev(iov, cnt) : writev(fd_, iov, cnt);
+        if (len <= 0) {
+            *saveErrno = errno;
+            break;
+        }
+        std::lock_guard<std::mutex> locker(mtx_);
+        size_t sent = len;
+        queued_ -= sent;
+        while (sent > 0) {
+            size_t left = queue_[head_]->size() - offset_;
+            if (sent < left) {
+                offset_ += sent;
+                break;
+            }
+            sent -= left;
+            queue_[head_].reset();
+            head_++;
+            offset_ = 0;
+        }
+        if (head_ == queue_.size()) {
+            /* 取空后释放容量, 空闲连接不保留发送队列的内存 */
+            std::vector<Frame>().swap(queue_);
+            head_ = 0;
+        }
+    }
+    return len;
+}
+
+bool WebSocket::Acquire() {
+    std::lock_guard<std::mutex> locker(mtx_);
+    if (busy_) {
+        return false;
+    }
+    busy_ = true;
+    return true;
+}
+
+void WebSocket::Release(const std::function<void(bool writable)>& rearm) {
+    std::lock_guard<std::mutex> locker(mtx_);
+    busy_ = false;
+    rearm(queued_ > 0);
+}
+
+size_t WebSocket::QueuedBytes() const {
+    std::lock_guard<std::mutex> locker(mtx_);
+    return queued_;
+}
+
+bool WebSocket::IsClosing() const {
+    std::lock_guard<std::mutex> locker(mtx_);
+    return closing_;
+}
+
+/**
+ * @brief 获取单例
+*/
+WebSocketHub* WebSocketHub::Instance() {
+    static WebSocketHub hub;
+    return &hub;
+}
+
+void WebSocketHub::Register(std::string_view path, const WebSocket::Handler& handler) {
+    WebSocketEndpoint& endpoint = endpoints_[std::string(path)];
+    endpoint.path = std::string(path);
+    endpoint.handler = handler;
+}
+
+WebSocketEndpoint* WebSocketHub::Find(std::string_view path) {
+    auto it = endpoints_.find(path);
+    return it == endpoints_.end() ? nullptr : &it->second;
+}
+
+void WebSocketHub::Wakeup(int fd) const {
+    if (wakeup_) {
+        wakeup_(fd);
+    }
+}
+
+void WebSocketHub::Join(WebSocket* ws) {
+    assert(ws);
+    std::lock_guard<std::mutex> locker(mtx_);
+    if (ws->GetEndpoint()->members.insert(ws).second) {
+        count_++;
+    }
+}
+
+/**
+ * @brief 离开端点, 必须在关闭socket之前调用, 之后不会再有广播唤醒该fd
+*/
+void WebSocketHub::Leave(WebSocket* ws) {
+    assert(ws);
+    std::lock_guard<std::mutex> locker(mtx_);
+    if (ws->GetEndpoint()->members.erase(ws)) {
+        count_--;
+    }
+}
+
+size_t WebSocketHub::Broadcast(std::string_view path, WebSocket::Opcode opcode, std::string_view payload) {
+    WebSocketEndpoint* endpoint = Find(path);
+    return endpoint ? Broadcast(endpoint, opcode, payload) : 0;
+}
+
+size_t WebSocketHub::Broadcast(WebSocketEndpoint* endpoint, WebSocket::Opcode opcode, std::string_view payload) {
+    assert(endpoint);
+    WebSocket::Frame frame = WebSocket::MakeFrame_(opcode, payload);
+    size_t sent = 0, dropped = 0;
+    std::lock_guard<std::mutex> locker(mtx_);
+    for (WebSocket* ws : endpoint->members) {
+        if (ws->Enqueue_(frame, false)) {
+            sent++;
+        } else {
+            dropped++;
+        }
+    }
+    if (dropped) {
+        LOG_WARN("websocket broadcast %s: %zu slow receivers skipped", endpoint->path.c_str(), dropped);
+    }
+    return sent;
+}
+
+size_t WebSocketHub::Count() const {
+    std::lock_guard<std::mutex> locker(mtx_);
+    return count_;
+}
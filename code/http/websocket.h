@@ -0,0 +1,194 @@
+#ifndef WEBSOCKET_H
+#define WEBSOCKET_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+#include "../buffer/buffer.h"
+
+class HttpRequest;
+class TlsConn;
+struct WebSocketEndpoint;
+
+/**
+ * @brief 升级后的WebSocket连接(RFC 6455), 由HttpConn持有
+ * 读和帧解析只在处理该连接的工作线程中进行; 发送可以来自任意线程, 帧放入连接自己的发送队列,
+ * 队列由空变为非空且连接空闲时通过WebSocketHub唤醒事件循环监听可写.
+ * 空闲连接只占用本对象和HttpConn本身, 不持有定时器
+*/
+class WebSocket {
+public:
+    enum Opcode : uint8_t {
+        CONTINUATION = 0x0,
+        TEXT = 0x1,
+        BINARY = 0x2,
+        CLOSE = 0x8,
+        PING = 0x9,
+        PONG = 0xa,
+    };
+
+    /**
+     * @brief 应用回调, 均可为空; onMessage在工作线程中调用, 分片消息拼接完整后才回调
+    */
+    struct Handler {
+        std::function<void(WebSocket& ws)> onOpen;
+        std::function<void(WebSocket& ws, Opcode opcode, std::string_view message)> onMessage;
+        std::function<void(WebSocket& ws)> onClose;
+    };
+
+    /**
+     * @param tls TLS连接的加密状态, 为空时直接写socket
+    */
+    WebSocket(int fd, WebSocketEndpoint* endpoint, TlsConn* tls = nullptr);
+    ~WebSocket() = default;
+
+    WebSocket(const WebSocket&) = delete;
+    WebSocket& operator=(const WebSocket&) = delete;
+
+    /**
+     * @brief 是否为合法的握手请求: GET, Upgrade: websocket, Connection: Upgrade, 版本13
+    */
+    static bool IsUpgradeRequest(const HttpRequest& request);
+
+    /**
+     * @brief 把101响应放入发送队列, 完成握手
+    */
+    void Accept(std::string_view key);
+
+    /**
+     * @brief 解析缓冲区中完整的帧并回调
+     * @return 协议错误时返回false, 关闭帧已放入发送队列
+    */
+    bool Feed(Buffer& buff);
+
+    /**
+     * @brief 发送一条消息, 任意线程可调用
+     * @return 连接正在关闭, 或发送队列超过HIGH_WATER(对端读得太慢)时返回false, 消息被丢弃
+    */
+    bool Send(Opcode opcode, std::string_view payload);
+
+    /**
+     * @brief 广播给同一端点上的所有连接(包括自己)
+     * @return 成功放入队列的连接数
+    */
+    size_t Broadcast(Opcode opcode, std::string_view payload);
+
+    /**
+     * @brief 发送关闭帧, 发送完后服务端关闭TCP连接
+    */
+    void Close(uint16_t code = 1000, std::string_view reason = std::string_view());
+
+    /**
+     * @brief 把发送队列写入socket, 直到写完或EAGAIN
+    */
+    ssize_t Write(int* saveErrno);
+
+    /**
+     * @brief 事件循环取得连接的处理权, 已被占用时返回false(其他线程发送时重复注册引起的事件, 应忽略)
+    */
+    bool Acquire();
+
+    /**
+     * @brief 工作线程处理完毕, 在锁内按是否还有待发送数据重新注册事件, 与并发的Send不会丢失唤醒
+    */
+    void Release(const std::function<void(bool writable)>& rearm);
+
+    size_t QueuedBytes() const;
+    bool IsClosing() const;
+    int GetFd() const { return fd_; }
+    WebSocketEndpoint* GetEndpoint() const { return endpoint_; }
+
+    static const size_t MAX_MESSAGE = 1024 * 1024;  // 单条消息上限, 超过时以1009关闭
+    static const size_t HIGH_WATER = 1024 * 1024;   // 发送队列上限, 超过后丢弃新消息
+
+private:
+    friend class WebSocketHub;
+
+    typedef std::shared_ptr<const std::string> Frame;   // 广播时所有连接共享同一帧
+
+    static Frame MakeFrame_(Opcode opcode, std::string_view payload);
+    bool Enqueue_(const Frame& frame, bool force);
+    bool Dispatch_(Opcode opcode, std::string_view payload);
+    bool Fail_(uint16_t code);
+
+    static const int MAX_IOV = 64;
+
+    int fd_;
+    TlsConn* tls_;                  // 由HttpConn持有, 只在发送时使用
+    WebSocketEndpoint* endpoint_;   // 所属端点, 提供回调和广播范围
+
+    /* 读状态, 只由当前处理连接的线程访问 */
+    Opcode msgOpcode_;              // 分片消息的类型
+    bool fragmented_;               // 正在接收分片消息
+    bool closeReceived_;            // 已收到关闭帧, 不再读取
+    std::string message_;           // 分片消息的拼接缓冲, 消息结束后释放
+
+    /* 发送状态, 由mtx_保护 */
+    mutable std::mutex mtx_;
+    std::vector<Frame> queue_;      // 发送队列, 取空后释放容量
+    size_t head_;                   // 第一个未发送完的帧
+    size_t offset_;                 // 该帧已发送的字节数
+    size_t queued_;                 // 未发送的总字节数
+    bool busy_;                     // 正被工作线程处理(或正在分派), 期间发送不唤醒事件循环
+    bool closing_;                  // 已发送关闭帧
+};
+
+/**
+ * @brief WebSocket端点: 一个路径对应的回调与当前连接
+*/
+struct WebSocketEndpoint {
+    std::string path;
+    WebSocket::Handler handler;
+    std::unordered_set<WebSocket*> members;     // 由WebSocketHub的锁保护
+};
+
+/**
+ * @brief WebSocket端点注册表与广播
+*/
+class WebSocketHub {
+public:
+    static WebSocketHub* Instance();
+
+    /**
+     * @brief 注册端点, 必须在服务启动前调用
+    */
+    void Register(std::string_view path, const WebSocket::Handler& handler);
+    WebSocketEndpoint* Find(std::string_view path);
+
+    /**
+     * @brief 设置唤醒函数: 空闲连接有了待发送数据时, 由它注册可写事件
+    */
+    void SetWakeup(const std::function<void(int fd)>& wakeup) { wakeup_ = wakeup; }
+    void Wakeup(int fd) const;
+
+    void Join(WebSocket* ws);
+    void Leave(WebSocket* ws);
+
+    /**
+     * @brief 向端点上的所有连接发送同一条消息, 帧只编码一次; 任意线程可调用
+     * @return 成功放入队列的连接数, 发送队列已满的连接被跳过
+    */
+    size_t Broadcast(std::string_view path, WebSocket::Opcode opcode, std::string_view payload);
+    size_t Broadcast(WebSocketEndpoint* endpoint, WebSocket::Opcode opcode, std::string_view payload);
+
+    size_t Count() const;
+
+private:
+    WebSocketHub() = default;
+
+    std::map<std::string, WebSocketEndpoint, std::less<>> endpoints_;   // 启动后只读
+    std::function<void(int fd)> wakeup_;
+    mutable std::mutex mtx_;        // 保护所有端点的members
+    size_t count_ = 0;              // 当前连接数
+};
+
+#endif
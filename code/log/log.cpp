@@ -1,75 +1,96 @@
 #include "log.h"
 
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+/**
+ * @brief 每个写日志线程的环形缓冲区
+ * 线程退出时只做标记, 由写线程取完剩余数据后释放
+*/
+struct Log::Producer {
+    explicit Producer(size_t capacity) : ring(capacity), exited(false) {}
+
+    RingBuffer ring;
+    std::atomic<bool> exited;
+};
+
 /**
  * @brief 构造函数
 */
-Log::Log() {
+Log::Log() : block_(BLOCK_SIZE) {
     lineCount_ = 0;
     isAsync_ = false;
     writeThread_ = nullptr;
-    deque_ = nullptr;
     toDay_ = 0;
-    fp_ = nullptr;
+    fileNo_ = 0;
+    fd_ = -1;
+    isOpen_ = false;
+    level_ = 1;
+    ringSize_ = MIN_RING_SIZE;
+    maxLine_ = MIN_RING_SIZE / 2;
+    wakeup_ = false;
+    running_ = false;
+    urgent_ = false;
+    flushIntervalMS_ = FLUSH_INTERVAL_MS;
+    flushBytes_ = FLUSH_BYTES;
+    flushLevel_ = FLUSH_LEVEL;
 }
 
 /**
- * @brief 析构函数
+ * @brief 析构函数, 写线程取完所有环形缓冲区后退出
+ * 线程池的线程是分离的, 仍可能存活, 它们的环形缓冲区不释放
 */
 Log::~Log() {
     if (writeThread_ && writeThread_->joinable()) {
-        while (!deque_->empty()) { // 一直等待直到队列为空
-            deque_->flush();
-        };
-        deque_->Close();
+        {
+            std::lock_guard<std::mutex> locker(wakeMtx_);
+            running_ = false;
+        }
+        cond_.notify_one();
         writeThread_->join();
     }
-    if (fp_) {
-        std::lock_guard<std::mutex> locker(mtx_);
-        fflush(fp_);
-        fclose(fp_);
-    }
-}
-
-/**
- * @brief 获取日志等级
-*/
-int Log::GetLevel() {
     std::lock_guard<std::mutex> locker(mtx_);
-    return level_;
+    for (Producer* producer : producers_) {
+        if (producer->exited.load(std::memory_order_acquire)) {
+            delete producer;
+        }
+    }
+    producers_.clear();
+    if (fd_ >= 0) {
+        close(fd_);
+    }
 }
 
 /**
  * @brief 设置日志等级
 */
 void Log::SetLevel(int level) {
-    std::lock_guard<std::mutex> locker(mtx_);
-    level_ = level;
+    level_.store(level, std::memory_order_relaxed);
 }
 
-/**
- * @brief 判断日志系统是否开启
-*/
-bool Log::IsOpen() { return isOpen_; }
-
 /**
  * @brief 添加日志等级标题
 */
-void Log::AppendLogLevelTitle_(int level) {
+void Log::AppendLogLevelTitle_(Buffer& buff, int level) {
     switch (level) {
         case 0:
-            buff_.Append("[debug]: ", 9);
+            buff.Append("[debug]: ", 9);
             break;
         case 1:
-            buff_.Append("[info]: ", 8);
+            buff.Append("[info]: ", 8);
             break;
         case 2:
-            buff_.Append("[warn]: ", 8);
+            buff.Append("[warn]: ", 8);
             break;
         case 3:
-            buff_.Append("[error]: ", 9);
+            buff.Append("[error]: ", 9);
             break;
         default:
-            buff_.Append("[info]: ", 8);
+            buff.Append("[info]: ", 8);
             break;
     }
 }
@@ -78,47 +99,33 @@ void Log::AppendLogLevelTitle_(int level) {
  * @brief 初始化
 */
 void Log::Init(int level = 1, const char* path, const char* suffix, int maxQueueCapacity) {
-    isOpen_ = true;
     level_ = level;
     if (maxQueueCapacity > 0) {
         isAsync_ = true;
-        if (!deque_) {// 为了防止多线程同时初始化deque_，导致deque_的构造函数被调用多次
-            std::unique_ptr<BlockDeque<std::string>> newDeque(new BlockDeque<std::string>);
-            deque_ = std::move(newDeque);
-
-            std::unique_ptr<std::thread> NewThread(new std::thread(FlushLogThread));
-            writeThread_ = std::move(NewThread);
-        }
+        ringSize_ = std::max(maxQueueCapacity * AVG_LINE_LEN, MIN_RING_SIZE);
+        maxLine_ = ringSize_ / 2;
     } else {
         isAsync_ = false;
     }
 
-    lineCount_ = 0;
-
-    time_t timer = time(nullptr);
-    struct tm* sysTime = localtime(&timer);
-    struct tm t = *sysTime;
-    path_ = path;
-    suffix_ = suffix;
-    char fileName[LOG_NAME_LEN] = {0};
-    snprintf(fileName, LOG_NAME_LEN - 1, "%s/%04d_%02d_%02d%s", path_, t.tm_year + 1900,
-             t.tm_mon + 1, t.tm_mday, suffix_);
-    toDay_ = t.tm_mday;
-
+    char stamp[CoarseClock::LOG_TIME_LEN];
+    struct tm t;
+    CoarseClock::Instance()->LogTime(stamp, &t);
     {
         std::lock_guard<std::mutex> locker(mtx_);
-        buff_.RetrieveAll();
-        if (fp_) {
-            Flush();
-            fclose(fp_);
-        }
-        fp_ = fopen(fileName, "a");
-        if (fp_ == nullptr) {
-            mkdir(path_, 0777);
-            fp_ = fopen(fileName, "a");
-        }
-        assert(fp_ != nullptr);
+        path_ = path;
+        suffix_ = suffix;
+        toDay_ = t.tm_mday;
+        lineCount_ = 0;
+        fileNo_ = 0;
+        OpenFile_(t);
+    }
+
+    if (isAsync_ && !writeThread_) {
+        running_ = true;
+        writeThread_.reset(new std::thread(FlushLogThread));
     }
+    isOpen_ = true;
 }
 
 /**
@@ -137,75 +144,255 @@ void Log::FlushLogThread() {
 }
 
 /**
- * @brief 异步写日志
+ * @brief 异步写日志: 被唤醒或等到刷新时间时取走所有环形缓冲区中的数据, 按刷新策略决定是否写出;
+ * 工作线程只写环形缓冲区和唤醒, 不做任何文件操作. 看到停止标志后还会再取一轮并写出, 之前写入的日志都会落盘
 */
 void Log::AsyncWrite_() {
-    std::string str = "";
-    while (deque_->pop(str)) {
-        std::lock_guard<std::mutex> locker(mtx_);
-        fputs(str.c_str(), fp_);
+    bool running = true;
+    TimeStamp lastFlush = SteadyClock::now();
+    while (running) {
+        bool urgent;
+        {
+            std::unique_lock<std::mutex> locker(wakeMtx_);
+            cond_.wait_until(locker, lastFlush + MS(flushIntervalMS_.load()),
+                             [this] { return wakeup_.load() || !running_.load(); });
+            wakeup_ = false;
+            urgent = urgent_.exchange(false);
+            running = running_;
+        }
+        Drain_();
+        TimeStamp now = SteadyClock::now();
+        if (urgent || !running || block_.ReadableBytes() >= flushBytes_.load() ||
+            now - lastFlush >= MS(flushIntervalMS_.load())) {
+            WriteBlock_();
+            lastFlush = now;
+        }
     }
 }
 
 /**
- * @brief 写日志
+ * @brief 依次取空各环形缓冲区, 一个缓冲区中的数据总是整行的; 块达到BLOCK_SIZE时先写出
 */
-void Log::Write(int level, const char* format, ...) {
-    struct timeval now = {0, 0};
-    gettimeofday(&now, nullptr);
-    time_t t_sec = now.tv_sec;
-    struct tm* sysTime = localtime(&t_sec);
-    struct tm t = *sysTime;
-    va_list vaList;
-    // 创建新日志文件
-    if (toDay_ != t.tm_mday || (lineCount_ && (lineCount_ % MAX_LINES == 0))) {
-        char newFile[LOG_NAME_LEN];
-        char tail[36] = {0};
-        snprintf(tail, 36, "%04d_%02d_%02d", t.tm_year + 1900, t.tm_mon + 1, t.tm_mday);
-        if (toDay_ != t.tm_mday) {
-            snprintf(newFile, LOG_NAME_LEN - 72, "%s/%s%s", path_, tail, suffix_);
-            toDay_ = t.tm_mday;
-            lineCount_ = 0;
-        } else {
-            snprintf(newFile, LOG_NAME_LEN - 72, "%s/%s-%d%s", path_, tail, (lineCount_ / MAX_LINES),
-                     suffix_);
+void Log::Drain_() {
+    {
+        std::lock_guard<std::mutex> locker(mtx_);
+        draining_ = producers_;
+    }
+    bool reclaim = false;
+    for (Producer* producer : draining_) {
+        /* 先读退出标志再取数据, 标志为真时取完就不会再有新数据 */
+        bool exited = producer->exited.load(std::memory_order_acquire);
+        const char* data;
+        size_t len;
+        while ((len = producer->ring.Peek(&data)) > 0) {
+            block_.Append(data, len);
+            producer->ring.Consume(len);
+        }
+        if (block_.ReadableBytes() >= BLOCK_SIZE) {
+            WriteBlock_();
         }
-        std::unique_lock<std::mutex> locker(mtx_);
-        Flush();
-        fclose(fp_);
-        fp_ = fopen(newFile, "a");
-        assert(fp_ != nullptr);
+        reclaim |= exited;
     }
+    if (reclaim) {
+        std::lock_guard<std::mutex> locker(mtx_);
+        for (auto it = producers_.begin(); it != producers_.end();) {
+            if ((*it)->exited.load(std::memory_order_acquire) && (*it)->ring.ReadableBytes() == 0) {
+                delete *it;
+                it = producers_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+}
+
+/**
+ * @brief 整块一次写出
+*/
+void Log::WriteBlock_() {
+    if (block_.ReadableBytes() == 0) {
+        return;
+    }
+    int lines = 0;
+    for (const char* eol = block_.FindEOL(); eol; eol = block_.FindEOL(eol + 1)) {
+        lines++;
+    }
+    std::string_view data = block_.View();
     {
-        std::unique_lock<std::mutex> locker(mtx_);
-        lineCount_++;
-        int n = snprintf(buff_.BeginWrite(), 128, "%d-%02d-%02d %02d:%02d:%02d.%06ld ",
-                         t.tm_year + 1900, t.tm_mon + 1, t.tm_mday, t.tm_hour, t.tm_min,
-                         t.tm_sec, now.tv_usec);
-        buff_.HasWritten(n);
-        AppendLogLevelTitle_(level);
+        std::lock_guard<std::mutex> locker(mtx_);
+        WriteFile_(data.data(), data.size(), lines);
+    }
+    block_.RetrieveAll();
+}
+
+/**
+ * @brief 写入日志文件, 被信号中断或只写出一部分时继续写
+*/
+void Log::WriteFile_(const char* data, size_t len, int lines) {
+    Rotate_();
+    lineCount_ += lines;
+    while (len > 0) {
+        ssize_t n = write(fd_, data, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        data += n;
+        len -= n;
+    }
+}
 
+/**
+ * @brief 换新文件; 异步时按块写出, 一个文件可能比MAX_LINES多出一块的行数
+*/
+void Log::Rotate_() {
+    char stamp[CoarseClock::LOG_TIME_LEN];
+    struct tm t;
+    CoarseClock::Instance()->LogTime(stamp, &t);
+    if (toDay_ != t.tm_mday) {
+        toDay_ = t.tm_mday;
+        fileNo_ = 0;
+    } else if (lineCount_ >= MAX_LINES) {
+        fileNo_++;
+    } else {
+        return;
+    }
+    lineCount_ = 0;
+    OpenFile_(t);
+}
+
+/**
+ * @brief 打开日志文件, 当天的第一个文件为 path/YYYY_MM_DD.log, 之后为 path/YYYY_MM_DD-N.log
+*/
+void Log::OpenFile_(const struct tm& t) {
+    char fileName[LOG_NAME_LEN] = {0};
+    if (fileNo_ == 0) {
+        snprintf(fileName, LOG_NAME_LEN - 1, "%s/%04d_%02d_%02d%s", path_, t.tm_year + 1900,
+                 t.tm_mon + 1, t.tm_mday, suffix_);
+    } else {
+        snprintf(fileName, LOG_NAME_LEN - 1, "%s/%04d_%02d_%02d-%d%s", path_, t.tm_year + 1900,
+                 t.tm_mon + 1, t.tm_mday, fileNo_, suffix_);
+    }
+    if (fd_ >= 0) {
+        close(fd_);
+    }
+    fd_ = open(fileName, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0666);
+    if (fd_ < 0) {
+        mkdir(path_, 0777);
+        fd_ = open(fileName, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0666);
+    }
+    assert(fd_ >= 0);
+}
+
+/**
+ * @brief 当前线程的环形缓冲区; 线程退出时thread_local对象的析构函数标记退出
+*/
+Log::Producer* Log::LocalProducer_() {
+    struct Handle {
+        Producer* producer = nullptr;
+        ~Handle() {
+            if (producer) {
+                producer->exited.store(true, std::memory_order_release);
+            }
+        }
+    };
+    thread_local Handle handle;
+    if (!handle.producer) {
+        handle.producer = new Producer(ringSize_);
+        std::lock_guard<std::mutex> locker(mtx_);
+        producers_.push_back(handle.producer);
+    }
+    return handle.producer;
+}
+
+/**
+ * @brief 写入环形缓冲区; 缓冲区满时唤醒写线程并让出CPU, 直到写入, 不丢日志也不打乱本线程的顺序
+*/
+void Log::Push_(std::string_view line) {
+    Producer* producer = LocalProducer_();
+    while (!producer->ring.TryPush(line.data(), line.size())) {
+        if (!running_.load(std::memory_order_relaxed)) {
+            return;
+        }
+        WakeUp_();
+        std::this_thread::yield();
+    }
+    if (producer->ring.ReadableBytes() > producer->ring.Capacity() / 2) {
+        WakeUp_();
+    }
+}
+
+/**
+ * @brief 只有第一个请求唤醒的线程加锁通知, 写线程醒来前的其余请求只读写一个原子变量
+*/
+void Log::WakeUp_() {
+    if (!wakeup_.exchange(true)) {
+        std::lock_guard<std::mutex> locker(wakeMtx_);
+        cond_.notify_one();
+    }
+}
+
+/**
+ * @brief 写日志, 在调用线程中格式化到线程私有的缓冲区
+*/
+void Log::Write(int level, const char* format, ...) {
+    /* 时间戳取自粗粒度时钟, 不再每行调用gettimeofday和localtime */
+    thread_local Buffer buff;
+    char stamp[CoarseClock::LOG_TIME_LEN];
+    size_t stampLen = CoarseClock::Instance()->LogTime(stamp, nullptr);
+    va_list vaList;
+
+    buff.Append(stamp, stampLen);
+    AppendLogLevelTitle_(buff, level);
+
+    /* 异步时一行必须能放进环形缓冲区, 超长的消息截断 */
+    size_t room = isAsync_ ? maxLine_ - buff.ReadableBytes() - 1 : SIZE_MAX;
+    va_start(vaList, format);
+    int m = vsnprintf(buff.BeginWrite(), buff.WritableBytes(), format, vaList);
+    va_end(vaList);
+    size_t len = std::min<size_t>(std::max(m, 0), room);
+    if (len >= buff.WritableBytes()) {
+        /* 超出可写空间时扩容后重新格式化 */
+        buff.EnsureWriteable(len + 1);
         va_start(vaList, format);
-        int m = vsnprintf(buff_.BeginWrite(), buff_.WritableBytes(), format, vaList);
+        vsnprintf(buff.BeginWrite(), len + 1, format, vaList);
         va_end(vaList);
-        buff_.HasWritten(m);
-        buff_.Append("\n\0", 2);
-
-        if (isAsync_ && deque_ && !deque_->full()) {
-            deque_->push_back(buff_.RetrieveAllToStr());
-        } else {
-            fputs(buff_.Peek(), fp_);
-            buff_.RetrieveAll();
+    }
+    buff.HasWritten(len);
+    buff.Append("\n", 1);
+
+    /* 按长度写出缓冲区中的内容, 不需要结尾的\0 */
+    std::string_view line = buff.View();
+    if (isAsync_) {
+        Push_(line);
+        if (level >= flushLevel_.load(std::memory_order_relaxed)) {
+            Flush();
         }
+    } else {
+        std::lock_guard<std::mutex> locker(mtx_);
+        WriteFile_(line.data(), line.size(), 1);
     }
+    buff.RetrieveAll();
 }
 
 /**
- * @brief 刷新缓冲区
+ * @brief 唤醒写线程并要求写出; 同步写时直接写文件, 没有需要刷新的缓冲
 */
 void Log::Flush() {
     if (isAsync_) {
-        deque_->flush();
+        urgent_ = true;
+        WakeUp_();
     }
-    fflush(fp_);
-}
\ No newline at end of file
+}
+
+/**
+ * @brief 设置刷新策略, 写线程下一次醒来时生效
+*/
+void Log::SetFlushPolicy(int intervalMS, size_t bytes, int level) {
+    assert(intervalMS > 0);
+    flushIntervalMS_ = intervalMS;
+    flushBytes_ = bytes;
+    flushLevel_ = level;
+}
@@ -7,17 +7,29 @@
 #include <sys/stat.h>
 #include <sys/time.h>
 
+#include <atomic>
+#include <condition_variable>
 #include <mutex>
 #include <string>
+#include <string_view>
 #include <thread>
+#include <vector>
 
 #include "../buffer/buffer.h"
-#include "blockqueue.h"
+#include "../timer/clock.h"
+#include "ringbuffer.h"
 
+/**
+ * @brief 日志系统
+ * 异步时每个写日志的线程有自己的无锁环形缓冲区, 在本线程内格式化后整行写入, 不与其他线程竞争;
+ * 写线程把各环形缓冲区中的数据汇总到一个大块中, 每块只调用一次write;
+ * 何时写出由写线程按刷新策略决定: 距上次写出超过间隔、块达到阈值, 或者有不低于指定等级的日志
+*/
 class Log {
 public:
     /**
      * @brief 初始化日志系统
+     * @param maxQueueCapacity 每个线程的环形缓冲区能容纳的行数(按AVG_LINE_LEN字节一行估算), 为0时同步写
     */
     void Init(int level, const char* path = "../log", const char* suffix = ".log",
  int maxQueueCapacity = 1024);
@@ -38,14 +50,22 @@ public:
     void Write(int level, const char* format, ...);
 
     /**
-     * @brief 刷新日志
+     * @brief 请求写线程立即写出已有的日志
     */
     void Flush();
 
+    /**
+     * @brief 设置异步写的刷新策略
+     * @param intervalMS 最长间隔多少毫秒写出一次
+     * @param bytes 汇总的数据达到多少字节时写出
+     * @param level 不低于该等级的日志立即写出
+    */
+    void SetFlushPolicy(int intervalMS, size_t bytes, int level);
+
     /**
      * @brief 获取日志等级
     */
-    int GetLevel();
+    int GetLevel() { return level_.load(std::memory_order_relaxed); }
 
     /**
      * @brief 设置日志等级
@@ -55,9 +75,12 @@ public:
     /**
      * @brief 判断日志系统是否开启
     */
-    bool IsOpen() ;
+    bool IsOpen() { return isOpen_.load(std::memory_order_relaxed); }
 
 private:
+    struct Producer;
+
+
     /**
      * @brief 构造函数
     */
@@ -66,7 +89,7 @@ private:
     /**
      * @brief 添加日志等级标题
     */
-    void AppendLogLevelTitle_(int level);
+    static void AppendLogLevelTitle_(Buffer& buff, int level);
 
     /**
      * @brief 析构函数
@@ -78,29 +101,89 @@ private:
     */
     void AsyncWrite_();
 
+    /**
+     * @brief 当前线程的环形缓冲区, 第一次调用时创建并登记
+    */
+    Producer* LocalProducer_();
+
+    /**
+     * @brief 把一行写入当前线程的环形缓冲区
+    */
+    void Push_(std::string_view line);
+
+    /**
+     * @brief 唤醒写线程
+    */
+    void WakeUp_();
+
+    /**
+     * @brief 把各环形缓冲区中的数据移到block_, 回收已退出线程的缓冲区
+    */
+    void Drain_();
+
+    /**
+     * @brief 写出block_
+    */
+    void WriteBlock_();
+
+    /**
+     * @brief 向日志文件写入lines行数据, 调用者持有mtx_
+    */
+    void WriteFile_(const char* data, size_t len, int lines);
+
+    /**
+     * @brief 换日或行数超过MAX_LINES时换新文件, 调用者持有mtx_
+    */
+    void Rotate_();
+
+    /**
+     * @brief 打开第fileNo_个日志文件, 调用者持有mtx_
+    */
+    void OpenFile_(const struct tm& t);
+
 private:
     static const int LOG_PATH_LEN = 256; // 日志路径长度
     static const int LOG_NAME_LEN = 256; // 日志名称长度
     static const int MAX_LINES = 50000;  // 最大行数
+    static constexpr size_t AVG_LINE_LEN = 128;             // 估算环形缓冲区大小时的平均行长
+    static constexpr size_t MIN_RING_SIZE = 4096;           // 环形缓冲区的最小容量
+    static constexpr size_t BLOCK_SIZE = 1024 * 1024;       // 写线程汇总的块大小, 达到时立即写出
+    static constexpr int FLUSH_INTERVAL_MS = 1000;          // 默认的刷新间隔
+    static constexpr size_t FLUSH_BYTES = 64 * 1024;        // 默认的刷新阈值
+    static constexpr int FLUSH_LEVEL = 3;                   // 默认立即写出error
 
     const char* path_;   // 日志路径
     const char* suffix_; // 日志后缀
 
     int MAX_LINES_; // 最大行数
 
-    int lineCount_; // 行数
+    int lineCount_; // 当前文件的行数
     int toDay_;     // 今天
+    int fileNo_;    // 当天的第几个文件
 
-    bool isOpen_; // 是否开启
+    std::atomic<bool> isOpen_; // 是否开启
 
-    Buffer buff_; // 缓冲区
-    int level_;   // 日志等级
+    std::atomic<int> level_;   // 日志等级
     bool isAsync_; // 是否异步
+    size_t ringSize_; // 每个线程的环形缓冲区容量
+    size_t maxLine_;  // 异步时一行的最大长度, 超出的部分截断
 
-    FILE* fp_; // 文件指针
-    std::unique_ptr<BlockDeque<std::string>> deque_; // 阻塞队列
+    int fd_; // 日志文件
+    Buffer block_; // 写线程汇总的块
+    std::vector<Producer*> producers_; // 各线程的环形缓冲区
+    std::vector<Producer*> draining_; // 写线程本轮处理的环形缓冲区
     std::unique_ptr<std::thread> writeThread_; // 写日志的线程
-    std::mutex mtx_; // 互斥锁
+    std::mutex mtx_; // 保护日志文件和producers_
+
+    std::mutex wakeMtx_; // 唤醒写线程
+    std::condition_variable cond_;
+    std::atomic<bool> wakeup_; // 已请求唤醒, 写线程醒来时清除
+    std::atomic<bool> running_; // 写线程在运行
+    std::atomic<bool> urgent_; // 有需要立即写出的日志
+
+    std::atomic<int> flushIntervalMS_; // 刷新间隔
+    std::atomic<size_t> flushBytes_; // 刷新阈值
+    std::atomic<int> flushLevel_; // 立即写出的最低等级
 };
 
 /**
@@ -111,7 +194,6 @@ private:
         Log* log = Log::Instance();                  \
         if (log->IsOpen() && log->GetLevel() <= level) { \
             log->Write(level, format, ##__VA_ARGS__); \
-            log->Flush();                            \
         }                                            \
     } while (0);
 
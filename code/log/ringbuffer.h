@@ -0,0 +1,99 @@
+#ifndef RING_BUFFER_H
+#define RING_BUFFER_H
+
+#include <assert.h>
+#include <stddef.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+/**
+ * @brief 单生产者单消费者的无锁字节环形缓冲区
+ * 容量为2的幂, 读写位置单调增长, 取模得到下标; 生产者只写head_, 消费者只写tail_,
+ * 各自缓存对方位置的副本, 只在空间(数据)看起来不够时才读取对方的原子变量
+*/
+class RingBuffer {
+public:
+    /**
+     * @param capacity 容量, 向上取整为2的幂
+    */
+    explicit RingBuffer(size_t capacity)
+        : cap_(RoundUp_(capacity)), buff_(new char[cap_]), head_(0), cachedTail_(0), tail_(0), cachedHead_(0) {}
+
+    RingBuffer(const RingBuffer&) = delete;
+    RingBuffer& operator=(const RingBuffer&) = delete;
+
+    size_t Capacity() const { return cap_; }
+
+    /**
+     * @brief 生产者写入len个字节, 空间不足时什么也不写
+     * @return 是否写入
+    */
+    bool TryPush(const char* data, size_t len) {
+        size_t head = head_.load(std::memory_order_relaxed);
+        if (cap_ - (head - cachedTail_) < len) {
+            cachedTail_ = tail_.load(std::memory_order_acquire);
+            if (cap_ - (head - cachedTail_) < len) {
+                return false;
+            }
+        }
+        size_t idx = head & (cap_ - 1);
+        size_t n = std::min(len, cap_ - idx);
+        memcpy(buff_.get() + idx, data, n);
+        memcpy(buff_.get(), data + n, len - n);
+        head_.store(head + len, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief 消费者取得从读位置开始的一段连续数据, 数据绕回时分两次取
+     * @return 连续可读的字节数, 为0时缓冲区为空
+    */
+    size_t Peek(const char** data) {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        if (cachedHead_ == tail) {
+            cachedHead_ = head_.load(std::memory_order_acquire);
+        }
+        size_t idx = tail & (cap_ - 1);
+        *data = buff_.get() + idx;
+        return std::min(cachedHead_ - tail, cap_ - idx);
+    }
+
+    /**
+     * @brief 消费者归还Peek得到的前len个字节
+    */
+    void Consume(size_t len) {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        assert(len <= cachedHead_ - tail);
+        tail_.store(tail + len, std::memory_order_release);
+    }
+
+    /**
+     * @brief 任意线程读取的近似数据量
+    */
+    size_t ReadableBytes() const {
+        return head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_acquire);
+    }
+
+private:
+    static size_t RoundUp_(size_t n) {
+        size_t cap = 64;
+        while (cap < n) {
+            cap <<= 1;
+        }
+        return cap;
+    }
+
+    const size_t cap_;
+    std::unique_ptr<char[]> buff_;
+
+    /* 两端的位置放在不同的缓存行, 避免伪共享 */
+    alignas(64) std::atomic<size_t> head_;      // 写位置, 生产者修改
+    size_t cachedTail_;                         // 生产者看到的读位置
+    alignas(64) std::atomic<size_t> tail_;      // 读位置, 消费者修改
+    size_t cachedHead_;                         // 消费者看到的写位置
+};
+
+#endif
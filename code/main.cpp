@@ -8,7 +8,10 @@ int main() {
     WebServer server(
         9999, 3, 60000, false,             /* 端口 ET模式 timeoutMs 优雅退出  */
         3306, "root", "123456", "webserver", /* Mysql配置 */
-        12, 6, true, 0, 1024);             /* 连接池数量 线程池数量 日志开关 日志等级 日志异步队列容量 */
+        12, 6, true, 0, 1024,              /* 连接池数量 线程池数量 日志开关 日志等级 日志异步队列容量 */
+        100);                              /* 单个连接最多处理的请求数 */
+    /* 为静态资源生成.gz/.br预压缩文件, 会写入资源目录 */
+    //server.Precompress();
     server.Start();
 } 
   
\ No newline at end of file
@@ -0,0 +1,289 @@
+#include "upstreampool.h"
+
+#include <arpa/inet.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+
+typedef std::chrono::milliseconds MS;
+
+UpstreamPool* UpstreamPool::Instance() {
+    static UpstreamPool pool;
+    return &pool;
+}
+
+UpstreamPool::~UpstreamPool() { ClosePool(); }
+
+/**
+ * @brief 添加上游组, 同名组已存在时更新其策略
+*/
+UpstreamGroup* UpstreamPool::AddGroup(std::string_view name, UpstreamGroup::Balance balance,
+                                      std::string_view healthPath) {
+    UpstreamGroup& group = groups_[std::string(name)];
+    group.name = std::string(name);
+    group.balance = balance;
+    group.healthPath = std::string(healthPath);
+    return &group;
+}
+
+/**
+ * @brief 添加服务器, 主机名在这里解析一次
+*/
+bool UpstreamPool::AddServer(std::string_view group, const char* host, int port) {
+    assert(host);
+    auto it = groups_.find(group);
+    if (it == groups_.end()) {
+        LOG_ERROR("upstream group %.*s not found", (int)group.size(), group.data());
+        return false;
+    }
+    struct addrinfo hints = {0};
+    struct addrinfo* res = nullptr;
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, nullptr, &hints, &res) != 0 || !res) {
+        LOG_ERROR("upstream %s:%d resolve error", host, port);
+        return false;
+    }
+    UpstreamServer server;
+    server.name = std::string(host) + ":" + std::to_string(port);
+    server.addr = *reinterpret_cast<struct sockaddr_in*>(res->ai_addr);
+    server.addr.sin_port = htons(port);
+    freeaddrinfo(res);
+    it->second.servers.push_back(std::move(server));
+    LOG_INFO("upstream %s: %s:%d", it->second.name.c_str(), host, port);
+    return true;
+}
+
+UpstreamGroup* UpstreamPool::Find(std::string_view name) {
+    auto it = groups_.find(name);
+    return it == groups_.end() ? nullptr : &it->second;
+}
+
+/**
+ * @brief 按均衡策略选择服务器, 跳过被摘除的; 全部被摘除时仍然尝试, 避免健康检查误判时拒绝所有请求
+*/
+UpstreamServer* UpstreamPool::Select_(UpstreamGroup* group, const UpstreamServer* avoid) {
+    const size_t n = group->servers.size();
+    UpstreamServer* best = nullptr;
+    for (int pass = 0; pass < 2 && !best; pass++) {
+        for (size_t i = 0; i < n; i++) {
+            UpstreamServer* server = &group->servers[(group->next + i) % n];
+            if (server == avoid || (pass == 0 && !server->healthy)) {
+                continue;
+            }
+            if (group->balance == UpstreamGroup::ROUND_ROBIN) {
+                best = server;
+                break;
+            }
+            if (!best || server->active < best->active) {
+                best = server;
+            }
+        }
+    }
+    if (!best && avoid) {
+        best = const_cast<UpstreamServer*>(avoid);
+    }
+    group->next = (group->next + 1) % n;
+    return best;
+}
+
+bool UpstreamPool::Acquire(UpstreamGroup* group, UpstreamConn* conn, const UpstreamServer* avoid) {
+    assert(group && conn);
+    std::lock_guard<std::mutex> locker(mtx_);
+    if (group->servers.empty()) {
+        return false;
+    }
+    UpstreamServer* server = Select_(group, avoid);
+    conn->server = server;
+    conn->connecting = false;
+    /* 优先复用最近放回的空闲连接; 对端已关闭或发来了数据的连接不能再用 */
+    while (server != avoid && !server->idle.empty()) {
+        int fd = server->idle.back().first;
+        server->idle.pop_back();
+        char ch;
+        if (recv(fd, &ch, 1, MSG_PEEK | MSG_DONTWAIT) < 0 && errno == EAGAIN) {
+            conn->fd = fd;
+            conn->reused = true;
+            server->active++;
+            return true;
+        }
+        close(fd);
+    }
+    conn->reused = false;
+    conn->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (conn->fd < 0) {
+        LOG_ERROR("upstream socket error: %d", errno);
+        return false;
+    }
+    int optval = 1;
+    setsockopt(conn->fd, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof(optval));
+    if (connect(conn->fd, (struct sockaddr*)&server->addr, sizeof(server->addr)) < 0) {
+        if (errno != EINPROGRESS) {
+            LOG_WARN("upstream %s connect error: %d", server->name.c_str(), errno);
+            close(conn->fd);
+            conn->fd = -1;
+            return false;
+        }
+        conn->connecting = true;
+    }
+    server->active++;
+    return true;
+}
+
+void UpstreamPool::Release(UpstreamConn* conn, bool reusable) {
+    assert(conn);
+    if (conn->fd < 0) {
+        return;
+    }
+    std::lock_guard<std::mutex> locker(mtx_);
+    UpstreamServer* server = conn->server;
+    server->active--;
+    if (reusable && server->idle.size() < MAX_IDLE) {
+        server->idle.emplace_back(conn->fd, CoarseClock::Instance()->Now());
+    } else {
+        close(conn->fd);
+    }
+    conn->fd = -1;
+}
+
+void UpstreamPool::ReportFailure(UpstreamServer* server) {
+    assert(server);
+    std::lock_guard<std::mutex> locker(mtx_);
+    if (++server->fails >= MAX_FAILS && server->healthy) {
+        server->healthy = false;
+        LOG_WARN("upstream %s down after %d failures", server->name.c_str(), server->fails);
+    }
+}
+
+void UpstreamPool::ReportSuccess(UpstreamServer* server) {
+    assert(server);
+    std::lock_guard<std::mutex> locker(mtx_);
+    server->fails = 0;
+}
+
+bool UpstreamPool::HealthCheckDue(TimeStamp now) {
+    if (groups_.empty() || now < nextCheck_ || checking_.exchange(true)) {
+        return false;
+    }
+    nextCheck_ = now + MS(HEALTH_INTERVAL_MS);
+    return true;
+}
+
+/**
+ * @brief 探测不持有锁, 只在更新状态时加锁
+*/
+void UpstreamPool::HealthCheck() {
+    for (auto& item : groups_) {
+        UpstreamGroup& group = item.second;
+        for (UpstreamServer& server : group.servers) {
+            bool ok = Probe_(server.addr, group.healthPath, server.name);
+            std::lock_guard<std::mutex> locker(mtx_);
+            if (ok != server.healthy) {
+                LOG_WARN("upstream %s %s", server.name.c_str(), ok ? "up" : "down");
+            }
+            server.healthy = ok;
+            server.fails = ok ? 0 : server.fails;
+            CloseIdle_(&server, !ok, CoarseClock::Instance()->Now());
+        }
+    }
+    checking_ = false;
+}
+
+/**
+ * @brief 关闭过期(或全部)的空闲连接, 调用者持有锁
+*/
+void UpstreamPool::CloseIdle_(UpstreamServer* server, bool all, TimeStamp now) {
+    size_t kept = 0;
+    for (auto& conn : server->idle) {
+        if (all || now - conn.second > MS(IDLE_TIMEOUT_MS)) {
+            close(conn.first);
+        } else {
+            server->idle[kept++] = conn;
+        }
+    }
+    server->idle.resize(kept);
+}
+
+/**
+ * @brief 在超时内建立连接; 配置了路径时再发送GET, 2xx/3xx视为健康
+*/
+bool UpstreamPool::Probe_(const struct sockaddr_in& addr, const std::string& path, const std::string& host) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return false;
+    }
+    bool ok = false;
+    struct pollfd pfd = {fd, POLLOUT, 0};
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if ((connect(fd, (const struct sockaddr*)&addr, sizeof(addr)) == 0 || errno == EINPROGRESS) &&
+        poll(&pfd, 1, HEALTH_TIMEOUT_MS) == 1 && getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) == 0 &&
+        err == 0) {
+        ok = path.empty();
+        if (!ok) {
+            std::string request = "GET " + path + " HTTP/1.1\r\nHost: " + host + "\r\nConnection: close\r\n\r\n";
+            char status[16] = {0};
+            pfd.events = POLLIN;
+            if (send(fd, request.data(), request.size(), MSG_NOSIGNAL) == (ssize_t)request.size() &&
+                poll(&pfd, 1, HEALTH_TIMEOUT_MS) == 1 && recv(fd, status, sizeof(status) - 1, 0) >= 12 &&
+                strncmp(status, "HTTP/1.", 7) == 0) {
+                ok = status[9] == '2' || status[9] == '3';
+            }
+        }
+    }
+    close(fd);
+    return ok;
+}
+
+/**
+ * @brief 管道默认容量64KB, 两端均为非阻塞
+*/
+bool UpstreamPool::AcquirePipe(int fds[2]) {
+    {
+        std::lock_guard<std::mutex> locker(mtx_);
+        if (!pipes_.empty()) {
+            fds[0] = pipes_.back().first;
+            fds[1] = pipes_.back().second;
+            pipes_.pop_back();
+            return true;
+        }
+    }
+    if (pipe2(fds, O_NONBLOCK | O_CLOEXEC) < 0) {
+        LOG_ERROR("pipe error: %d", errno);
+        return false;
+    }
+    return true;
+}
+
+void UpstreamPool::ReleasePipe(int fds[2]) {
+    std::lock_guard<std::mutex> locker(mtx_);
+    if (pipes_.size() < MAX_PIPES) {
+        pipes_.emplace_back(fds[0], fds[1]);
+    } else {
+        close(fds[0]);
+        close(fds[1]);
+    }
+    fds[0] = fds[1] = -1;
+}
+
+void UpstreamPool::ClosePool() {
+    std::lock_guard<std::mutex> locker(mtx_);
+    for (auto& item : groups_) {
+        for (UpstreamServer& server : item.second.servers) {
+            CloseIdle_(&server, true, TimeStamp());
+        }
+    }
+    for (auto& p : pipes_) {
+        close(p.first);
+        close(p.second);
+    }
+    pipes_.clear();
+}
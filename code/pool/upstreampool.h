@@ -0,0 +1,131 @@
+#ifndef UPSTREAMPOOL_H
+#define UPSTREAMPOOL_H
+
+#include <netinet/in.h>
+
+#include <atomic>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "../log/log.h"
+#include "../timer/clock.h"
+
+/**
+ * @brief 一个上游服务器(后端进程)
+*/
+struct UpstreamServer {
+    std::string name;               // host:port, 用于日志
+    struct sockaddr_in addr;
+    bool healthy = true;            // 健康检查或连续失败后置为false, 不再参与负载均衡
+    int fails = 0;                  // 连续失败次数
+    int active = 0;                 // 当前借出的连接数(最少连接数均衡)
+    std::vector<std::pair<int, TimeStamp>> idle;    // 空闲的keep-alive连接及放回时间, 后进先出
+};
+
+/**
+ * @brief 一组可互相替代的上游服务器, 代理路由转发到组
+*/
+struct UpstreamGroup {
+    enum Balance {
+        ROUND_ROBIN,
+        LEAST_CONN,
+    };
+    std::string name;
+    Balance balance = ROUND_ROBIN;
+    std::string healthPath;         // 主动健康检查的路径, 为空时只检查能否建立TCP连接
+    std::deque<UpstreamServer> servers; // 启动后不再增删, 元素地址不变
+    size_t next = 0;                // 轮询位置
+};
+
+/**
+ * @brief 借出的上游连接
+*/
+struct UpstreamConn {
+    int fd = -1;
+    UpstreamServer* server = nullptr;
+    bool reused = false;            // 来自空闲连接, 可能已被对端关闭
+    bool connecting = false;        // 非阻塞connect尚未完成
+};
+
+/**
+ * @brief 上游连接池
+ * 按组的均衡策略选出服务器, 优先复用空闲的keep-alive连接, 否则发起非阻塞connect;
+ * 连续失败的服务器被摘除, 由定期的健康检查恢复. 同时缓存splice用的管道
+*/
+class UpstreamPool {
+public:
+    static UpstreamPool* Instance();
+
+    /**
+     * @brief 添加上游组和其中的服务器, 必须在服务启动前调用
+    */
+    UpstreamGroup* AddGroup(std::string_view name, UpstreamGroup::Balance balance,
+                            std::string_view healthPath = std::string_view());
+    bool AddServer(std::string_view group, const char* host, int port);
+    UpstreamGroup* Find(std::string_view name);
+    bool Empty() const { return groups_.empty(); }
+
+    /**
+     * @brief 借出一个连接
+     * @param avoid 重试时上次失败的服务器, 优先选择其他服务器; 只能选它时不使用空闲连接
+     * @return 没有可用的服务器或connect立即失败时返回false
+    */
+    bool Acquire(UpstreamGroup* group, UpstreamConn* conn, const UpstreamServer* avoid = nullptr);
+
+    /**
+     * @brief 归还连接, reusable为false时关闭
+    */
+    void Release(UpstreamConn* conn, bool reusable);
+
+    /**
+     * @brief 记录一次失败(连接失败、响应前断开), 连续MAX_FAILS次后摘除服务器
+    */
+    void ReportFailure(UpstreamServer* server);
+    void ReportSuccess(UpstreamServer* server);
+
+    /**
+     * @brief 探测所有服务器并清理过期的空闲连接, 由事件循环定期交给工作线程执行
+    */
+    void HealthCheck();
+
+    /**
+     * @brief 是否到了下一次健康检查的时间, 到了则标记为进行中
+    */
+    bool HealthCheckDue(TimeStamp now);
+
+    /**
+     * @brief 取出/放回一个非阻塞管道, 放回的管道必须为空
+    */
+    bool AcquirePipe(int fds[2]);
+    void ReleasePipe(int fds[2]);
+
+    void ClosePool();
+
+    static constexpr int MAX_FAILS = 3;                 // 连续失败多少次后摘除
+    static constexpr size_t MAX_IDLE = 32;              // 每个服务器最多保留的空闲连接
+    static constexpr int IDLE_TIMEOUT_MS = 30000;       // 空闲连接的保留时间, 应小于后端的keep-alive超时
+    static constexpr int HEALTH_INTERVAL_MS = 5000;     // 健康检查间隔
+    static constexpr int HEALTH_TIMEOUT_MS = 1000;      // 单次探测超时
+    static constexpr size_t MAX_PIPES = 64;             // 缓存的管道数
+
+private:
+    UpstreamPool() = default;
+    ~UpstreamPool();
+
+    UpstreamServer* Select_(UpstreamGroup* group, const UpstreamServer* avoid);
+    static bool Probe_(const struct sockaddr_in& addr, const std::string& path, const std::string& host);
+    static void CloseIdle_(UpstreamServer* server, bool all, TimeStamp now);
+
+    std::map<std::string, UpstreamGroup, std::less<>> groups_;  // 启动后只读
+    std::mutex mtx_;                                // 保护服务器状态与空闲连接
+    std::vector<std::pair<int, int>> pipes_;        // 空闲管道
+    std::atomic<bool> checking_{false};             // 健康检查进行中
+    TimeStamp nextCheck_;
+};
+
+#endif
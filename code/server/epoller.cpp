@@ -4,14 +4,22 @@
 /**
  * 构造函数
 */
-Epoller::Epoller(int maxEvent) : epollFd_(epoll_create(512)), events_(maxEvent) {
-    assert(epollFd_ >= 0 && events_.size() > 0);
+Epoller::Epoller(int maxEvent)
+    : epollFd_(epoll_create(512)),
+      timerFd_(timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)),
+      timerArmed_(false),
+      events_(maxEvent) {
+    assert(epollFd_ >= 0 && timerFd_ >= 0 && events_.size() > 0);
+    AddFd(timerFd_, EPOLLIN);
 }
 
 /**
  * 析构函数
 */
-Epoller::~Epoller() { close(epollFd_); }
+Epoller::~Epoller() {
+    close(timerFd_);
+    close(epollFd_);
+}
 
 /**
  * 添加文件描述符
@@ -51,6 +59,37 @@ int Epoller::Wait(int timeoutMs) {
     return epoll_wait(epollFd_, &events_[0], static_cast<int>(events_.size()), timeoutMs);
 }
 
+/**
+ * 设定timerfd, 按绝对时间设定(steady_clock即CLOCK_MONOTONIC), 不受设定前耗时的影响
+*/
+void Epoller::SetTimer(int timeoutMs) {
+    if (timeoutMs < 0) {
+        return;
+    }
+    TimeStamp deadline = CoarseClock::Instance()->Now() + MS(timeoutMs);
+    if (timerArmed_ && timerDeadline_ <= deadline) {
+        return;
+    }
+    int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline.time_since_epoch()).count();
+    struct itimerspec spec = {};
+    spec.it_value.tv_sec = ns / 1000000000;
+    spec.it_value.tv_nsec = ns % 1000000000;
+    if (timerfd_settime(timerFd_, TFD_TIMER_ABSTIME, &spec, nullptr) == 0) {
+        timerArmed_ = true;
+        timerDeadline_ = deadline;
+    }
+}
+
+/**
+ * 读出到期次数, 清除可读状态
+*/
+void Epoller::HandleTimer() {
+    uint64_t expirations;
+    while (read(timerFd_, &expirations, sizeof(expirations)) > 0) {
+    }
+    timerArmed_ = false;
+}
+
 /**
  * 获取事件文件描述符
 */
@@ -5,10 +5,13 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <sys/epoll.h>
+#include <sys/timerfd.h>
 #include <unistd.h>
 
 #include <vector>
 
+#include "../timer/clock.h"
+
 class Epoller {
 public:
     explicit Epoller(int maxEvent = 1024);
@@ -27,8 +30,26 @@ public:
 
     uint32_t GetEvents(size_t i) const;
 
+    /**
+     * @brief 每个Epoller一个timerfd, 构造时注册可读事件, 由事件循环所在的线程设定和处理
+    */
+    int TimerFd() const { return timerFd_; }
+
+    /**
+     * @brief timeoutMs毫秒后唤醒Wait; 已设定的唤醒时间不晚于它时不改动, 多次设定合并为最早的一次
+    */
+    void SetTimer(int timeoutMs);
+
+    /**
+     * @brief 处理timerfd的可读事件, 之后的SetTimer会重新设定
+    */
+    void HandleTimer();
+
 private:
     int epollFd_;
+    int timerFd_;
+    bool timerArmed_;           // timerfd已设定且尚未处理到期事件
+    TimeStamp timerDeadline_;   // 已设定的唤醒时间
 
     std::vector<struct epoll_event> events_;
 };
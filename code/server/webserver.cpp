@@ -3,15 +3,29 @@
 WebServer::WebServer(int port, int trigMode, int timeoutMS, bool OptLinger, int sqlPort,
                      const char* sqlUser, const char* sqlPwd, const char* dbName,
                      int connPoolNum, int threadNum, bool openLog, int logLevel,
-                     int logQueSize)
+                     int logQueSize, int keepAliveMax)
     : port_(port), openLinger_(OptLinger), timeoutMS_(timeoutMS), isClose_(false),
-      timer_(new HeapTimer()), threadpool_(new ThreadPool(threadNum)), epoller_(new Epoller()) {
+      timer_(new TimingWheel(TIMER_TICK_MS, [this](TimerNode* node) { OnTimeout_(node); })),
+      threadpool_(new ThreadPool(threadNum)), epoller_(new Epoller()),
+      router_(new Router()) {
 
-    assert(srcDir_);
     srcDir_ = getcwd(nullptr, 256);
+    assert(srcDir_);
     strncat(srcDir_, "/../resources/", 16);
     HttpConn::userCount = 0;
     HttpConn::srcDir = srcDir_;
+    HttpConn::timeoutMS = timeoutMS_;
+    HttpConn::keepAliveMax = keepAliveMax;
+    HttpConn::router = router_.get();
+    /* WebSocket连接空闲时有了待发送数据(其他连接的广播), 注册可写事件 */
+    WebSocketHub::Instance()->SetWakeup([this](int fd) { epoller_->ModFd(fd, connEvent_ | EPOLLOUT); });
+    /* 代理换用或释放上游连接前, 把它从Epoller和归属表中注销 */
+    ProxySession::SetUnwatch([this](int fd) {
+        epoller_->DelFd(fd);
+        std::lock_guard<std::mutex> locker(upstreamMtx_);
+        upstreamOwners_.erase(fd);
+    });
+    InitRoutes_();
     SqlConnPool::Instance()->Init("localhost", sqlPort, sqlUser, sqlPwd, dbName, connPoolNum);  // 连接池初始化
 
     InitEventMode_(trigMode);  // 处理模式
@@ -32,18 +46,36 @@ WebServer::WebServer(int port, int trigMode, int timeoutMS, bool OptLinger, int
         LOG_INFO("LogSys level: %d", logLevel);
         LOG_INFO("srcDir: %s", HttpConn::srcDir);
         LOG_INFO("SqlConnPool num: %d, ThreadPool num: %d", connPoolNum, threadNum);
+        LOG_INFO("Keep-Alive timeout: %dms, max requests: %d", timeoutMS_, keepAliveMax);
         }
     }
+
+    HttpResponse::InitErrorPages(srcDir_);
+    /* 静态资源缓存, 资源目录变化时由inotify通知失效 */
+    FileCache::Instance()->Init(srcDir_);
+    /* 页面每次验证, 样式/脚本/图片等按ETag长时间缓存 */
+    FileCache::Instance()->AddCacheRule("text/html", 0);
+    FileCache::Instance()->AddCacheRule("/css/", 7 * 24 * 3600);
+    FileCache::Instance()->AddCacheRule("/js/", 7 * 24 * 3600);
+    FileCache::Instance()->AddCacheRule("image/", 30 * 24 * 3600);
+    FileCache::Instance()->AddCacheRule("font/", 30 * 24 * 3600);
+    FileCache::Instance()->AddCacheRule("video/", 24 * 3600);
+    if (FileCache::Instance()->WatchFd() >= 0) {
+        epoller_->AddFd(FileCache::Instance()->WatchFd(), EPOLLIN);
+    }
 }
 
 /**
  * @brief 析构函数
  */
 WebServer::~WebServer() {
+    /* 定时器节点嵌在users_的连接中, 先于users_析构摘下 */
+    timer_->clear();
     close(listenFd_);
     isClose_ = true;
     free(srcDir_);
     SqlConnPool::Instance()->ClosePool();
+    UpstreamPool::Instance()->ClosePool();
 }
 
 /**
@@ -74,6 +106,110 @@ void WebServer::InitEventMode_(int trigMode) {
     HttpConn::isET = (connEvent_ & EPOLLET);
 }
 
+/**
+ * @brief 注册默认路由
+*/
+void WebServer::InitRoutes_() {
+    /* 默认网页 */
+    const char* pages[][2] = {
+        {"/", "/index.html"},          {"/index", "/index.html"},     {"/register", "/register.html"},
+        {"/login", "/login.html"},     {"/welcome", "/welcome.html"}, {"/video", "/video.html"},
+        {"/picture", "/picture.html"},
+    };
+    for (auto& page : pages) {
+        std::string_view file = page[1];
+        router_->Get(page[0], [file](HttpRequest& req, HttpResponse& resp) { resp.SetFile(file); });
+    }
+
+    /* 注册和登录 */
+    auto verify = [](bool isLogin) {
+        return [isLogin](HttpRequest& req, HttpResponse& resp) {
+            bool ok = HttpRequest::UserVerify(req.GetPost("username"), req.GetPost("password"), isLogin);
+            resp.SetFile(ok ? "/welcome.html" : "/error.html");
+        };
+    };
+    router_->Post("/register", verify(false));
+    router_->Post("/register.html", verify(false));
+    router_->Post("/login", verify(true));
+    router_->Post("/login.html", verify(true));
+
+    /* 示例聊天室: 收到的消息广播给所有连接 */
+    WebSocket::Handler chat;
+    chat.onMessage = [](WebSocket& ws, WebSocket::Opcode opcode, std::string_view message) {
+        ws.Broadcast(opcode, message);
+    };
+    AddWebSocket("/chat", chat);
+
+    /* 其余GET请求返回资源目录下的静态文件 */
+    router_->Get("/*filepath", [](HttpRequest& req, HttpResponse& resp) { resp.SetFile(req.path()); });
+}
+
+/**
+ * @brief 注册自定义路由
+*/
+void WebServer::AddRoute(const char* method, const char* pattern, const Router::Handler& handler) {
+    router_->Add(method, pattern, handler);
+}
+
+/**
+ * @brief 注册WebSocket端点
+*/
+void WebServer::AddWebSocket(const char* path, const WebSocket::Handler& handler) {
+    WebSocketHub::Instance()->Register(path, handler);
+}
+
+/**
+ * @brief 配置上游组
+*/
+void WebServer::AddUpstreamGroup(const char* group, UpstreamGroup::Balance balance, const char* healthPath) {
+    UpstreamPool::Instance()->AddGroup(group, balance, healthPath);
+}
+
+/**
+ * @brief 向上游组添加服务器
+*/
+bool WebServer::AddUpstream(const char* group, const char* host, int port) {
+    return UpstreamPool::Instance()->AddServer(group, host, port);
+}
+
+/**
+ * @brief 注册代理路由, 上游组需要已经配置
+*/
+void WebServer::AddProxy(const char* pattern, const char* group) {
+    UpstreamGroup* upstream = UpstreamPool::Instance()->Find(group);
+    assert(upstream);
+    router_->Add("*", pattern, [upstream](HttpRequest& req, HttpResponse& resp) { resp.SetProxy(upstream); });
+}
+
+/**
+ * @brief 各阶段的超时, keep-alive空闲超时为构造时的timeoutMS
+*/
+void WebServer::SetTimeouts(int headerMS, int bodyMS, int bodyMinRate, int writeMS, int writeMinRate) {
+    HttpConn::headerTimeoutMS = headerMS;
+    HttpConn::bodyTimeoutMS = bodyMS;
+    HttpConn::bodyMinRate = bodyMinRate;
+    HttpConn::writeTimeoutMS = writeMS;
+    HttpConn::writeMinRate = writeMinRate;
+}
+
+/**
+ * @brief 生成预压缩文件, 已是最新的跳过; 文件缓存按需加载, Start之前还没有缓存项需要失效
+*/
+void WebServer::Precompress() {
+    Compressor::PrecompressDir(srcDir_);
+}
+
+/**
+ * @brief 启用TLS; OpenSSL和kTLS写socket时不带MSG_NOSIGNAL, 忽略SIGPIPE
+*/
+bool WebServer::EnableTls(const char* certFile, const char* keyFile, bool http2) {
+    if (!TlsContext::Instance()->Init(certFile, keyFile, http2)) {
+        return false;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    return true;
+}
+
 /**
  * @brief 初始化socket
 */
@@ -145,20 +281,37 @@ bool WebServer::InitSocket_() {
  * @brief 开始运行
 */
 void WebServer::Start() {
-    int timeMS = -1;
+    router_->Freeze();
     if (!isClose_) {
         LOG_INFO("========== Server start ==========");
     }
+    CoarseClock::Instance()->Update();
     while (!isClose_) {
-        if (timeoutMS_ > 0) {
-            timeMS = timer_->GetNextTick();
+        /* 定时器由timerfd唤醒; 至少每秒醒来一次刷新时钟, 工作线程和日志线程读到的时间不会过旧 */
+        int eventCnt = epoller_->Wait(CLOCK_REFRESH_MS);
+        CoarseClock::Instance()->Update();
+        /* 健康检查会阻塞等待探测结果, 交给工作线程 */
+        if (UpstreamPool::Instance()->HealthCheckDue(CoarseClock::Instance()->Now())) {
+            threadpool_->AddTask([] { UpstreamPool::Instance()->HealthCheck(); });
         }
-        int eventCnt = epoller_->Wait(timeMS);
         for (int i = 0; i < eventCnt; i++) {
             int fd = epoller_->GetEventFd(i);
             uint32_t events = epoller_->GetEvents(i);
             if (fd == listenFd_) {
                 DealListen_();
+            } else if (fd == epoller_->TimerFd()) {
+                epoller_->HandleTimer();
+                ArmTimer_();
+            } else if (fd == FileCache::Instance()->WatchFd()) {
+                FileCache::Instance()->HandleEvents();
+            } else if (HttpConn* owner = FindUpstreamOwner_(fd)) {
+                /* 上游连接的任何事件(包括挂断)都交给代理处理 */
+                ExtentTime_(owner);
+                Dispatch_(owner, &WebServer::OnUpstream_);
+            } else if (users_.count(fd) > 0 && users_[fd].IsWebSocket() &&
+                       !users_[fd].GetWebSocket()->Acquire()) {
+                /* 工作线程正在处理该连接, 事件由其他线程发送时的唤醒引起, 处理完后会重新注册 */
+                continue;
             } else if (events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
                 assert(users_.count(fd) > 0);
                 CloseConn_(&users_[fd]);
@@ -182,7 +335,10 @@ void WebServer::AddClient_(int fd, sockaddr_in addr) {
     assert(fd > 0);
     users_[fd].init(fd, addr);
     if (timeoutMS_ > 0) {
-        timer_->add(fd, timeoutMS_, std::bind(&WebServer::CloseConn_, this, &users_[fd]));
+        /* 新连接处于请求头阶段 */
+        users_[fd].Touch(CoarseClock::Instance()->Now());
+        ArmConn_(&users_[fd], users_[fd].Deadline());
+        ArmTimer_();
     }
     epoller_->AddFd(fd, EPOLLIN | connEvent_);
     SetFdNonblock(fd);
@@ -201,7 +357,7 @@ void WebServer::DealListen_() {
         if (fd <= 0) {
             return;
         } else if (HttpConn::userCount >= MAX_FD) {
-            SendError_(fd, "Server busy!");
+            SendError_(fd, 503);
             LOG_WARN("Clients is full!");
             return;
         }
@@ -215,7 +371,7 @@ void WebServer::DealListen_() {
 void WebServer::DealWrite_(HttpConn* client) {
     assert(client);
     ExtentTime_(client);
-    threadpool_->AddTask(std::bind(&WebServer::OnWrite_, this, client));
+    Dispatch_(client, &WebServer::OnWrite_);
 }
 
 /**
@@ -223,15 +379,47 @@ void WebServer::DealWrite_(HttpConn* client) {
 */
 void WebServer::DealRead_(HttpConn* client) {
     assert(client);
+    /* 空闲的keep-alive连接上有数据到达, 下一个请求开始, 按请求头期限计时 */
+    if (client->GetPhase() == HttpConn::IDLE) {
+        client->SetPhase(HttpConn::HEADER);
+    }
     ExtentTime_(client);
-    threadpool_->AddTask(std::bind(&WebServer::OnRead_, this, client));
+    Dispatch_(client, &WebServer::OnRead_);
+}
+
+/**
+ * @brief 交给工作线程处理; 处理完之前连接归该线程所有, 定时器到期时不在主线程关闭它
+*/
+void WebServer::Dispatch_(HttpConn* client, void (WebServer::*task)(HttpConn*)) {
+    client->Dispatch();
+    threadpool_->AddTask([this, client, task] {
+        (this->*task)(client);
+        client->Finish();
+    });
 }
 
 /**
  * @brief 处理请求
 */
 void WebServer::OnProcess_(HttpConn* client) {
-    if (client->process()) {
+    bool writable = client->process();
+    if (client->GetProxy()) {
+        HandleProxy_(client, client->GetProxy()->GetStatus());
+        return;
+    }
+    if (client->IsWebSocket()) {
+        /* 关闭帧发送完后断开, 否则按发送队列是否为空重新注册 */
+        if (!client->IsKeepAlive() && client->ToWriteBytes() == 0) {
+            CloseConn_(client);
+            return;
+        }
+        int fd = client->GetFd();
+        client->GetWebSocket()->Release([this, fd](bool hasOutput) {
+            epoller_->ModFd(fd, connEvent_ | (hasOutput ? EPOLLOUT : EPOLLIN));
+        });
+        return;
+    }
+    if (writable) {
         epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLOUT);
     } else {
         epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLIN);
@@ -260,7 +448,24 @@ void WebServer::OnWrite_(HttpConn* client) {
     assert(client);
     int ret = -1;
     int writeErrno = 0;
+    if (client->GetProxy()) {
+        HandleProxy_(client, client->GetProxy()->OnClient());
+        return;
+    }
+    if (client->IsHandshaking()) {
+        /* TLS握手等待可写, 继续握手, 之后与读事件相同 */
+        OnRead_(client);
+        return;
+    }
     ret = client->write(&writeErrno);
+    if (client->IsWebSocket()) {
+        if (ret < 0 && writeErrno != EAGAIN) {
+            CloseConn_(client);
+            return;
+        }
+        OnProcess_(client);
+        return;
+    }
     if (client->ToWriteBytes() == 0) {
         /* 数据已经全部写完 */
         if (client->IsKeepAlive()) {
@@ -277,6 +482,69 @@ void WebServer::OnWrite_(HttpConn* client) {
     CloseConn_(client);
 }
 
+/**
+ * @brief 上游连接事件处理
+*/
+void WebServer::OnUpstream_(HttpConn* client) {
+    assert(client);
+    ProxySession* proxy = client->GetProxy();
+    if (!proxy) {
+        return;
+    }
+    HandleProxy_(client, proxy->OnUpstream());
+}
+
+/**
+ * @brief 代理未结束时注册下一步等待的事件(上游与客户端同一时刻只等待一个);
+ * 结束后继续处理该连接上的下一个请求, 或发送502, 或关闭
+*/
+void WebServer::HandleProxy_(HttpConn* client, ProxySession::Status status) {
+    switch (status) {
+        case ProxySession::WAIT_UPSTREAM_READ:
+            WatchUpstream_(client, EPOLLIN);
+            return;
+        case ProxySession::WAIT_UPSTREAM_WRITE:
+            WatchUpstream_(client, EPOLLOUT);
+            return;
+        case ProxySession::WAIT_CLIENT_WRITE:
+            epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLOUT);
+            return;
+        default:
+            break;
+    }
+    if (!client->FinishProxy()) {
+        CloseConn_(client);
+    } else if (client->ToWriteBytes() > 0) {
+        epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLOUT);
+    } else {
+        OnProcess_(client);
+    }
+}
+
+/**
+ * @brief 上游fd按水平触发和EPOLLONESHOT注册, 第一次等待时加入归属表
+*/
+void WebServer::WatchUpstream_(HttpConn* client, uint32_t events) {
+    ProxySession* proxy = client->GetProxy();
+    int fd = proxy->UpstreamFd();
+    if (proxy->WatchedFd() == fd) {
+        epoller_->ModFd(fd, EPOLLONESHOT | events);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> locker(upstreamMtx_);
+        upstreamOwners_[fd] = client;
+    }
+    proxy->SetWatchedFd(fd);
+    epoller_->AddFd(fd, EPOLLONESHOT | events);
+}
+
+HttpConn* WebServer::FindUpstreamOwner_(int fd) {
+    std::lock_guard<std::mutex> locker(upstreamMtx_);
+    auto it = upstreamOwners_.find(fd);
+    return it == upstreamOwners_.end() ? nullptr : it->second;
+}
+
 /**
  * @brief 关闭连接
 */
@@ -290,9 +558,27 @@ void WebServer::CloseConn_(HttpConn* client) {
 /**
  * @brief 发送错误信息
 */
-void WebServer::SendError_(int fd, const char* info) {
+void WebServer::SendError_(int fd, int code) {
     assert(fd > 0);
-    int ret = send(fd, info, strlen(info), 0);
+    if (TlsContext::Instance()->Enabled()) {
+        /* TLS监听上握手之前无法发送响应 */
+        close(fd);
+        return;
+    }
+    /* 预先生成的错误响应, 不经过HttpConn */
+    const HttpResponse::ErrorPage* page = HttpResponse::FindErrorPage(code);
+    assert(page);
+    char date[64];
+    std::string_view now = CoarseClock::Instance()->HttpDate();
+    int len = snprintf(date, sizeof(date), "Date: %.*s\r\n\r\n", (int)now.size(), now.data());
+    struct iovec iov[3];
+    iov[0].iov_base = const_cast<char*>(page->header[0].data());
+    iov[0].iov_len = page->header[0].size();
+    iov[1].iov_base = date;
+    iov[1].iov_len = len;
+    iov[2].iov_base = const_cast<char*>(page->body.data());
+    iov[2].iov_len = page->body.size();
+    ssize_t ret = writev(fd, iov, 3);
     if (ret < 0) {
         LOG_WARN("send error to client[%d] error!", fd);
     }
@@ -300,15 +586,66 @@ void WebServer::SendError_(int fd, const char* info) {
 }
 
 /**
- * @brief 延长超时时间
+ * @brief 延长超时时间: 只记录活动时间, 定时器到期时再顺延;
+ * 只有进入了期限更早的阶段(如keep-alive连接开始新请求)时才提前定时器
 */
 void WebServer::ExtentTime_(HttpConn* client) {
     assert(client);
+    if (timeoutMS_ > 0 && !client->IsWebSocket()) {
+        client->Touch(CoarseClock::Instance()->Now());
+        TimeStamp deadline = client->Deadline();
+        if (deadline < client->ArmedDeadline()) {
+            epoller_->SetTimer(ArmConn_(client, deadline));
+        }
+    }
+}
+
+/**
+ * @brief 连接的定时器在deadline到期
+ * @return 距到期的毫秒数
+*/
+int WebServer::ArmConn_(HttpConn* client, TimeStamp deadline) {
+    TimeStamp now = CoarseClock::Instance()->Now();
+    int timeout = deadline > now ? std::chrono::ceil<MS>(deadline - now).count() : 0;
+    client->SetArmedDeadline(deadline);
+    timer_->add(client->GetTimer(), timeout);
+    return timeout;
+}
+
+/**
+ * @brief 处理到期的定时器并设定下一次唤醒; timerfd已设定得更早时不重复设定
+*/
+void WebServer::ArmTimer_() {
     if (timeoutMS_ > 0) {
-        timer_->adjust(client->GetFd(), timeoutMS_);
+        epoller_->SetTimer(timer_->GetNextTick());
     }
 }
 
+/**
+ * @brief 超时: 按连接当前的阶段重新计算期限, 期间有进展(读写事件、传输的字节)而延后的重新定时, 否则关闭;
+ * 升级为WebSocket的连接不受空闲超时管理, 已被工作线程关闭的连接不再定时, 到期时忽略;
+ * 工作线程正在处理的连接(包括其代理会话)不能在主线程释放, 过一个tick再检查, 由处理完后的期限决定
+*/
+void WebServer::OnTimeout_(TimerNode* node) {
+    HttpConn* client = static_cast<HttpConn*>(node->data);
+    assert(client);
+    if (client->IsWebSocket() || client->IsClosed()) {
+        return;
+    }
+    TimeStamp now = CoarseClock::Instance()->Now();
+    if (client->IsDispatched()) {
+        ArmConn_(client, now + MS(TIMER_TICK_MS));
+        return;
+    }
+    TimeStamp deadline = client->Deadline();
+    if (deadline > now) {
+        ArmConn_(client, deadline);
+        return;
+    }
+    LOG_INFO("Client[%d] timeout in phase %d", client->GetFd(), client->GetPhase());
+    CloseConn_(client);
+}
+
 
 /**
  * @brief 设置文件描述符非阻塞
@@ -5,10 +5,12 @@
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <signal.h>
 #include <netinet/in.h>
 #include <sys/socket.h>
 #include <unistd.h>
 
+#include <mutex>
 #include <unordered_map>
 
 #include "../http/httpconn.h"
@@ -16,38 +18,96 @@
 #include "../pool/sqlconnRAII.h"
 #include "../pool/sqlconnpool.h"
 #include "../pool/threadpool.h"
-#include "../timer/heaptimer.h"
+#include "../pool/upstreampool.h"
+#include "../timer/timingwheel.h"
 #include "epoller.h"
 
 class WebServer {
 public:
     WebServer(int port, int trigMode, int timeoutMS, bool OptLinger, int sqlPort,
               const char* sqlUser, const char* sqlPwd, const char* dbName, int connPoolNum,
-              int threadNum, bool openLog, int logLevel, int logQueSize);
+              int threadNum, bool openLog, int logLevel, int logQueSize, int keepAliveMax = 100);
 
     ~WebServer();
     void Start();
 
+    /**
+     * @brief 注册自定义路由, 必须在Start之前调用
+    */
+    void AddRoute(const char* method, const char* pattern, const Router::Handler& handler);
+
+    /**
+     * @brief 注册WebSocket端点, 必须在Start之前调用
+    */
+    void AddWebSocket(const char* path, const WebSocket::Handler& handler);
+
+    /**
+     * @brief 配置上游组和其中的服务器, 必须在Start之前调用
+     * @param healthPath 健康检查请求的路径, 为空时只检查TCP连接
+    */
+    void AddUpstreamGroup(const char* group, UpstreamGroup::Balance balance, const char* healthPath = "");
+    bool AddUpstream(const char* group, const char* host, int port);
+
+    /**
+     * @brief 注册代理路由: 匹配的请求(任意方法)转发给上游组, pattern与AddRoute相同, 通常为以 *name 结尾的前缀路由
+    */
+    void AddProxy(const char* pattern, const char* group);
+
+    /**
+     * @brief 监听socket改为TLS, 必须在Start之前调用
+     * @param certFile PEM格式的证书链
+     * @param keyFile PEM格式的私钥
+     * @param http2 ALPN是否协商h2, 代理路由只支持HTTP/1
+     * @return 证书或私钥无效时返回false, 保持明文
+    */
+    bool EnableTls(const char* certFile, const char* keyFile, bool http2 = true);
+
+    /**
+     * @brief 配置请求头、请求体、响应发送三个阶段的超时, 必须在Start之前调用; 构造时的timeoutMS为keep-alive空闲超时
+     * @param headerMS 收全请求头的期限, 从连接建立或keep-alive连接收到下一个请求的第一个字节起算
+     * @param bodyMS, writeMS 请求体和响应的基础期限, 每传输minRate字节延长1秒
+     * @param bodyMinRate, writeMinRate 最低速率(字节/秒), <=0时改为距上次读写超过期限才超时
+    */
+    void SetTimeouts(int headerMS, int bodyMS, int bodyMinRate, int writeMS, int writeMinRate);
+
+    /**
+     * @brief 为资源目录下可压缩的文件生成缺失或过期的.gz/.br, 必须在Start之前调用
+     * 会写入资源目录, 默认不生成; 资源目录只读或由部署流程生成预压缩文件时不要调用
+    */
+    void Precompress();
+
 private:
     bool InitSocket_();                     // 初始化socket
     void InitEventMode_(int trigMode);      // 初始化事件模式
+    void InitRoutes_();                     // 注册默认路由
     void AddClient_(int fd, sockaddr_in addr);  // 添加客户端
 
     void DealListen_();                     // 处理监听事件
     void DealWrite_(HttpConn* client);      // 处理写事件
     void DealRead_(HttpConn* client);       // 处理读事件
+    void Dispatch_(HttpConn* client, void (WebServer::*task)(HttpConn*));  // 把连接交给工作线程, 记录在处理中
 
-    void SendError_(int fd, const char* info);  // 发送错误信息
+    void SendError_(int fd, int code);          // 发送预先生成的错误响应
     void ExtentTime_(HttpConn* client);         // 延长超时时间
     void CloseConn_(HttpConn* client);          // 关闭连接
+    void OnTimeout_(TimerNode* node);           // 超时
+    int ArmConn_(HttpConn* client, TimeStamp deadline); // 设定连接的定时器
+    void ArmTimer_();                           // 按时间轮中最早的到期时间设定timerfd
 
     void OnRead_(HttpConn* client);             // 读事件处理
     void OnWrite_(HttpConn* client);            // 写事件处理
     void OnProcess_(HttpConn* client);          // 处理请求
+    void OnUpstream_(HttpConn* client);         // 上游连接事件处理
+
+    void HandleProxy_(HttpConn* client, ProxySession::Status status);  // 按代理状态注册事件或结束代理
+    void WatchUpstream_(HttpConn* client, uint32_t events);             // 在Epoller上等待上游fd
+    HttpConn* FindUpstreamOwner_(int fd);                               // 上游fd所属的客户端连接
 
     static int SetFdNonblock(int fd);           // 设置文件描述符非阻塞
 
-    static const int MAX_FD = 65536;            // 最大文件描述符数量
+    static constexpr int MAX_FD = 65536;            // 最大文件描述符数量
+    static constexpr int CLOCK_REFRESH_MS = 1000;   // 空闲时刷新时钟的间隔
+    static constexpr int TIMER_TICK_MS = 100;       // 时间轮的精度, 超时最多推迟一个tick
     int port_;                                  // 端口号
     bool openLinger_;                           // 是否开启优雅关闭
     int timeoutMS_;                             // 超时时间
@@ -58,11 +118,15 @@ private:
     uint32_t listenEvent_;                      // 监听的文件描述符的事件
     uint32_t connEvent_;                        // 连接的文件描述符的事件
 
-    std::unique_ptr<HeapTimer> timer_;          // 堆定时器
+    std::unique_ptr<TimingWheel> timer_;        // 时间轮定时器, 节点嵌在HttpConn中
     std::unique_ptr<ThreadPool> threadpool_;    // 线程池
     std::unique_ptr<Epoller> epoller_;          // 事件处理对象
+    std::unique_ptr<Router> router_;            // 路由表, Start之后只读
     std::unordered_map<int, HttpConn> users_;   // 用户信息
 
+    std::mutex upstreamMtx_;                        // 上游fd在工作线程中注册和注销
+    std::unordered_map<int, HttpConn*> upstreamOwners_; // 已注册到Epoller的上游fd -> 客户端连接
+
 };
 
 #endif
\ No newline at end of file
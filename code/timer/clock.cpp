@@ -0,0 +1,72 @@
+#include "clock.h"
+
+#include <string.h>
+
+CoarseClock::CoarseClock() : cur_(0), steady_(0), wallUs_(0) {
+    memset(slots_, 0, sizeof(slots_));
+    slots_[0].sec = -1;
+    Update();
+}
+
+/**
+ * @brief 获取单例
+*/
+CoarseClock* CoarseClock::Instance() {
+    static CoarseClock clock;
+    return &clock;
+}
+
+/**
+ * @brief 刷新缓存的时间, 秒数变化时才重新格式化
+*/
+void CoarseClock::Update() {
+    std::lock_guard<std::mutex> locker(mtx_);
+    steady_.store(SteadyClock::now().time_since_epoch().count(), std::memory_order_release);
+
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    int cur = cur_.load(std::memory_order_relaxed);
+    if (ts.tv_sec != slots_[cur].sec) {
+        int next = (cur + 1) % SLOT_NUM;
+        Slot& slot = slots_[next];
+        slot.sec = ts.tv_sec;
+        localtime_r(&slot.sec, &slot.local);
+        struct tm gmt;
+        gmtime_r(&slot.sec, &gmt);
+        slot.httpDateLen = strftime(slot.httpDate, sizeof(slot.httpDate), "%a, %d %b %Y %H:%M:%S GMT", &gmt);
+        strftime(slot.logTime, sizeof(slot.logTime), "%Y-%m-%d %H:%M:%S", &slot.local);
+        cur_.store(next, std::memory_order_release);
+    }
+    wallUs_.store(int64_t(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000, std::memory_order_release);
+}
+
+/**
+ * @brief HTTP日期
+*/
+std::string_view CoarseClock::HttpDate() const {
+    const Slot& slot = slots_[cur_.load(std::memory_order_acquire)];
+    return std::string_view(slot.httpDate, slot.httpDateLen);
+}
+
+/**
+ * @brief 日志时间戳, 只拼接预先格式化的秒和微秒
+*/
+size_t CoarseClock::LogTime(char* buf, struct tm* local) const {
+    const Slot& slot = slots_[cur_.load(std::memory_order_acquire)];
+    int64_t us = wallUs_.load(std::memory_order_acquire);
+    /* 读取之间跨过了一秒: 以槽为准, 微秒取该秒的开头或末尾, 保证时间不倒退 */
+    time_t sec = us / 1000000;
+    long usec = sec == slot.sec ? us % 1000000 : (sec < slot.sec ? 0 : 999999);
+    memcpy(buf, slot.logTime, 19);
+    buf[19] = '.';
+    for (int i = 25; i >= 20; i--) {
+        buf[i] = char('0' + usec % 10);
+        usec /= 10;
+    }
+    buf[26] = ' ';
+    buf[27] = '\0';
+    if (local) {
+        *local = slot.local;
+    }
+    return 27;
+}
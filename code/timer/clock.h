@@ -0,0 +1,75 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <stdint.h>
+#include <time.h>
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string_view>
+
+typedef std::chrono::steady_clock SteadyClock;     // 单调时钟
+typedef SteadyClock::time_point TimeStamp;          // 时间戳
+typedef std::chrono::milliseconds MS;              // 毫秒
+
+/**
+ * @brief 粗粒度时钟
+ * 主线程每轮事件循环Update一次, 其余地方读取缓存的时间, 不再各自调用时钟和格式化;
+ * 每秒只格式化一次HTTP日期和日志时间, 结果放在环形槽中, 读者无锁
+*/
+class CoarseClock {
+public:
+    static CoarseClock* Instance();
+
+    /**
+     * @brief 读取系统时钟并刷新缓存, 只应由事件循环调用
+    */
+    void Update();
+
+    /**
+     * @brief 上次Update时的单调时间
+    */
+    TimeStamp Now() const { return TimeStamp(SteadyClock::duration(steady_.load(std::memory_order_acquire))); }
+
+    /**
+     * @brief 上次Update时的墙上时间(秒)
+    */
+    time_t WallTime() const { return slots_[cur_.load(std::memory_order_acquire)].sec; }
+
+    /**
+     * @brief RFC 7231格式的日期, 如 "Sun, 06 Nov 1994 08:49:37 GMT"
+    */
+    std::string_view HttpDate() const;
+
+    /**
+     * @brief 日志时间戳 "YYYY-MM-DD HH:MM:SS.uuuuuu "
+     * @param buf 至少LOG_TIME_LEN字节
+     * @param local 返回对应的本地时间, 可为空
+     * @return 写入的长度
+    */
+    size_t LogTime(char* buf, struct tm* local) const;
+
+    static const size_t LOG_TIME_LEN = 28;
+
+private:
+    CoarseClock();
+
+    struct Slot {
+        time_t sec;                 // 墙上时间(秒)
+        struct tm local;            // 本地时间
+        char httpDate[32];          // HTTP日期
+        size_t httpDateLen;
+        char logTime[20];           // "YYYY-MM-DD HH:MM:SS"
+    };
+
+    static const int SLOT_NUM = 4;  // 每秒才切换一次槽, 读者不会读到正在改写的槽
+
+    Slot slots_[SLOT_NUM];
+    std::atomic<int> cur_;                  // 当前槽
+    std::atomic<int64_t> steady_;           // 单调时间, 纳秒
+    std::atomic<int64_t> wallUs_;           // 墙上时间, 微秒
+    std::mutex mtx_;                        // 写者互斥
+};
+
+#endif
@@ -0,0 +1,163 @@
+#include "timingwheel.h"
+
+#include <algorithm>
+
+/**
+ * @brief 构造函数, 各槽初始化为空的循环链表
+ * @param tickMS 定时精度(毫秒)
+ * @param cb 到期回调
+*/
+TimingWheel::TimingWheel(int tickMS, const TimeoutCallBack& cb)
+    : current_(0), count_(0), tickMS_(tickMS), start_(CoarseClock::Instance()->Now()), callback_(cb) {
+    assert(tickMS_ > 0);
+    for (int i = 0; i < LEVEL_NUM; i++) {
+        for (int j = 0; j < SLOT_NUM; j++) {
+            slots_[i][j].prev = slots_[i][j].next = &slots_[i][j];
+        }
+    }
+}
+
+/**
+ * @brief 时钟启动以来经过的tick数(向下取整)
+*/
+uint64_t TimingWheel::Now_() const {
+    return std::chrono::duration_cast<MS>(CoarseClock::Instance()->Now() - start_).count() / tickMS_;
+}
+
+/**
+ * @brief 定时, 到期时间向上取整到tick, 不会提前到期
+*/
+void TimingWheel::add(TimerNode* node, int timeout) {
+    assert(node && timeout >= 0);
+    if (node->Linked()) {
+        Unlink_(node);
+    } else {
+        count_++;
+    }
+    int64_t elapsed = std::chrono::duration_cast<MS>(CoarseClock::Instance()->Now() - start_).count();
+    node->expires = std::max<uint64_t>((elapsed + timeout + tickMS_ - 1) / tickMS_, current_);
+    Insert_(node);
+}
+
+void TimingWheel::del(TimerNode* node) {
+    assert(node);
+    if (node->Linked()) {
+        Unlink_(node);
+        count_--;
+    }
+}
+
+void TimingWheel::clear() {
+    for (int i = 0; i < LEVEL_NUM; i++) {
+        for (int j = 0; j < SLOT_NUM; j++) {
+            Slot* slot = &slots_[i][j];
+            while (slot->next != slot) {
+                Unlink_(slot->next);
+            }
+        }
+    }
+    count_ = 0;
+}
+
+/**
+ * @brief 按距到期的tick数选层: 相差不到SLOT_NUM^(i+1)的放在第i层, 槽号取到期tick在该层的位
+*/
+void TimingWheel::Insert_(TimerNode* node) {
+    assert(node->expires >= current_);
+    uint64_t delta = node->expires - current_;
+    int level = 0;
+    while (level < LEVEL_NUM - 1 && delta >= (uint64_t(1) << (SLOT_BITS * (level + 1)))) {
+        level++;
+    }
+    if (delta >= (uint64_t(1) << (SLOT_BITS * LEVEL_NUM))) {
+        node->expires = current_ + (uint64_t(1) << (SLOT_BITS * LEVEL_NUM)) - 1;
+    }
+    Slot* slot = &slots_[level][(node->expires >> (SLOT_BITS * level)) & (SLOT_NUM - 1)];
+    node->prev = slot->prev;
+    node->next = slot;
+    slot->prev->next = node;
+    slot->prev = node;
+}
+
+void TimingWheel::Unlink_(TimerNode* node) {
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+    node->prev = node->next = nullptr;
+}
+
+/**
+ * @brief 把level层当前的槽重新分散到下层, 先整体摘下再逐个插入, 插回同一个槽的节点不会被重复处理
+ * @return 该槽的槽号, 为0时说明该层也转完一圈, 需要继续处理上一层
+*/
+int TimingWheel::Cascade_(int level) {
+    int idx = (current_ >> (SLOT_BITS * level)) & (SLOT_NUM - 1);
+    Slot* slot = &slots_[level][idx];
+    if (slot->next != slot) {
+        Slot pending;
+        pending.next = slot->next;
+        pending.prev = slot->prev;
+        pending.next->prev = pending.prev->next = &pending;
+        slot->prev = slot->next = slot;
+        while (pending.next != &pending) {
+            TimerNode* node = pending.next;
+            Unlink_(node);
+            Insert_(node);
+        }
+    }
+    return idx;
+}
+
+/**
+ * @brief 逐个tick推进到当前时间; 到期的槽先整体摘下, 回调中可以任意添加、取消其他节点
+*/
+void TimingWheel::tick() {
+    uint64_t now = Now_();
+    if (count_ == 0) {
+        current_ = std::max(current_, now + 1);
+        return;
+    }
+    while (current_ <= now) {
+        int idx = current_ & (SLOT_NUM - 1);
+        if (idx == 0) {
+            for (int level = 1; level < LEVEL_NUM && Cascade_(level) == 0; level++) {
+            }
+        }
+        Slot* slot = &slots_[0][idx];
+        current_++;
+        if (slot->next == slot) {
+            continue;
+        }
+        Slot expired;
+        expired.next = slot->next;
+        expired.prev = slot->prev;
+        expired.next->prev = expired.prev->next = &expired;
+        slot->prev = slot->next = slot;
+        while (expired.next != &expired) {
+            TimerNode* node = expired.next;
+            Unlink_(node);
+            count_--;
+            callback_(node);
+        }
+    }
+}
+
+/**
+ * @brief 第0层的下一个非空槽, 最迟醒在下一次分散上层的时刻(上层的节点可能在那之后很快到期)
+*/
+int TimingWheel::GetNextTick() {
+    tick();
+    if (count_ == 0) {
+        return -1;
+    }
+    uint64_t ticks = (SLOT_NUM - (current_ & (SLOT_NUM - 1))) & (SLOT_NUM - 1);
+    for (uint64_t i = 0; i < ticks; i++) {
+        const Slot* slot = &slots_[0][(current_ + i) & (SLOT_NUM - 1)];
+        if (slot->next != slot) {
+            ticks = i;
+            break;
+        }
+    }
+    int64_t elapsed = std::chrono::duration_cast<MS>(CoarseClock::Instance()->Now() - start_).count();
+    int64_t res = int64_t(current_ + ticks) * tickMS_ - elapsed;
+    return res < 0 ? 0 : res;
+}
@@ -0,0 +1,93 @@
+#ifndef TIMING_WHEEL_H
+#define TIMING_WHEEL_H
+
+#include <assert.h>
+#include <stdint.h>
+
+#include <chrono>
+#include <functional>
+
+#include "clock.h"
+
+/**
+ * @brief 侵入式定时器节点, 嵌在被管理的对象中, 由时间轮串进槽位的双向链表
+ * data由持有者设置, 到期回调中用它找回持有者
+*/
+struct TimerNode {
+    TimerNode* prev = nullptr;
+    TimerNode* next = nullptr;
+    uint64_t expires = 0;   // 到期的tick
+    void* data = nullptr;   // 持有者
+
+    bool Linked() const { return next != nullptr; }
+};
+
+typedef std::function<void(TimerNode*)> TimeoutCallBack;   // 超时回调函数
+
+/**
+ * @brief 分层时间轮, 只由事件循环线程使用
+ * LEVEL_NUM层各SLOT_NUM个槽, 第i层一个槽覆盖SLOT_NUM^i个tick; 添加、取消、重新定时都是O(1)的链表操作,
+ * 低层转完一圈时把上一层的一个槽重新分散到低层. 超出最大范围的定时按最大范围处理
+*/
+class TimingWheel {
+public:
+    /**
+     * @param tickMS 一个tick的毫秒数, 即定时精度
+     * @param cb 节点到期时的回调, 调用前节点已摘下
+    */
+    TimingWheel(int tickMS, const TimeoutCallBack& cb);
+    ~TimingWheel() { clear(); }
+
+    TimingWheel(const TimingWheel&) = delete;
+    TimingWheel& operator=(const TimingWheel&) = delete;
+
+    /**
+     * @brief 从现在起timeout毫秒后到期, 节点已在轮中时重新定时
+    */
+    void add(TimerNode* node, int timeout);
+    void adjust(TimerNode* node, int timeout) { add(node, timeout); }
+
+    /**
+     * @brief 取消定时, 节点不在轮中时什么也不做
+    */
+    void del(TimerNode* node);
+
+    /**
+     * @brief 摘下所有节点, 不调用回调
+    */
+    void clear();
+
+    /**
+     * @brief 推进到当前时间, 调用到期节点的回调
+    */
+    void tick();
+
+    /**
+     * @brief 推进后距下一个可能到期的槽的毫秒数, 没有定时器时返回-1
+    */
+    int GetNextTick();
+
+    size_t size() const { return count_; }
+
+    static constexpr int SLOT_BITS = 6;
+    static constexpr int SLOT_NUM = 1 << SLOT_BITS;     // 每层的槽数
+    static constexpr int LEVEL_NUM = 4;                 // 层数, tick为100ms时可定时约19天
+
+private:
+    typedef TimerNode Slot;     // 槽是循环链表的哨兵
+
+    void Insert_(TimerNode* node);
+    int Cascade_(int level);
+    static void Unlink_(TimerNode* node);
+
+    uint64_t Now_() const;
+
+    Slot slots_[LEVEL_NUM][SLOT_NUM];
+    uint64_t current_;          // 下一个要处理的tick
+    size_t count_;              // 轮中的节点数
+    int tickMS_;
+    TimeStamp start_;           // tick 0对应的时间
+    TimeoutCallBack callback_;
+};
+
+#endif
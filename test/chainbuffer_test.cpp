@@ -0,0 +1,132 @@
+/**
+ * @brief ChunkPool分级取块/归还, ChainBuffer跨块的追加、消费、截断与读写fd
+*/
+#include "../code/buffer/chainbuffer.h"
+#include "test.h"
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <string>
+
+namespace {
+
+/**
+ * @brief 按PeekIov拼出从offset开始的全部可读数据
+*/
+std::string Contents(const ChainBuffer& buff, size_t offset = 0) {
+    struct iovec iov[64];
+    int cnt = buff.PeekIov(iov, 64, offset);
+    std::string out;
+    for (int i = 0; i < cnt; i++) {
+        out.append(static_cast<const char*>(iov[i].iov_base), iov[i].iov_len);
+    }
+    return out;
+}
+
+std::string Pattern(size_t len) {
+    std::string data(len, '\0');
+    for (size_t i = 0; i < len; i++) {
+        data[i] = static_cast<char>('a' + i % 26);
+    }
+    return data;
+}
+
+}  // namespace
+
+TEST(ChunkPoolClasses) {
+    ChunkPool* pool = ChunkPool::Instance();
+    ChunkPool::Chunk* small = pool->Get(1);
+    ChunkPool::Chunk* middle = pool->Get(5000);
+    ChunkPool::Chunk* large = pool->Get(1 << 20);
+    CHECK_EQ(small->cap, ChunkPool::CLASS_SIZE[0]);
+    CHECK_EQ(middle->cap, ChunkPool::CLASS_SIZE[1]);
+    CHECK_EQ(large->cap, ChunkPool::CLASS_SIZE[2]);
+    CHECK_EQ(small->Readable(), 0u);
+    CHECK_EQ(small->Writable(), small->cap);
+
+    size_t cached = pool->Cached();
+    pool->Put(small);
+    pool->Put(middle);
+    pool->Put(large);
+    CHECK_EQ(pool->Cached(), cached + 3);
+    /* 归还的块被复用, 读写位置重置 */
+    ChunkPool::Chunk* reused = pool->Get(100);
+    CHECK(reused == small);
+    CHECK_EQ(reused->read + reused->write, 0u);
+    pool->Put(reused);
+}
+
+TEST(ChainBufferAppendAcrossChunks) {
+    std::string data = Pattern(200 * 1024);
+    ChainBuffer buff;
+    for (size_t i = 0; i < data.size(); i += 1000) {
+        buff.Append(data.data() + i, std::min<size_t>(1000, data.size() - i));
+    }
+    CHECK_EQ(buff.ReadableBytes(), data.size());
+    CHECK(Contents(buff) == data);
+    CHECK(Contents(buff, 4096 + 7) == data.substr(4096 + 7));
+}
+
+TEST(ChainBufferRetrieve) {
+    std::string data = Pattern(100 * 1024);
+    ChainBuffer buff;
+    buff.Append(data);
+    size_t cached = ChunkPool::Instance()->Cached();
+    buff.Retrieve(70 * 1024);
+    CHECK_EQ(buff.ReadableBytes(), data.size() - 70 * 1024);
+    CHECK(Contents(buff) == data.substr(70 * 1024));
+    /* 读完的块立即归还 */
+    CHECK(ChunkPool::Instance()->Cached() > cached);
+    buff.Retrieve(buff.ReadableBytes());
+    CHECK_EQ(buff.ReadableBytes(), 0u);
+    CHECK(Contents(buff).empty());
+    buff.Append("again");
+    CHECK(Contents(buff) == "again");
+}
+
+TEST(ChainBufferTruncate) {
+    std::string data = Pattern(100 * 1024);
+    ChainBuffer buff;
+    buff.Append(data);
+    buff.Truncate(data.size() + 1);
+    CHECK_EQ(buff.ReadableBytes(), data.size());
+    buff.Truncate(5000);
+    CHECK_EQ(buff.ReadableBytes(), 5000u);
+    CHECK(Contents(buff) == data.substr(0, 5000));
+    /* 截断后从新的尾部继续追加 */
+    buff.Append("tail");
+    CHECK(Contents(buff) == data.substr(0, 5000) + "tail");
+    buff.Retrieve(100);
+    buff.Truncate(10);
+    CHECK(Contents(buff) == data.substr(100, 10));
+    buff.Truncate(0);
+    CHECK_EQ(buff.ReadableBytes(), 0u);
+}
+
+TEST(ChainBufferReadWriteFd) {
+    int fds[2];
+    CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    /* 阻塞的socket, 数据不超过socket缓冲区, 写端不会卡住 */
+    std::string data = Pattern(48 * 1024);
+    ChainBuffer out;
+    out.Append(data);
+    ChainBuffer in;
+    int err = 0;
+    size_t received = 0;
+    while (out.ReadableBytes() > 0 || received < data.size()) {
+        if (out.ReadableBytes() > 0) {
+            CHECK(out.WriteFd(fds[0], &err) > 0);
+        }
+        ssize_t n = in.ReadFd(fds[1], &err);
+        CHECK(n > 0);
+        if (n <= 0) {
+            break;
+        }
+        received += n;
+    }
+    CHECK_EQ(in.ReadableBytes(), data.size());
+    CHECK(Contents(in) == data);
+    close(fds[0]);
+    close(fds[1]);
+}
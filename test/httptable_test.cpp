@@ -0,0 +1,56 @@
+/**
+ * @brief 编译期完美哈希表: 每个条目都能查回自己, 大小写规则, 未知key返回默认值
+*/
+#include "../code/http/httptable.h"
+#include "test.h"
+
+#include <string>
+
+TEST(HeaderTableFindsEveryEntry) {
+    for (const auto& entry : HEADER_TABLE) {
+        CHECK(LookupHeader(entry.key) == entry.value);
+    }
+}
+
+TEST(HeaderTableIgnoresCase) {
+    CHECK(LookupHeader("content-length") == HttpHeader::CONTENT_LENGTH);
+    CHECK(LookupHeader("CONTENT-LENGTH") == HttpHeader::CONTENT_LENGTH);
+    CHECK(LookupHeader("Content-Lengt") == HttpHeader::UNKNOWN);
+    CHECK(LookupHeader("Content-Length ") == HttpHeader::UNKNOWN);
+    CHECK(LookupHeader("") == HttpHeader::UNKNOWN);
+    CHECK(LookupHeader("X-Forwarded-For") == HttpHeader::UNKNOWN);
+}
+
+TEST(MimeTypeBySuffix) {
+    for (const auto& entry : SUFFIX_TYPE) {
+        CHECK(LookupMimeType("/dir/file" + std::string(entry.key)) == entry.value);
+    }
+    CHECK(LookupMimeType("/INDEX.HTML") == "text/html");
+    CHECK(LookupMimeType("/a.b/file") == "text/plain");
+    CHECK(LookupMimeType("/file") == "text/plain");
+    CHECK(LookupMimeType("/file.unknown") == "text/plain");
+}
+
+TEST(ExactAndIntKeys) {
+    constexpr auto paths = httptable::MakeStaticMap<httptable::ExactKey, int>({
+        {"/index", 1}, {"/login", 2}, {"/register", 3},
+    });
+    static_assert(paths.Valid(), "no perfect hash seed");
+    CHECK_EQ(paths.Get("/login", 0), 2);
+    CHECK_EQ(paths.Get("/LOGIN", 0), 0);
+    CHECK(paths.Find("/logout") == nullptr);
+
+    constexpr auto codes = httptable::MakeStaticMap<httptable::IntKey, int>({
+        {200, 1}, {304, 2}, {404, 3}, {405, 4}, {503, 5},
+    });
+    static_assert(codes.Valid(), "no perfect hash seed");
+    CHECK_EQ(codes.Get(405, 0), 4);
+    CHECK_EQ(codes.Get(500, 0), 0);
+}
+
+TEST(ContainsToken) {
+    CHECK(httptable::ContainsToken("keep-alive, Upgrade", "upgrade"));
+    CHECK(httptable::ContainsToken(" close ", "close"));
+    CHECK(!httptable::ContainsToken("keep-alive-ish", "keep-alive"));
+    CHECK(!httptable::ContainsToken("", "close"));
+}
@@ -0,0 +1,151 @@
+/**
+ * @brief 路由: 静态 > 参数 > 前缀的优先级, 冲突路由的拒绝, 404/405与Allow
+*/
+#include "../code/http/router.h"
+#include "test.h"
+
+namespace {
+
+typedef void (*HandlerFunc)(HttpRequest&, HttpResponse&);
+
+void Index(HttpRequest&, HttpResponse&) {}
+void Login(HttpRequest&, HttpResponse&) {}
+void DoLogin(HttpRequest&, HttpResponse&) {}
+void User(HttpRequest&, HttpResponse&) {}
+void Profile(HttpRequest&, HttpResponse&) {}
+void Files(HttpRequest&, HttpResponse&) {}
+void StaticIndex(HttpRequest&, HttpResponse&) {}
+void Proxy(HttpRequest&, HttpResponse&) {}
+
+/**
+ * @brief 与webserver的默认路由相同的形状
+*/
+void Setup(Router* router) {
+    router->Get("/", Index);
+    router->Get("/login", Login);
+    router->Post("/login", DoLogin);
+    router->Get("/user/:id", User);
+    router->Get("/user/:id/profile", Profile);
+    router->Get("/static/*file", Files);
+    router->Get("/static/index.html", StaticIndex);
+    router->Add("*", "/api/*rest", Proxy);
+}
+
+/**
+ * @brief 查找并返回匹配到的处理函数, 没有匹配时为nullptr
+*/
+HandlerFunc Match(const Router& router, std::string_view method, std::string_view path,
+                  RouteParams* params, Router::MATCH_RESULT* result = nullptr, unsigned* allowed = nullptr) {
+    const Router::Handler* handler;
+    Router::MATCH_RESULT res = router.Find(method, path, &handler, params, allowed);
+    if (result) {
+        *result = res;
+    }
+    if (res != Router::MATCHED) {
+        return nullptr;
+    }
+    const HandlerFunc* func = handler->target<HandlerFunc>();
+    return func ? *func : nullptr;
+}
+
+}  // namespace
+
+TEST(RouterStaticBeforeParamBeforeCatchAll) {
+    Router router;
+    Setup(&router);
+    RouteParams params;
+    CHECK(Match(router, "GET", "/", &params) == Index);
+    CHECK(Match(router, "GET", "/login", &params) == Login);
+    CHECK(Match(router, "POST", "/login", &params) == DoLogin);
+    CHECK(Match(router, "HEAD", "/login", &params) == Login);
+
+    CHECK(Match(router, "GET", "/static/index.html", &params) == StaticIndex);
+    CHECK(Match(router, "GET", "/static/index.htm", &params) == Files);
+    CHECK_EQ(params.Get("file"), "index.htm");
+    CHECK(Match(router, "GET", "/static/css/a.css", &params) == Files);
+    CHECK_EQ(params.Get("file"), "css/a.css");
+    CHECK(Match(router, "GET", "/static/", &params) == Files);
+    CHECK_EQ(params.Get("file"), "");
+
+    CHECK(Match(router, "GET", "/user/42", &params) == User);
+    CHECK_EQ(params.size(), 1u);
+    CHECK_EQ(params.Get("id"), "42");
+    CHECK(Match(router, "GET", "/user/42/profile", &params) == Profile);
+    CHECK_EQ(params.Get("id"), "42");
+}
+
+TEST(RouterCatchAllFallbackDropsParams) {
+    Router router;
+    router.Get("/u/:id/profile", Profile);
+    router.Get("/u/*rest", Files);
+    RouteParams params;
+    CHECK(Match(router, "GET", "/u/7/profile", &params) == Profile);
+    CHECK_EQ(params.Get("id"), "7");
+    /* 参数路由走到一半失败, 退回前缀路由, 参数路由压入的参数要弹出 */
+    CHECK(Match(router, "GET", "/u/7/other", &params) == Files);
+    CHECK_EQ(params.size(), 1u);
+    CHECK_EQ(params.Get("id"), "");
+    CHECK_EQ(params.Get("rest"), "7/other");
+}
+
+TEST(RouterAnyMethod) {
+    Router router;
+    Setup(&router);
+    RouteParams params;
+    CHECK(Match(router, "DELETE", "/api/v1/items/3", &params) == Proxy);
+    CHECK_EQ(params.Get("rest"), "v1/items/3");
+    CHECK(Match(router, "GET", "/api/", &params) == Proxy);
+}
+
+TEST(RouterRejectsConflictingRoutes) {
+    Router router;
+    Setup(&router);
+    router.Get("/user/new", Index);       // 与/user/:id冲突, 被忽略
+    router.Get("/:page", Index);          // 与根下的静态段冲突, 被忽略
+    RouteParams params;
+    CHECK(Match(router, "GET", "/user/new", &params) == User);
+    CHECK_EQ(params.Get("id"), "new");
+    Router::MATCH_RESULT result;
+    CHECK(Match(router, "GET", "/about", &params, &result) == nullptr);
+    CHECK_EQ(result, Router::NOT_FOUND);
+}
+
+TEST(RouterNotFound) {
+    Router router;
+    Setup(&router);
+    RouteParams params;
+    Router::MATCH_RESULT result;
+    CHECK(Match(router, "GET", "/nope", &params, &result) == nullptr);
+    CHECK_EQ(result, Router::NOT_FOUND);
+    CHECK(Match(router, "GET", "/logins", &params, &result) == nullptr);
+    CHECK_EQ(result, Router::NOT_FOUND);
+    CHECK(Match(router, "GET", "/user/", &params, &result) == nullptr);
+    CHECK_EQ(result, Router::NOT_FOUND);
+    CHECK(Match(router, "GET", "", &params, &result) == nullptr);
+    CHECK_EQ(result, Router::NOT_FOUND);
+    /* 前缀路由只对注册过的方法算作路径存在 */
+    CHECK(Match(router, "POST", "/static/a.css", &params, &result) == nullptr);
+    CHECK_EQ(result, Router::NOT_FOUND);
+}
+
+TEST(RouterNotAllowedReportsMethods) {
+    Router router;
+    Setup(&router);
+    RouteParams params;
+    Router::MATCH_RESULT result;
+    unsigned allowed = 0;
+    CHECK(Match(router, "DELETE", "/login", &params, &result, &allowed) == nullptr);
+    CHECK_EQ(result, Router::NOT_ALLOWED);
+    CHECK_EQ(Router::AllowList(allowed), "GET, HEAD, POST");
+
+    CHECK(Match(router, "PUT", "/user/1", &params, &result, &allowed) == nullptr);
+    CHECK_EQ(result, Router::NOT_ALLOWED);
+    CHECK_EQ(Router::AllowList(allowed), "GET, HEAD");
+
+    CHECK(Match(router, "BREW", "/", &params, &result, &allowed) == nullptr);
+    CHECK_EQ(result, Router::NOT_ALLOWED);
+    CHECK_EQ(Router::AllowList(allowed), "GET, HEAD");
+
+    CHECK(Match(router, "GET", "/login", &params, &result, &allowed) == Login);
+    CHECK_EQ(allowed, 0u);
+}
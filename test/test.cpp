@@ -0,0 +1,28 @@
+/**
+ * @brief 依次运行所有注册的用例, 有失败时返回非0
+*/
+#include "test.h"
+
+namespace test {
+
+std::vector<Case>& Cases() {
+    static std::vector<Case> cases;
+    return cases;
+}
+
+int failures = 0;
+
+}  // namespace test
+
+int main() {
+    int failed = 0;
+    for (const test::Case& c : test::Cases()) {
+        int before = test::failures;
+        c.func();
+        bool ok = test::failures == before;
+        printf("[%s] %s\n", ok ? "  OK  " : " FAIL ", c.name);
+        failed += !ok;
+    }
+    printf("%zu cases, %d failed\n", test::Cases().size(), failed);
+    return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,42 @@
+/**
+ * @brief 极简单元测试框架: TEST注册用例, CHECK失败时打印位置并计数, 不中断当前用例
+*/
+#ifndef TEST_H
+#define TEST_H
+
+#include <stdio.h>
+
+#include <vector>
+
+namespace test {
+
+struct Case {
+    const char* name;
+    void (*func)();
+};
+
+std::vector<Case>& Cases();
+extern int failures;
+
+struct Register {
+    Register(const char* name, void (*func)()) { Cases().push_back({name, func}); }
+};
+
+}  // namespace test
+
+#define TEST(name)                                        \
+    static void name();                                   \
+    static test::Register name##Register_(#name, name);   \
+    static void name()
+
+#define CHECK(cond)                                                                 \
+    do {                                                                            \
+        if (!(cond)) {                                                              \
+            fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond); \
+            test::failures++;                                                       \
+        }                                                                           \
+    } while (0)
+
+#define CHECK_EQ(a, b) CHECK((a) == (b))
+
+#endif
@@ -0,0 +1,93 @@
+/**
+ * @brief 时间轮: 不提前到期, 上层的节点分散到下层后按时到期, 取消与重新定时
+ * 使用真实时钟, tick为1ms, 超过SLOT_NUM个tick的定时要经过一次上层分散
+*/
+#include "../code/timer/timingwheel.h"
+#include "test.h"
+
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct Timer {
+    TimerNode node;
+    int id = 0;
+    int64_t firedMS = -1;   // 到期时距开始的毫秒数
+};
+
+/**
+ * @brief 推进时钟直到轮空或超过limitMS
+*/
+void Run(TimingWheel& wheel, TimeStamp start, int limitMS) {
+    while (wheel.size() > 0) {
+        std::this_thread::sleep_for(MS(1));
+        CoarseClock::Instance()->Update();
+        if (CoarseClock::Instance()->Now() - start > MS(limitMS)) {
+            break;
+        }
+        wheel.tick();
+    }
+}
+
+}  // namespace
+
+TEST(TimingWheelExpiresInOrderAcrossLevels) {
+    CoarseClock::Instance()->Update();
+    TimeStamp start = CoarseClock::Instance()->Now();
+    std::vector<int> order;
+    TimingWheel wheel(1, [&](TimerNode* node) {
+        Timer* timer = static_cast<Timer*>(node->data);
+        timer->firedMS = std::chrono::duration_cast<MS>(CoarseClock::Instance()->Now() - start).count();
+        order.push_back(timer->id);
+    });
+    /* 5ms在第0层, 150ms和300ms在第1层, 要经过分散才到期 */
+    const int timeouts[] = {300, 5, 150, 40};
+    Timer timers[4];
+    for (int i = 0; i < 4; i++) {
+        timers[i].id = timeouts[i];
+        timers[i].node.data = &timers[i];
+        wheel.add(&timers[i].node, timeouts[i]);
+    }
+    CHECK_EQ(wheel.size(), 4u);
+    Run(wheel, start, 2000);
+    CHECK_EQ(wheel.size(), 0u);
+    CHECK((order == std::vector<int>{5, 40, 150, 300}));
+    for (const Timer& timer : timers) {
+        CHECK(timer.firedMS >= timer.id);
+        CHECK(!timer.node.Linked());
+    }
+}
+
+TEST(TimingWheelDeleteAndAdjust) {
+    CoarseClock::Instance()->Update();
+    TimeStamp start = CoarseClock::Instance()->Now();
+    std::vector<int> order;
+    TimingWheel wheel(1, [&](TimerNode* node) { order.push_back(static_cast<Timer*>(node->data)->id); });
+    Timer a, b, c;
+    a.id = 1, b.id = 2, c.id = 3;
+    a.node.data = &a, b.node.data = &b, c.node.data = &c;
+    wheel.add(&a.node, 20);
+    wheel.add(&b.node, 30);
+    wheel.add(&c.node, 10);
+    wheel.del(&c.node);
+    wheel.del(&c.node);         // 不在轮中时什么也不做
+    wheel.adjust(&a.node, 100); // 推迟到b之后, 跨到第1层
+    CHECK_EQ(wheel.size(), 2u);
+    Run(wheel, start, 2000);
+    CHECK((order == std::vector<int>{2, 1}));
+}
+
+TEST(TimingWheelNextTick) {
+    CoarseClock::Instance()->Update();
+    TimingWheel wheel(10, [](TimerNode*) {});
+    CHECK_EQ(wheel.GetNextTick(), -1);
+    TimerNode node;
+    wheel.add(&node, 35);
+    int next = wheel.GetNextTick();
+    CHECK(next >= 0 && next <= 40);
+    wheel.clear();
+    CHECK_EQ(wheel.size(), 0u);
+    CHECK(!node.Linked());
+    CHECK_EQ(wheel.GetNextTick(), -1);
+}